@@ -11,6 +11,8 @@ BuildRequires:  meson
 BuildRequires:  gcc
 BuildRequires:  gstreamer1-devel
 BuildRequires:  glib2-devel
+BuildRequires:  json-glib-devel
+BuildRequires:  opus-devel
 BuildRequires:  gettext
 
 %description
@@ -32,6 +34,16 @@ Gstreamer plugin for VOSK voice recognition engine.
 %doc AUTHORS README.md
 %{_libdir}/gstreamer-1.0/libgstvosk.so
 %{_libdir}/libvosk.so
+%{_libdir}/libgstvoskcore.so*
+%{_libdir}/libgstvoskresult.so*
+%{_includedir}/gst-vosk/gstvoskcore.h
+%{_includedir}/gst-vosk/gstvoskresult.h
+%{_libdir}/pkgconfig/gstvoskcore.pc
+%{_libdir}/pkgconfig/gstvoskresult.pc
+%{_bindir}/gst-vosk-evaluate
+%{_bindir}/gst-vosk-autotune
+%{_bindir}/gst-vosk-pack
+%{_bindir}/gst-vosk-prefork
 
 %changelog
 * Sun Jul 31 2022 Philippe Rouquier <bonfire-app@wanadoo.fr> 0.1.0-1
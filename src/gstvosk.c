@@ -19,29 +19,51 @@
 
 #include <libintl.h>
 #include <locale.h>
+#include <unistd.h>
 
 #include <glib.h>
 #include <gio/gio.h>
 #include <gst/gst.h>
 
 #include "gstvosk.h"
+#include "gstvoskbatcher.h"
+#include "gstvoskcore.h"
 #include "vosk-api.h"
 #include "../gst-vosk-config.h"
 
-GST_DEBUG_CATEGORY_STATIC (gst_vosk_debug);
+GST_DEBUG_CATEGORY (gst_vosk_debug);
 #define GST_CAT_DEFAULT gst_vosk_debug
 
 #define DEFAULT_SPEECH_MODEL "/usr/share/vosk/model"
 #define DEFAULT_ALTERNATIVE_NUM 0
+#define DEFAULT_RESCORING_THRESHOLD 0.7
+#define DEFAULT_BATCH_DEADLINE 50
+#define DEFAULT_BATCH_SIZE 32
+#define DEFAULT_PULL_READ_SIZE 0
+#define DEFAULT_CPU_WARNING_RATIO 0.0
+#define DEFAULT_WAKE_PREROLL 1500
+#define DEFAULT_LAZY_HISTORY 0
+#define DEFAULT_DUPLICATE_TOLERANCE 500
+#define DEFAULT_CAPTION_FPS_N 30000
+#define DEFAULT_CAPTION_FPS_D 1001
 
 #define _(STRING) gettext(STRING)
 
 #define GST_VOSK_LOCK(vosk) (g_mutex_lock(&vosk->RecMut))
 #define GST_VOSK_UNLOCK(vosk) (g_mutex_unlock(&vosk->RecMut))
 
+#define GST_VOSK_HAS_RECOGNIZER(vosk) \
+  (vosk->core != NULL && gst_vosk_core_is_started (vosk->core))
+
 enum
 {
   RESULT,
+  REVISED_RESULT,
+  RESULTS,
+  TENTATIVE_RESULT,
+  RETRACTED_RESULT,
+  TRANSCRIBE,
+  TRANSCRIPTION,
   LAST_SIGNAL
 };
 
@@ -56,91 +78,154 @@ enum
   PROP_CURRENT_FINAL_RESULTS,
   PROP_CURRENT_RESULTS,
   PROP_PARTIAL_RESULTS_INTERVAL,
+  PROP_RESCORING_MODEL,
+  PROP_RESCORING_THRESHOLD,
+  PROP_MAX_UTTERANCE_DURATION,
+  PROP_RECYCLE_INTERVAL,
+  PROP_STATS,
+  PROP_CONFIG_FILE,
+  PROP_BATCH,
+  PROP_BATCH_DEADLINE,
+  PROP_BATCH_SIZE,
+  PROP_MODEL_MAP,
+  PROP_SUSPENDED,
+  PROP_CAPTION_FRAMERATE,
+  PROP_PULL_READ_SIZE,
+  PROP_CPU_WARNING_RATIO,
+  PROP_SPECULATIVE_SILENCE,
+  PROP_WAKE_PHRASES,
+  PROP_WAKE_PREROLL,
+  PROP_LAZY_HISTORY,
+  PROP_LAZY_COMPRESS,
+  PROP_DEDUPLICATE,
+  PROP_DUPLICATE_TOLERANCE,
+  PROP_RESULT_FORMAT,
+  PROP_TRICK_MODE_RESULTS,
 };
 
+/* Audio decoded before the CPU cost of a stream is compared with
+ * cpu-warning-ratio, so that the first utterances do not trigger it */
+#define CPU_WARNING_MIN_DURATION (10 * GST_SECOND)
+
+/* Silence a batch stream is given for a gap, enough for its endpointer to
+ * end the utterance */
+#define BATCH_GAP_SILENCE GST_SECOND
+
+/* Number of blocks read ahead of decoding in pull mode */
+#define PULL_READ_AHEAD 2
+
+/* Final results kept to be given again during trick modes */
+#define TRICK_RESULTS_MAX 512
+
+/* Segment flags meaning that audio is skipped */
+#define GST_VOSK_TRICK_MODE_FLAGS (GST_SEGMENT_FLAG_TRICKMODE | \
+                                   GST_SEGMENT_FLAG_TRICKMODE_KEY_UNITS | \
+                                   GST_SEGMENT_FLAG_TRICKMODE_NO_AUDIO)
+
+/*
+ * Serialized downstream events that suspend and resume recognition at an exact
+ * point of the stream. "vosk-suspend" may carry a "resume-time" field
+ * (GstClockTime, compared with buffer timestamps) to resume by itself.
+ */
+#define GST_VOSK_SUSPEND_EVENT "vosk-suspend"
+#define GST_VOSK_RESUME_EVENT "vosk-resume"
+
+/*
+ * Serialized downstream event asking for the transcription of the history
+ * (lazy mode) between its "start" and "stop" fields (GstClockTime, compared
+ * with buffer timestamps). Without "stop", up to the event.
+ */
+#define GST_VOSK_TRANSCRIBE_EVENT "vosk-transcribe"
+
+/* Transcriptions are fed to their recognizer by blocks of that duration so
+ * that utterance ends are detected */
+#define TRANSCRIPTION_BLOCK (100 * GST_MSECOND)
+
 /*
  * gst-launch-1.0 -m pulsesrc  buffer-time=9223372036854775807 ! \
  *                   audio/x-raw,format=S16LE,rate=16000, channels=1 ! \
  *                   vosk speech-model=path/to/model ! fakesink
 */
 
-#define VOSK_EMPTY_PARTIAL_RESULT  "{\n  \"partial\" : \"\"\n}"
 #define VOSK_EMPTY_TEXT_RESULT     "{\n  \"text\" : \"\"\n}"
 #define VOSK_EMPTY_TEXT_RESULT_ALT "{\"text\": \"\"}"
 
-/* BUG : protect from local formatting errors when fr_ prefix
-   Maybe there are other locales ?
-   Use uselocale () when we can as it is supposed to be safer since it sets
-   the locale only for the thread. */
-#if HAVE_USELOCALE
-
-#define PROTECT_FROM_LOCALE_BUG_START                         \
-  locale_t current_locale;                                    \
-  locale_t new_locale;                                        \
-  locale_t old_locale = NULL;                                 \
-                                                              \
-  current_locale = uselocale (NULL);                          \
-  old_locale = duplocale (current_locale);                    \
-  new_locale = newlocale (LC_NUMERIC_MASK, "C", old_locale);  \
-  if (new_locale)                                             \
-    uselocale (new_locale);
+/* Key of the speech-model core in the model pool */
+#define GST_VOSK_DEFAULT_LANGUAGE ""
 
+#ifdef HAVE_OPUS
+#define GST_VOSK_OPUS_CAPS "; audio/x-opus, channel-mapping-family=0"
 #else
-
-#define PROTECT_FROM_LOCALE_BUG_START                         \
-  gchar *saved_locale = NULL;                                 \
-  const gchar *current_locale;                                \
-  current_locale = setlocale(LC_NUMERIC, NULL);               \
-  if (current_locale != NULL &&                               \
-      g_str_has_prefix (current_locale, "fr_") == TRUE) {     \
-    saved_locale = g_strdup (current_locale);                 \
-    setlocale (LC_NUMERIC, "C");                              \
-    GST_LOG_OBJECT (vosk, "Changed locale %s", saved_locale); \
-  }
-
+#define GST_VOSK_OPUS_CAPS
 #endif
 
-#if HAVE_USELOCALE
-
-#define PROTECT_FROM_LOCALE_BUG_END                           \
-  if (old_locale) {                                           \
-    uselocale (current_locale);                               \
-    freelocale (new_locale);                                  \
-  }
-
-#else
-
-#define PROTECT_FROM_LOCALE_BUG_END                           \
-  if (saved_locale != NULL) {                                 \
-    setlocale (LC_NUMERIC, saved_locale);                     \
-    GST_LOG_OBJECT (vosk, "Reset locale %s", saved_locale);   \
-    g_free (saved_locale);                                    \
-  }
-
-#endif
+/* Encoded audio is decoded for recognition and goes downstream untouched */
+#define GST_VOSK_CAPS "audio/x-raw," \
+                      "format=S16LE," \
+                      "rate=[1, MAX]," \
+                      "channels=1; " \
+                      "audio/x-mulaw," \
+                      "rate=[1, MAX]," \
+                      "channels=1; " \
+                      "audio/x-alaw," \
+                      "rate=[1, MAX]," \
+                      "channels=1" \
+                      GST_VOSK_OPUS_CAPS
 
 /* the capabilities of the inputs and outputs. */
 static GstStaticPadTemplate sink_factory = GST_STATIC_PAD_TEMPLATE ("sink",
     GST_PAD_SINK,
     GST_PAD_ALWAYS,
-    GST_STATIC_CAPS ("audio/x-raw,"
-                     "format=S16LE,"
-                     "rate=[1, MAX],"
-                     "channels=1")
+    GST_STATIC_CAPS (GST_VOSK_CAPS)
     );
 
 static GstStaticPadTemplate src_factory = GST_STATIC_PAD_TEMPLATE ("src",
     GST_PAD_SRC,
     GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_VOSK_CAPS)
+    );
+
+/* Each buffer holds the audio of one utterance, see GST_VOSK_RESULT_META.
+ * Encoded input is exported decoded. */
+static GstStaticPadTemplate utterance_src_factory = GST_STATIC_PAD_TEMPLATE ("utterance_src",
+    GST_PAD_SRC,
+    GST_PAD_REQUEST,
     GST_STATIC_CAPS ("audio/x-raw,"
                      "format=S16LE,"
                      "rate=[1, MAX],"
                      "channels=1")
     );
 
+/* CEA-608 roll-up captions of the results, one byte pair per frame */
+static GstStaticPadTemplate caption_src_factory = GST_STATIC_PAD_TEMPLATE ("caption_src",
+    GST_PAD_SRC,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS ("closedcaption/x-cea-608,"
+                     "format=raw,"
+                     "framerate=[1/1, MAX]")
+    );
+
 #define gst_vosk_parent_class parent_class
 G_DEFINE_TYPE (GstVosk, gst_vosk, GST_TYPE_ELEMENT);
 
+GType
+gst_vosk_result_format_get_type (void)
+{
+  static gsize format_type = 0;
+  static const GEnumValue formats[] = {
+    { GST_VOSK_RESULT_FORMAT_JSON, "JSON text as given by libvosk", "json" },
+    { GST_VOSK_RESULT_FORMAT_CBOR, "Compact CBOR encoding (GBytes)", "cbor" },
+    { 0, NULL, NULL },
+  };
+
+  if (g_once_init_enter (&format_type)) {
+    GType type = g_enum_register_static ("GstVoskResultFormat", formats);
+    g_once_init_leave (&format_type, type);
+  }
+
+  return format_type;
+}
+
 static void
 gst_vosk_set_property (GObject * object, guint prop_id,
                        const GValue * value, GParamSpec * pspec);
@@ -152,16 +237,123 @@ static GstStateChangeReturn
 gst_vosk_change_state (GstElement *element,
                        GstStateChange transition);
 
+static GstPad *
+gst_vosk_request_new_pad (GstElement *element,
+                          GstPadTemplate *templ,
+                          const gchar *name,
+                          const GstCaps *caps);
+
+static void
+gst_vosk_release_pad (GstElement *element,
+                      GstPad *pad);
+
+static GstIterator *
+gst_vosk_iterate_internal_links (GstPad *pad,
+                                 GstObject *parent);
+
 static gboolean
 gst_vosk_sink_event (GstPad * pad, GstObject * parent, GstEvent * event);
 
 static GstFlowReturn
 gst_vosk_chain (GstPad * pad, GstObject * parent, GstBuffer * buf);
 
+static gboolean
+gst_vosk_sink_activate (GstPad *pad, GstObject *parent);
+
+static gboolean
+gst_vosk_sink_activate_mode (GstPad *pad,
+                             GstObject *parent,
+                             GstPadMode mode,
+                             gboolean active);
+
+static gboolean
+gst_vosk_query (GstPad *pad,
+                GstObject *parent,
+                GstQuery *query);
+
+static gboolean
+gst_vosk_src_event (GstPad *pad,
+                    GstObject *parent,
+                    GstEvent *event);
+
 static void
 gst_vosk_load_model_async (gpointer thread_data,
                            gpointer element);
 
+static void
+gst_vosk_batch_result (GstElement *element,
+                       const gchar *json_txt);
+
+static void
+gst_vosk_configure_core (GstVosk *vosk);
+
+static void
+gst_vosk_switch_language (GstVosk *vosk,
+                          const gchar *language);
+
+static void
+gst_vosk_set_suspended (GstVosk *vosk,
+                        gboolean suspended,
+                        GstClockTime resume_time);
+
+static void
+gst_vosk_results_deliver (GstVosk *vosk);
+
+static void
+gst_vosk_message_new (GstVosk *vosk,
+                      const gchar *field,
+                      const gchar *text_results,
+                      guint64 utterance_id,
+                      GstClockTime cpu_time);
+
+static void
+gst_vosk_result_post (GstVosk *vosk, GstVoskCoreResult *result);
+
+/*
+ * Results are built as JSON (which is what other elements sharing them get)
+ * and encoded right before being queued if result-format asks for it. JSON
+ * that cannot be encoded is kept as is.
+ */
+static void
+gst_vosk_encode_results (GstVosk *vosk,
+                         GstStructure *contents)
+{
+  static const gchar *fields[] = {
+    "current-result",
+    "tentative-result",
+    "retracted-result",
+    "revised-result",
+    "cached-result",
+    NULL
+  };
+  guint i;
+
+  if (vosk->result_format != GST_VOSK_RESULT_FORMAT_CBOR)
+    return;
+
+  for (i = 0; fields[i]; i++) {
+    const gchar *json_txt;
+    GBytes *bytes;
+
+    json_txt = gst_structure_get_string (contents, fields[i]);
+    if (!json_txt || !(bytes = gst_vosk_result_encode (json_txt)))
+      continue;
+
+    gst_structure_set (contents, fields[i], G_TYPE_BYTES, bytes, NULL);
+    g_bytes_unref (bytes);
+  }
+}
+
+static void
+gst_vosk_revised_result (gpointer user_data,
+                         guint64 utterance_id,
+                         const gchar *json_txt);
+
+static guint64
+gst_vosk_transcribe (GstVosk *vosk,
+                     GstClockTime start,
+                     GstClockTime stop);
+
 /* Note : audio rate is handled by the application with the use of caps */
 
 static void
@@ -174,6 +366,32 @@ gst_vosk_finalize (GObject *object)
     vosk->model_path = NULL;
   }
 
+  if (vosk->rescoring_model_path) {
+    g_free (vosk->rescoring_model_path);
+    vosk->rescoring_model_path = NULL;
+  }
+
+  g_free (vosk->config_file);
+  vosk->config_file = NULL;
+
+  g_free (vosk->wake_phrases);
+  vosk->wake_phrases = NULL;
+
+  g_list_free (vosk->proxy_pads);
+  vosk->proxy_pads = NULL;
+
+  g_queue_clear_full (&vosk->results_pending, (GDestroyNotify) gst_structure_free);
+  g_queue_clear_full (&vosk->trick_results, (GDestroyNotify) gst_structure_free);
+  g_rec_mutex_clear (&vosk->DeliverMut);
+  g_cond_clear (&vosk->ReadyCond);
+  g_mutex_clear (&vosk->PullMut);
+  g_cond_clear (&vosk->PullCond);
+
+  if (vosk->model_map) {
+    gst_structure_free (vosk->model_map);
+    vosk->model_map = NULL;
+  }
+
   g_thread_pool_free(vosk->thread_pool, TRUE, TRUE);
   vosk->thread_pool=NULL;
 
@@ -202,7 +420,7 @@ gst_vosk_class_init (GstVoskClass * klass)
           DEFAULT_SPEECH_MODEL, G_PARAM_READWRITE|GST_PARAM_MUTABLE_READY));
 
   g_object_class_install_property (gobject_class, PROP_ALTERNATIVES,
-      g_param_spec_int ("alternatives", _("Alternative Number"), _("Number of alternative results returned"),
+      g_param_spec_int ("alternatives", _("Alternative Number"), _("Number of alternative results returned. Alternatives have no word confidence: utterances are not rescored when they are requested"),
           0, 100, DEFAULT_ALTERNATIVE_NUM, G_PARAM_READWRITE));
 
   g_object_class_install_property (gobject_class, PROP_CURRENT_FINAL_RESULTS,
@@ -217,6 +435,98 @@ gst_vosk_class_init (GstVoskClass * klass)
       g_param_spec_int64 ("partial-results-interval", _("Minimum time interval between partial results"), _("Set the minimum time interval between partial results (in milliseconds). Set -1 to disable partial results"),
           -1,G_MAXINT64, 0, G_PARAM_READWRITE));
 
+  g_object_class_install_property (gobject_class, PROP_RESCORING_MODEL,
+      g_param_spec_string ("rescoring-model", _("Rescoring Model"), _("Location (path) of a larger speech model used to decode again utterances with a low confidence. Enables word results. Disabled when alternatives are requested"),
+          NULL, G_PARAM_READWRITE|GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_RESCORING_THRESHOLD,
+      g_param_spec_double ("rescoring-threshold", _("Rescoring threshold"), _("Utterances with an average word confidence below this value are decoded again with the rescoring model"),
+          0.0, 1.0, DEFAULT_RESCORING_THRESHOLD, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_UTTERANCE_DURATION,
+      g_param_spec_int64 ("max-utterance-duration", _("Maximum utterance duration"), _("Force a final result at the next low energy point once an utterance lasts longer than this (in milliseconds). Set 0 for no limit"),
+          0, G_MAXINT64, 0, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_RECYCLE_INTERVAL,
+      g_param_spec_int64 ("recycle-interval", _("Recognizer recycling interval"), _("Create a new recognizer at the first utterance boundary once the current one has decoded that much audio (in milliseconds). Set 0 to never recycle"),
+          0, G_MAXINT64, 0, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", _("Statistics"), _("Various statistics about the recognizer"),
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_CONFIG_FILE,
+      g_param_spec_string ("config-file", _("Configuration file"), _("Location (path) of a key file whose [vosk] group sets other properties (see gst-vosk-autotune)"),
+          NULL, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_BATCH,
+      g_param_spec_boolean ("batch", _("Batch decoding"), _("Decode audio in micro-batches shared with the other elements of the process, using the batch model libvosk loads from ./model (speech-model is ignored). It needs a CUDA build of libvosk. There are no partial results"),
+          FALSE, G_PARAM_READWRITE|GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_BATCH_DEADLINE,
+      g_param_spec_int64 ("batch-deadline", _("Batch deadline"), _("Maximum time audio waits for a batch to be full before it is decoded (in milliseconds)"),
+          0, G_MAXINT64, DEFAULT_BATCH_DEADLINE, G_PARAM_READWRITE|GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_BATCH_SIZE,
+      g_param_spec_uint ("batch-size", _("Batch size"), _("Number of streams with audio waiting that triggers the decoding of a batch. It is shared by all the elements in batch mode, the smallest value applies"),
+          1, G_MAXUINT, DEFAULT_BATCH_SIZE, G_PARAM_READWRITE|GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_MODEL_MAP,
+      g_param_spec_boxed ("model-map", _("Model map"), _("Speech models preloaded for the languages of the stream, as a structure whose fields are language codes and values model paths (\"map, en=/path/en, fr=/path/fr\"). Language tags switch between them, other languages use speech-model"),
+          GST_TYPE_STRUCTURE, G_PARAM_READWRITE|GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_SUSPENDED,
+      g_param_spec_boolean ("suspended", _("Suspended"), _("Stop decoding audio (which still flows through the element) after ending the current utterance. See also the vosk-suspend and vosk-resume events"),
+          FALSE, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_CAPTION_FRAMERATE,
+      gst_param_spec_fraction ("caption-framerate", _("Caption frame rate"), _("Frame rate of the video the captions of the caption_src pad go with (one byte pair per frame)"),
+          1, 1, G_MAXINT, 1, DEFAULT_CAPTION_FPS_N, DEFAULT_CAPTION_FPS_D, G_PARAM_READWRITE|GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_PULL_READ_SIZE,
+      g_param_spec_uint ("pull-read-size", _("Pull read size"), _("When upstream allows it, pull blocks of that size (in bytes, rounded down to whole samples) from a reader thread that stays ahead of decoding instead of being pushed data. Bytes are read as raw mono S16 from the start of the stream, so upstream must provide fixed caps: rawaudioparse does, wavparse does not allow pulling and a capsfilter in front of a WAV file would have its header decoded. Set 0 to always be pushed data"),
+          0, G_MAXUINT, DEFAULT_PULL_READ_SIZE, G_PARAM_READWRITE|GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_CPU_WARNING_RATIO,
+      g_param_spec_double ("cpu-warning-ratio", _("CPU warning ratio"), _("Post a warning message once the recognition of the stream has used more than this many seconds of CPU per second of audio. Set 0 to disable"),
+          0.0, G_MAXDOUBLE, DEFAULT_CPU_WARNING_RATIO, G_PARAM_READWRITE|GST_PARAM_MUTABLE_PLAYING));
+
+  g_object_class_install_property (gobject_class, PROP_SPECULATIVE_SILENCE,
+      g_param_spec_int64 ("speculative-silence", _("Speculative silence"), _("Give the partial result of an utterance as a tentative final result once it is followed by that much silence (in milliseconds), before the end of the utterance is detected. It is confirmed by the final result with the same utterance id or retracted if speech resumes. Set 0 to disable"),
+          0, G_MAXINT64, 0, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_WAKE_PHRASES,
+      g_param_spec_string ("wake-phrases", _("Wake phrases"), _("Comma separated phrases listened for with a small grammar recognizer. The speech model only decodes audio from the last wake-preroll milliseconds before one of them is heard to the end of the utterance. Unset to always decode"),
+          NULL, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_WAKE_PREROLL,
+      g_param_spec_int64 ("wake-preroll", _("Wake preroll"), _("Audio retained while listening for wake phrases and decoded once one is heard (in milliseconds). It must be long enough to hold the phrase"),
+          0, G_MAXINT64, DEFAULT_WAKE_PREROLL, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_LAZY_HISTORY,
+      g_param_spec_int64 ("lazy-history", _("Lazy history"), _("Lazy mode: nothing is decoded, the last lazy-history milliseconds of the input are kept and ranges of them are decoded on request (\"transcribe\" action signal or \"vosk-transcribe\" event). Set 0 to decode everything as it comes"),
+          0, G_MAXINT64, DEFAULT_LAZY_HISTORY, G_PARAM_READWRITE|GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_LAZY_COMPRESS,
+      g_param_spec_boolean ("lazy-compress", _("Lazy compress"), _("Keep the history of lazy mode as G.711 u-law, which takes half the memory"),
+          FALSE, G_PARAM_READWRITE|GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_DEDUPLICATE,
+      g_param_spec_boolean ("deduplicate", _("Deduplicate"), _("Compare the input with that of the other elements of the process with this property set. While it carries the same audio as one of them, it is not decoded and the results of the other one are delivered instead"),
+          FALSE, G_PARAM_READWRITE|GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_DUPLICATE_TOLERANCE,
+      g_param_spec_int64 ("duplicate-tolerance", _("Duplicate tolerance"), _("How far apart the same audio can be in two streams for them to be duplicates (in milliseconds)"),
+          0, G_MAXINT64, DEFAULT_DUPLICATE_TOLERANCE, G_PARAM_READWRITE|GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_RESULT_FORMAT,
+      g_param_spec_enum ("result-format", _("Result format"), _("Format of the results in messages and in the results signal: the JSON text of libvosk or a compact CBOR encoding of it, as GBytes, that gstvoskresult.h decodes. With cbor, the result, tentative-result, retracted-result and revised-result signals are not emitted"),
+          GST_TYPE_VOSK_RESULT_FORMAT, GST_VOSK_RESULT_FORMAT_JSON, G_PARAM_READWRITE|GST_PARAM_MUTABLE_READY));
+
+  g_object_class_install_property (gobject_class, PROP_TRICK_MODE_RESULTS,
+      g_param_spec_boolean ("trick-mode-results", _("Trick mode results"), _("Audio played at another rate than 1.0 or in a trick mode is not decoded. With this set, the final results of the ranges decoded during normal playback are given again (as cached-result) when those ranges are played that way"),
+          FALSE, G_PARAM_READWRITE|GST_PARAM_MUTABLE_PLAYING));
+
   signals[RESULT] =
     g_signal_new ("result",
                   G_OBJECT_CLASS_TYPE (gobject_class),
@@ -227,6 +537,79 @@ gst_vosk_class_init (GstVoskClass * klass)
                   1,
                   G_TYPE_STRING);
 
+  /* All the results delivered at once, as "vosk" structures with the fields
+   * of the element messages */
+  signals[RESULTS] =
+    g_signal_new ("results",
+                  G_OBJECT_CLASS_TYPE (gobject_class),
+                  G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE,
+                  0, NULL, NULL,
+                  NULL,
+                  G_TYPE_NONE,
+                  1,
+                  G_TYPE_PTR_ARRAY);
+
+  signals[REVISED_RESULT] =
+    g_signal_new ("revised-result",
+                  G_OBJECT_CLASS_TYPE (gobject_class),
+                  G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE,
+                  0, NULL, NULL,
+                  NULL,
+                  G_TYPE_NONE,
+                  2,
+                  G_TYPE_STRING,
+                  G_TYPE_UINT64);
+
+  signals[TENTATIVE_RESULT] =
+    g_signal_new ("tentative-result",
+                  G_OBJECT_CLASS_TYPE (gobject_class),
+                  G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE,
+                  0, NULL, NULL,
+                  NULL,
+                  G_TYPE_NONE,
+                  2,
+                  G_TYPE_STRING,
+                  G_TYPE_UINT64);
+
+  signals[RETRACTED_RESULT] =
+    g_signal_new ("retracted-result",
+                  G_OBJECT_CLASS_TYPE (gobject_class),
+                  G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE,
+                  0, NULL, NULL,
+                  NULL,
+                  G_TYPE_NONE,
+                  2,
+                  G_TYPE_STRING,
+                  G_TYPE_UINT64);
+
+  /* Lazy mode: queues the transcription of the history between two
+   * timestamps (GST_CLOCK_TIME_NONE for its start or its end). Returns the
+   * id of the transcription, 0 if there is nothing to transcribe. */
+  signals[TRANSCRIBE] =
+    g_signal_new_class_handler ("transcribe",
+                                G_OBJECT_CLASS_TYPE (gobject_class),
+                                G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+                                G_CALLBACK (gst_vosk_transcribe),
+                                NULL, NULL,
+                                NULL,
+                                G_TYPE_UINT64,
+                                2,
+                                G_TYPE_UINT64,
+                                G_TYPE_UINT64);
+
+  /* A JSON array with the final results of the utterances of the range and
+   * the transcription id */
+  signals[TRANSCRIPTION] =
+    g_signal_new ("transcription",
+                  G_OBJECT_CLASS_TYPE (gobject_class),
+                  G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE,
+                  0, NULL, NULL,
+                  NULL,
+                  G_TYPE_NONE,
+                  2,
+                  G_TYPE_STRING,
+                  G_TYPE_UINT64);
+
   gst_element_class_set_details_simple(gstelement_class,
     "vosk",
     "Filter/Audio",
@@ -237,8 +620,14 @@ gst_vosk_class_init (GstVoskClass * klass)
       gst_static_pad_template_get (&src_factory));
   gst_element_class_add_pad_template (gstelement_class,
       gst_static_pad_template_get (&sink_factory));
+  gst_element_class_add_pad_template (gstelement_class,
+      gst_static_pad_template_get (&utterance_src_factory));
+  gst_element_class_add_pad_template (gstelement_class,
+      gst_static_pad_template_get (&caption_src_factory));
 
   gstelement_class->change_state = gst_vosk_change_state;
+  gstelement_class->request_new_pad = gst_vosk_request_new_pad;
+  gstelement_class->release_pad = gst_vosk_release_pad;
 }
 
 static void
@@ -249,12 +638,25 @@ gst_vosk_init (GstVosk * vosk)
                               GST_DEBUG_FUNCPTR(gst_vosk_sink_event));
   gst_pad_set_chain_function (vosk->sinkpad,
                               GST_DEBUG_FUNCPTR(gst_vosk_chain));
+  gst_pad_set_iterate_internal_links_function (vosk->sinkpad,
+                                               GST_DEBUG_FUNCPTR(gst_vosk_iterate_internal_links));
+  gst_pad_set_activate_function (vosk->sinkpad,
+                                 GST_DEBUG_FUNCPTR(gst_vosk_sink_activate));
+  gst_pad_set_activatemode_function (vosk->sinkpad,
+                                     GST_DEBUG_FUNCPTR(gst_vosk_sink_activate_mode));
+  gst_pad_set_query_function (vosk->sinkpad,
+                              GST_DEBUG_FUNCPTR(gst_vosk_query));
   GST_PAD_SET_PROXY_CAPS (vosk->sinkpad);
   gst_element_add_pad (GST_ELEMENT (vosk), vosk->sinkpad);
 
   vosk->srcpad = gst_pad_new_from_static_template (&src_factory, "src");
+  gst_pad_set_query_function (vosk->srcpad,
+                              GST_DEBUG_FUNCPTR(gst_vosk_query));
+  gst_pad_set_event_function (vosk->srcpad,
+                              GST_DEBUG_FUNCPTR(gst_vosk_src_event));
   GST_PAD_SET_PROXY_CAPS (vosk->srcpad);
   gst_element_add_pad (GST_ELEMENT (vosk), vosk->srcpad);
+  vosk->proxy_pads = g_list_append (NULL, vosk->srcpad);
 
   if (!gst_debug_is_active())
     vosk_set_log_level (-1);
@@ -262,6 +664,31 @@ gst_vosk_init (GstVosk * vosk)
   vosk->rate = 0.0;
   vosk->alternatives = DEFAULT_ALTERNATIVE_NUM;
   vosk->model_path = g_strdup(DEFAULT_SPEECH_MODEL);
+  vosk->rescoring_threshold = DEFAULT_RESCORING_THRESHOLD;
+  vosk->batch_deadline = DEFAULT_BATCH_DEADLINE * GST_MSECOND;
+  vosk->batch_size = DEFAULT_BATCH_SIZE;
+  vosk->resume_time = GST_CLOCK_TIME_NONE;
+  vosk->cpu_warning_ratio = DEFAULT_CPU_WARNING_RATIO;
+  vosk->wake_preroll = DEFAULT_WAKE_PREROLL * GST_MSECOND;
+  vosk->lazy_history = DEFAULT_LAZY_HISTORY * GST_MSECOND;
+  vosk->duplicate_tolerance = DEFAULT_DUPLICATE_TOLERANCE * GST_MSECOND;
+  vosk->caption_fps_n = DEFAULT_CAPTION_FPS_N;
+  vosk->caption_fps_d = DEFAULT_CAPTION_FPS_D;
+  vosk->caption_start = GST_CLOCK_TIME_NONE;
+  vosk->segment_rate = 1.0;
+  vosk->segment_applied_rate = 1.0;
+  vosk->rate_multiplier = 1.0;
+  vosk->utterance_pts = GST_CLOCK_TIME_NONE;
+
+  g_rec_mutex_init (&vosk->DeliverMut);
+  g_cond_init (&vosk->ReadyCond);
+  g_mutex_init (&vosk->PullMut);
+  g_cond_init (&vosk->PullCond);
+  g_queue_init (&vosk->pull_blocks);
+  g_queue_init (&vosk->results_pending);
+  g_queue_init (&vosk->utterance_buffers);
+  g_queue_init (&vosk->utterance_pending);
+  g_queue_init (&vosk->trick_results);
 
   vosk->thread_pool=g_thread_pool_new((GFunc) gst_vosk_load_model_async,
                                       vosk,
@@ -270,19 +697,81 @@ gst_vosk_init (GstVosk * vosk)
                                       NULL);
 }
 
+/*
+ * MUST be called with lock held
+ */
+static void
+gst_vosk_utterance_clear (GstVosk *vosk)
+{
+  g_queue_clear_full (&vosk->utterance_buffers, (GDestroyNotify) gst_buffer_unref);
+  g_queue_clear_full (&vosk->utterance_pending, (GDestroyNotify) gst_buffer_unref);
+}
+
 static void
 gst_vosk_reset (GstVosk *vosk)
 {
-  if (vosk->recognizer) {
-    vosk_recognizer_free (vosk->recognizer);
-    vosk->recognizer = NULL;
+  gst_vosk_core_free (vosk->core);
+  vosk->core = NULL;
+
+  gst_vosk_model_unref (vosk->model);
+  vosk->model = NULL;
+
+  if (vosk->model_pool) {
+    g_hash_table_unref (vosk->model_pool);
+    vosk->model_pool = NULL;
   }
 
-  if (vosk->prev_partial) {
-    g_free (vosk->prev_partial);
-    vosk->prev_partial = NULL;
+  g_free (vosk->language);
+  vosk->language = NULL;
+
+  g_free (vosk->stream_language);
+  vosk->stream_language = NULL;
+
+  if (vosk->batch_stream) {
+    gst_vosk_batcher_stream_free (vosk->batch_stream);
+    vosk->batch_stream = NULL;
   }
 
+  gst_vosk_batcher_release (vosk->batch_model);
+  vosk->batch_model = NULL;
+
+  gst_vosk_history_free (vosk->history);
+  vosk->history = NULL;
+
+  gst_vosk_decoder_free (vosk->decoder);
+  vosk->decoder = NULL;
+
+  gst_vosk_duplicate_unregister (vosk->duplicate);
+  vosk->duplicate = NULL;
+  vosk->duplicated = FALSE;
+  vosk->has_shared_utterance = FALSE;
+
+  gst_vosk_utterance_clear (vosk);
+  g_queue_clear_full (&vosk->results_pending, (GDestroyNotify) gst_structure_free);
+
+  if (vosk->caption)
+    gst_vosk_caption_reset (vosk->caption);
+  vosk->caption_start = GST_CLOCK_TIME_NONE;
+  vosk->caption_started = FALSE;
+
+  vosk->batch_samples = 0;
+  vosk->skipped_duration = 0;
+  vosk->resume_time = GST_CLOCK_TIME_NONE;
+
+  vosk->segment_rate = 1.0;
+  vosk->segment_applied_rate = 1.0;
+  vosk->segment_flags = GST_SEGMENT_FLAG_NONE;
+  vosk->rate_multiplier = 1.0;
+  vosk->trick_mode = FALSE;
+  vosk->utterance_pts = GST_CLOCK_TIME_NONE;
+  g_queue_clear_full (&vosk->trick_results, (GDestroyNotify) gst_structure_free);
+
+  vosk->next_pts = GST_CLOCK_TIME_NONE;
+  vosk->decoded_duration = 0;
+  vosk->cpu_time = 0;
+  vosk->core_cpu_time = 0;
+  vosk->cpu_warned = FALSE;
+
   vosk->last_processed_time=GST_CLOCK_TIME_NONE;
   vosk->rate=0.0;
 }
@@ -315,19 +804,21 @@ gst_vosk_get_rate(GstVosk *vosk)
   caps_struct = gst_caps_get_structure (caps, 0);
   if (caps_struct == NULL) {
     GST_INFO_OBJECT (vosk, "no capabilities structure.");
+    gst_caps_unref (caps);
     return 0;
   }
 
-  if (gst_structure_get_int (caps_struct, "rate", &rate) == FALSE) {
+  /* That of the decoded audio for encoded input */
+  rate = gst_vosk_decoder_caps_rate (caps_struct);
+  if (rate <= 0)
     GST_INFO_OBJECT (vosk, "no rate set in the capabilities");
-    return 0;
-  }
 
+  gst_caps_unref (caps);
   return rate;
 }
 
 static gboolean
-gst_vosk_recognizer_new (GstVosk *vosk, VoskModel *model)
+gst_vosk_recognizer_new (GstVosk *vosk)
 {
   vosk->rate = gst_vosk_get_rate(vosk);
   if (vosk->rate <= 0.0) {
@@ -337,30 +828,229 @@ gst_vosk_recognizer_new (GstVosk *vosk, VoskModel *model)
 
   GST_INFO_OBJECT (vosk, "current rate is %f", vosk->rate);
 
-  if (model == NULL) {
+  if (vosk->batch_model) {
+    GST_INFO_OBJECT (vosk, "creating batch stream (rate = %f).", vosk->rate);
+    vosk->batch_stream = gst_vosk_batcher_stream_new (vosk->batch_model,
+                                                      GST_ELEMENT (vosk),
+                                                      gst_vosk_batch_result,
+                                                      vosk->rate,
+                                                      vosk->batch_deadline,
+                                                      vosk->batch_size);
+    return vosk->batch_stream != NULL;
+  }
+
+  if (vosk->core == NULL) {
     GST_INFO_OBJECT (vosk, "no model provided.");
     return FALSE;
   }
 
+  if (vosk->lazy_history && !vosk->history) {
+    GST_INFO_OBJECT (vosk, "lazy mode, keeping %" GST_TIME_FORMAT " of audio.",
+                     GST_TIME_ARGS (vosk->lazy_history));
+    vosk->history = gst_vosk_history_new (vosk->rate,
+                                          vosk->lazy_history,
+                                          vosk->lazy_compress);
+  }
+
+  if (vosk->deduplicate && !vosk->history && !vosk->duplicate)
+    vosk->duplicate = gst_vosk_duplicate_register (vosk->duplicate_tolerance);
+
   GST_INFO_OBJECT (vosk, "creating recognizer (rate = %f).", vosk->rate);
-  vosk->recognizer = vosk_recognizer_new (model, vosk->rate);
-  vosk_recognizer_set_max_alternatives (vosk->recognizer, vosk->alternatives);
-  return TRUE;
+  return gst_vosk_core_start (vosk->core, vosk->rate);
 }
 
 typedef struct {
   gchar *path;
+  gchar *rescoring_path;
+  gboolean batch;
+  GstStructure *model_map;
+  GstVoskModel *model;
   GCancellable *cancellable;
 } GstVoskThreadData;
 
+/*
+ * Loads the models of model-map. They come from the model cache, so elements
+ * with the same map share them.
+ */
+static GHashTable *
+gst_vosk_model_pool_new (GstVosk *vosk,
+                         const GstStructure *model_map,
+                         const gchar *rescoring_path)
+{
+  GHashTable *pool;
+  gint i;
+
+  pool = g_hash_table_new_full (g_str_hash,
+                                g_str_equal,
+                                g_free,
+                                (GDestroyNotify) gst_vosk_core_free);
+
+  for (i = 0; i < gst_structure_n_fields (model_map); i++) {
+    const gchar *language = gst_structure_nth_field_name (model_map, i);
+    const gchar *path = gst_structure_get_string (model_map, language);
+    GstVoskCore *core;
+
+    if (!path) {
+      GST_WARNING_OBJECT (vosk, "model-map: %s is not a path.", language);
+      continue;
+    }
+
+    GST_INFO_OBJECT (vosk, "preloading model %s for %s.", path, language);
+    core = gst_vosk_core_new (path, rescoring_path);
+    if (!core) {
+      GST_WARNING_OBJECT (vosk, "could not load model %s for %s.", path, language);
+      continue;
+    }
+
+    g_hash_table_insert (pool, g_strdup (language), core);
+  }
+
+  return pool;
+}
+
+/*
+ * Returns the model of the vosk-model context of the element if it is that
+ * of speech-model.
+ */
+static GstVoskModel *
+gst_vosk_model_context_get (GstVosk *vosk)
+{
+  GstVoskModel *model = NULL;
+  const GstStructure *structure;
+  GstContext *context;
+
+  context = gst_element_get_context (GST_ELEMENT (vosk), GST_VOSK_MODEL_CONTEXT);
+  if (!context)
+    return NULL;
+
+  structure = gst_context_get_structure (context);
+  if (gst_structure_get (structure, "model", GST_TYPE_VOSK_MODEL, &model, NULL) &&
+      g_strcmp0 (gst_vosk_model_get_path (model), vosk->model_path)) {
+    GST_INFO_OBJECT (vosk, "model of context (%s) is not speech-model.",
+                     gst_vosk_model_get_path (model));
+    gst_vosk_model_unref (model);
+    model = NULL;
+  }
+
+  gst_context_unref (context);
+  return model;
+}
+
+/*
+ * Looks for a vosk-model context: the one of the element, then that of
+ * downstream and upstream elements, then that of the bins or of the
+ * application (which answer the need-context message synchronously).
+ */
+static GstVoskModel *
+gst_vosk_model_context_find (GstVosk *vosk)
+{
+  GstVoskModel *model;
+  GstContext *context = NULL;
+  GstQuery *query;
+
+  if ((model = gst_vosk_model_context_get (vosk)))
+    return model;
+
+  query = gst_query_new_context (GST_VOSK_MODEL_CONTEXT);
+  if (gst_pad_peer_query (vosk->srcpad, query) ||
+      gst_pad_peer_query (vosk->sinkpad, query)) {
+    gst_query_parse_context (query, &context);
+    if (context)
+      gst_element_set_context (GST_ELEMENT (vosk), context);
+  }
+  gst_query_unref (query);
+
+  if ((model = gst_vosk_model_context_get (vosk)))
+    return model;
+
+  gst_element_post_message (GST_ELEMENT (vosk),
+                            gst_message_new_need_context (GST_OBJECT (vosk),
+                                                          GST_VOSK_MODEL_CONTEXT));
+  return gst_vosk_model_context_get (vosk);
+}
+
+/* Makes the model the element loaded available to the others */
+static void
+gst_vosk_model_context_publish (GstVosk *vosk,
+                                GstVoskModel *model)
+{
+  GstContext *context;
+
+  context = gst_context_new (GST_VOSK_MODEL_CONTEXT, TRUE);
+  gst_structure_set (gst_context_writable_structure (context),
+                     "model", GST_TYPE_VOSK_MODEL, model,
+                     NULL);
+
+  gst_element_set_context (GST_ELEMENT (vosk), context);
+  gst_element_post_message (GST_ELEMENT (vosk),
+                            gst_message_new_have_context (GST_OBJECT (vosk), context));
+}
+
+static gboolean
+gst_vosk_query (GstPad *pad,
+                GstObject *parent,
+                GstQuery *query)
+{
+  /* See gst_vosk_src_event () */
+  if (GST_QUERY_TYPE (query) == GST_QUERY_SEEKING &&
+      pad == GST_VOSK (parent)->srcpad &&
+      GST_PAD_MODE (GST_VOSK (parent)->sinkpad) == GST_PAD_MODE_PULL) {
+    GstFormat format;
+
+    gst_query_parse_seeking (query, &format, NULL, NULL, NULL);
+    gst_query_set_seeking (query, format, FALSE, 0, -1);
+    return TRUE;
+  }
+
+  if (GST_QUERY_TYPE (query) == GST_QUERY_CONTEXT) {
+    const gchar *context_type;
+    GstContext *context;
+
+    gst_query_parse_context_type (query, &context_type);
+    if (!g_strcmp0 (context_type, GST_VOSK_MODEL_CONTEXT) &&
+        (context = gst_element_get_context (GST_ELEMENT (parent), context_type))) {
+      gst_query_set_context (query, context);
+      gst_context_unref (context);
+      return TRUE;
+    }
+  }
+
+  return gst_pad_query_default (pad, parent, query);
+}
+
+/*
+ * In pull mode, the pad task reads the stream from the start on its own and
+ * nothing would flush it or move its reader: seeks are refused.
+ */
+static gboolean
+gst_vosk_src_event (GstPad *pad,
+                    GstObject *parent,
+                    GstEvent *event)
+{
+  GstVosk *vosk = GST_VOSK (parent);
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_SEEK &&
+      GST_PAD_MODE (vosk->sinkpad) == GST_PAD_MODE_PULL) {
+    GST_DEBUG_OBJECT (vosk, "seeking is not supported in pull mode.");
+    gst_event_unref (event);
+    return FALSE;
+  }
+
+  return gst_pad_event_default (pad, parent, event);
+}
+
 static void
 gst_vosk_load_model_async (gpointer thread_data,
                            gpointer element)
 {
   GstVoskThreadData *status = thread_data;
   GstVosk *vosk = GST_VOSK (element);
+  VoskBatchModel *batch_model = NULL;
+  GHashTable *model_pool = NULL;
+  GstVoskCore *core = NULL;
+  GstVoskModel *model = NULL;
+  gboolean publish = FALSE;
   GstMessage *message;
-  VoskModel *model;
 
   /* There can be only one model loading at a time. Even when loading has been
    * cancelled for one model while it is waiting to be loaded.
@@ -378,7 +1068,22 @@ gst_vosk_load_model_async (gpointer thread_data,
 
   /* This is why we do all this. Depending on the model size it can take a long
    * time before it returns. */
-  model = vosk_model_new (status->path);
+  if (status->batch)
+    batch_model = gst_vosk_batcher_acquire ();
+  else {
+    /* Nobody had it: other elements can use ours */
+    if (!status->model) {
+      status->model = gst_vosk_model_new (status->path, TRUE);
+      publish = TRUE;
+    }
+
+    if (status->model)
+      core = gst_vosk_core_new_for_model (status->model, status->rescoring_path);
+  }
+
+  /* Load them all now so that switching language does not stall streaming */
+  if (core && status->model_map)
+    model_pool = gst_vosk_model_pool_new (vosk, status->model_map, status->rescoring_path);
 
   GST_VOSK_LOCK(vosk);
 
@@ -393,22 +1098,35 @@ gst_vosk_load_model_async (gpointer thread_data,
     GST_VOSK_UNLOCK(vosk);
 
     GST_INFO_OBJECT (vosk, "model creation cancelled (%s).", status->path);
-    vosk_model_free (model);
+    gst_vosk_core_free (core);
+    gst_vosk_batcher_release (batch_model);
+    if (model_pool)
+      g_hash_table_unref (model_pool);
 
     /* Note: don't use condition, not our problem anymore */
     goto clean;
   }
 
   /* Do this here to make sure the following is still relevant */
-  if (!model) {
+  if (!core && !batch_model) {
     GST_VOSK_UNLOCK(vosk);
 
-    GST_ERROR_OBJECT(vosk, "could not create model object for %s.", status->path);
-    GST_ELEMENT_ERROR(GST_ELEMENT(vosk),
-                      RESOURCE,
-                      NOT_FOUND,
-                      ("model could not be loaded"),
-                      ("an error was encountered while loading model (%s)", status->path));
+    if (status->batch) {
+      GST_ERROR_OBJECT(vosk, "could not create batch model.");
+      GST_ELEMENT_ERROR(GST_ELEMENT(vosk),
+                        RESOURCE,
+                        NOT_FOUND,
+                        ("batch model could not be loaded"),
+                        ("batch mode needs a CUDA build of libvosk and its model in ./model"));
+    }
+    else {
+      GST_ERROR_OBJECT(vosk, "could not create model object for %s.", status->path);
+      GST_ELEMENT_ERROR(GST_ELEMENT(vosk),
+                        RESOURCE,
+                        NOT_FOUND,
+                        ("model could not be loaded"),
+                        ("an error was encountered while loading model (%s)", status->path));
+    }
 
     GST_STATE_LOCK(vosk);
     gst_element_abort_state (GST_ELEMENT(vosk));
@@ -419,14 +1137,37 @@ gst_vosk_load_model_async (gpointer thread_data,
 
   GST_INFO_OBJECT (vosk, "model ready (%s).", status->path);
 
-  /* This is the only place where vosk->recognizer can be set and only one
-   * thread at a time can do it. */
-  gst_vosk_recognizer_new(vosk, model);
-  /* Unreference the model (it does not destroy it) */
-  vosk_model_free (model);
+  /* The core keeps references on the models: they stay in the cache as long
+   * as they are in use. */
+  vosk->core = core;
+  vosk->model = status->model;
+  status->model = NULL;
+  vosk->batch_model = batch_model;
+  vosk->model_pool = model_pool;
+  vosk->language = g_strdup (GST_VOSK_DEFAULT_LANGUAGE);
+
+  if (core)
+    gst_vosk_configure_core (vosk);
+
+  /* The stream may have been tagged while loading */
+  if (vosk->stream_language)
+    gst_vosk_switch_language (vosk, vosk->stream_language);
+
+  /* A recognizer is created here or, in pull mode, by gst_vosk_pull_start ()
+   * when the caps were not known yet. Both hold the lock. */
+  gst_vosk_recognizer_new(vosk);
+  g_cond_broadcast (&vosk->ReadyCond);
+
+  if (publish)
+    model = gst_vosk_model_ref (vosk->model);
 
   GST_VOSK_UNLOCK(vosk);
 
+  if (model) {
+    gst_vosk_model_context_publish (vosk, model);
+    gst_vosk_model_unref (model);
+  }
+
   GST_INFO_OBJECT (vosk, "async state change successfully completed.");
   message = gst_message_new_async_done (GST_OBJECT_CAST (vosk),
                                         GST_CLOCK_TIME_NONE);
@@ -442,9 +1183,30 @@ clean:
   g_cancellable_cancel(status->cancellable);
   g_object_unref(status->cancellable);
   g_free(status->path);
+  g_free(status->rescoring_path);
+  if (status->model_map)
+    gst_structure_free (status->model_map);
+  gst_vosk_model_unref (status->model);
   g_free(status);
 }
 
+/*
+ * Alternatives results of libvosk have no word confidence, which is what
+ * rescoring relies on.
+ * MUST NOT be called with lock held
+ */
+static void
+gst_vosk_check_rescoring (GstVosk *vosk)
+{
+  if (vosk->rescoring_model_path && vosk->alternatives > 0)
+    GST_ELEMENT_WARNING (vosk,
+                         RESOURCE,
+                         SETTINGS,
+                         ("rescoring is disabled when alternatives are requested"),
+                         ("alternatives (%d) carry no word confidence to compare with rescoring-threshold",
+                          vosk->alternatives));
+}
+
 static GstStateChangeReturn
 gst_vosk_check_model_path(GstElement *element)
 {
@@ -465,7 +1227,7 @@ gst_vosk_check_model_path(GstElement *element)
 
   vosk->last_processed_time=GST_CLOCK_TIME_NONE;
 
-  if(vosk->recognizer) {
+  if(GST_VOSK_HAS_RECOGNIZER(vosk) || vosk->batch_stream) {
     GST_VOSK_UNLOCK(vosk);
     return GST_STATE_CHANGE_SUCCESS;
   }
@@ -475,9 +1237,26 @@ gst_vosk_check_model_path(GstElement *element)
 
   GST_VOSK_UNLOCK(vosk);
 
+  gst_vosk_check_rescoring (vosk);
+
+  /* libvosk has no way to pass a path to its batch model */
+  if (vosk->batch && g_strcmp0 (vosk->model_path, DEFAULT_SPEECH_MODEL))
+    GST_ELEMENT_WARNING (vosk,
+                         RESOURCE,
+                         SETTINGS,
+                         ("speech-model is ignored in batch mode"),
+                         ("libvosk loads its batch model from ./model, not from %s", vosk->model_path));
+
   thread_data=g_new0(GstVoskThreadData, 1);
   thread_data->cancellable=g_object_ref(vosk->current_operation);
   thread_data->path=g_strdup(vosk->model_path);
+  thread_data->rescoring_path=g_strdup(vosk->rescoring_model_path);
+  thread_data->batch=vosk->batch;
+  thread_data->model_map=vosk->model_map ? gst_structure_copy (vosk->model_map) : NULL;
+
+  /* Applications and bins may have it already loaded */
+  if (!vosk->batch)
+    thread_data->model=gst_vosk_model_context_find (vosk);
   g_thread_pool_push(vosk->thread_pool,
                      thread_data,
                      NULL);
@@ -530,44 +1309,342 @@ gst_vosk_change_state (GstElement *element, GstStateChange transition)
   return ret;
 }
 
-static void
-gst_vosk_set_num_alternatives(GstVosk *vosk)
-{
-  GST_VOSK_LOCK(vosk);
+/*
+ * Caps of the audio exported on utterance_src when the input is encoded (it
+ * is decoded), NULL when it is raw.
+ * MUST be called with lock held
+ */
+static GstCaps *
+gst_vosk_decoded_caps (GstVosk *vosk)
+{
+  if (!vosk->decoder)
+    return NULL;
+
+  return gst_caps_new_simple ("audio/x-raw",
+                              "format", G_TYPE_STRING, "S16LE",
+                              "layout", G_TYPE_STRING, "interleaved",
+                              "rate", G_TYPE_INT, gst_vosk_decoder_get_rate (vosk->decoder),
+                              "channels", G_TYPE_INT, 1,
+                              NULL);
+}
+
+static gboolean
+gst_vosk_copy_sticky_event (GstPad *pad,
+                            GstEvent **event,
+                            gpointer user_data)
+{
+  gst_pad_store_sticky_event (GST_PAD (user_data), *event);
+  return TRUE;
+}
+
+static GstIterator *
+gst_vosk_iterate_internal_links (GstPad *pad,
+                                 GstObject *parent)
+{
+  GstVosk *vosk = GST_VOSK (parent);
+
+  if (pad != vosk->sinkpad)
+    return gst_pad_iterate_internal_links_default (pad, parent);
+
+  return gst_iterator_new_list (GST_TYPE_PAD,
+                                GST_OBJECT_GET_LOCK (vosk),
+                                &vosk->proxy_pads_cookie,
+                                &vosk->proxy_pads,
+                                G_OBJECT (vosk),
+                                NULL);
+}
+
+static void
+gst_vosk_activate_request_pad (GstVosk *vosk,
+                               GstPad *pad)
+{
+  GST_OBJECT_LOCK(vosk);
+  if (GST_STATE(vosk) > GST_STATE_READY)
+    gst_pad_set_active (pad, TRUE);
+  GST_OBJECT_UNLOCK(vosk);
+}
+
+static GstPad *
+gst_vosk_request_utterance_pad (GstVosk *vosk,
+                                GstPadTemplate *templ)
+{
+  GstCaps *decoded;
+  GstEvent *event;
+  GstPad *pad;
+
+  GST_VOSK_LOCK(vosk);
+  if (vosk->utterance_srcpad) {
+    GST_VOSK_UNLOCK(vosk);
+    GST_WARNING_OBJECT (vosk, "there can be only one utterance_src pad.");
+    return NULL;
+  }
+
+  pad = gst_pad_new_from_template (templ, "utterance_src");
+  vosk->utterance_srcpad = pad;
+  decoded = gst_vosk_decoded_caps (vosk);
+  GST_VOSK_UNLOCK(vosk);
+
+  gst_vosk_activate_request_pad (vosk, pad);
+
+  /* Events are forwarded to all src pads but this one may come late */
+  gst_pad_sticky_events_foreach (vosk->sinkpad, gst_vosk_copy_sticky_event, pad);
+  if (decoded) {
+    /* Storing does not take the event */
+    event = gst_event_new_caps (decoded);
+    gst_pad_store_sticky_event (pad, event);
+    gst_event_unref (event);
+    gst_caps_unref (decoded);
+  }
+
+  GST_OBJECT_LOCK(vosk);
+  vosk->proxy_pads = g_list_append (vosk->proxy_pads, pad);
+  vosk->proxy_pads_cookie++;
+  GST_OBJECT_UNLOCK(vosk);
+
+  GST_INFO_OBJECT (vosk, "utterance audio exported.");
+  return pad;
+}
+
+static GstPad *
+gst_vosk_request_caption_pad (GstVosk *vosk,
+                              GstPadTemplate *templ)
+{
+  GstPad *pad;
+
+  GST_VOSK_LOCK(vosk);
+  if (vosk->caption_srcpad) {
+    GST_VOSK_UNLOCK(vosk);
+    GST_WARNING_OBJECT (vosk, "there can be only one caption_src pad.");
+    return NULL;
+  }
 
-  if (vosk->recognizer)
-    vosk_recognizer_set_max_alternatives (vosk->recognizer, vosk->alternatives);
+  /* Its events are pushed when captions start */
+  pad = gst_pad_new_from_template (templ, "caption_src");
+  vosk->caption_srcpad = pad;
+  vosk->caption = gst_vosk_caption_new ();
+  vosk->caption_start = GST_CLOCK_TIME_NONE;
+  vosk->caption_started = FALSE;
+  GST_VOSK_UNLOCK(vosk);
+
+  gst_vosk_activate_request_pad (vosk, pad);
+
+  GST_INFO_OBJECT (vosk, "captions enabled.");
+  return pad;
+}
+
+static GstPad *
+gst_vosk_request_new_pad (GstElement *element,
+                          GstPadTemplate *templ,
+                          const gchar *name,
+                          const GstCaps *caps)
+{
+  GstVosk *vosk = GST_VOSK (element);
+  GstPad *pad;
+
+  if (!g_strcmp0 (GST_PAD_TEMPLATE_NAME_TEMPLATE (templ), "caption_src"))
+    pad = gst_vosk_request_caption_pad (vosk, templ);
   else
-    GST_LOG_OBJECT (vosk, "No recognizer to set num alternatives.");
+    pad = gst_vosk_request_utterance_pad (vosk, templ);
 
+  if (pad)
+    gst_element_add_pad (element, pad);
+
+  return pad;
+}
+
+static void
+gst_vosk_release_pad (GstElement *element,
+                      GstPad *pad)
+{
+  GstVosk *vosk = GST_VOSK (element);
+
+  GST_VOSK_LOCK(vosk);
+  if (pad == vosk->utterance_srcpad) {
+    vosk->utterance_srcpad = NULL;
+    gst_vosk_utterance_clear (vosk);
+  }
+  else if (pad == vosk->caption_srcpad) {
+    vosk->caption_srcpad = NULL;
+    gst_vosk_caption_free (vosk->caption);
+    vosk->caption = NULL;
+  }
+  else {
+    GST_VOSK_UNLOCK(vosk);
+    return;
+  }
   GST_VOSK_UNLOCK(vosk);
+
+  GST_OBJECT_LOCK(vosk);
+  vosk->proxy_pads = g_list_remove (vosk->proxy_pads, pad);
+  vosk->proxy_pads_cookie++;
+  GST_OBJECT_UNLOCK(vosk);
+
+  gst_pad_set_active (pad, FALSE);
+  gst_element_remove_pad (element, pad);
 }
 
+/*
+ * MUST be called with lock held
+ */
 static void
-gst_vosk_set_model_path (GstVosk *vosk,
-                         const gchar *model_path)
+gst_vosk_configure_wake (GstVosk *vosk)
+{
+  gchar **phrases = NULL;
+  guint i;
+
+  if (vosk->wake_phrases) {
+    phrases = g_strsplit (vosk->wake_phrases, ",", -1);
+    for (i = 0; phrases[i]; i++)
+      g_strstrip (phrases[i]);
+  }
+
+  gst_vosk_core_set_wake_phrases (vosk->core,
+                                  (const gchar * const *) phrases,
+                                  vosk->wake_preroll);
+  g_strfreev (phrases);
+}
+
+/*
+ * MUST be called with lock held
+ */
+static void
+gst_vosk_configure_core (GstVosk *vosk)
+{
+  if (!vosk->core)
+    return;
+
+  gst_vosk_core_set_alternatives (vosk->core, vosk->alternatives);
+  gst_vosk_core_set_max_utterance_duration (vosk->core, vosk->max_utterance_duration);
+  gst_vosk_core_set_recycle_interval (vosk->core, vosk->recycle_interval);
+  gst_vosk_core_set_speculative_silence (vosk->core, vosk->speculative_silence);
+  gst_vosk_configure_wake (vosk);
+
+  if (gst_vosk_core_has_rescoring (vosk->core))
+    gst_vosk_core_set_rescoring (vosk->core,
+                                 vosk->rescoring_threshold,
+                                 gst_vosk_revised_result,
+                                 vosk,
+                                 gst_object_ref,
+                                 gst_object_unref);
+}
+
+static void
+gst_vosk_update_core (GstVosk *vosk)
+{
+  GST_VOSK_LOCK(vosk);
+  gst_vosk_configure_core (vosk);
+  GST_VOSK_UNLOCK(vosk);
+}
+
+static gboolean
+gst_vosk_can_change_model (GstVosk *vosk)
 {
   GstState state;
 
-  /* This property can only be changed in the READY state */
+  /* Model properties can only be changed in the READY state */
   GST_OBJECT_LOCK(vosk);
   state = GST_STATE(vosk);
   if (state != GST_STATE_READY && state != GST_STATE_NULL) {
-    GST_INFO_OBJECT (vosk, "Changing the `speech-model' property can only "
+    GST_INFO_OBJECT (vosk, "Changing a model property can only "
                            "be done in NULL or READY state");
     GST_OBJECT_UNLOCK(vosk);
-    return;
+    return FALSE;
   }
   GST_OBJECT_UNLOCK(vosk);
 
+  return TRUE;
+}
+
+static void
+gst_vosk_set_model_path (GstVosk *vosk,
+                         gchar **path_ptr,
+                         const gchar *model_path)
+{
+  if (!gst_vosk_can_change_model (vosk))
+    return;
+
   GST_INFO_OBJECT (vosk, "new path for model %s", model_path);
-  if(!g_strcmp0 (model_path, vosk->model_path))
+  if(!g_strcmp0 (model_path, *path_ptr))
     return;
 
-  if (vosk->model_path)
-    g_free (vosk->model_path);
+  if (*path_ptr)
+    g_free (*path_ptr);
+
+  *path_ptr = g_strdup (model_path);
+}
+
+static void
+gst_vosk_set_model_map (GstVosk *vosk,
+                        const GstStructure *model_map)
+{
+  if (!gst_vosk_can_change_model (vosk))
+    return;
+
+  if (vosk->model_map)
+    gst_structure_free (vosk->model_map);
+
+  vosk->model_map = model_map ? gst_structure_copy (model_map) : NULL;
+}
+
+/*
+ * Each key of the [vosk] group is the name of a property, its value is
+ * deserialized the way gst-launch does it.
+ */
+static void
+gst_vosk_load_config_file (GstVosk *vosk,
+                           const gchar *path)
+{
+  GKeyFile *key_file;
+  GError *error = NULL;
+  gchar **keys;
+  guint i;
+
+  g_free (vosk->config_file);
+  vosk->config_file = g_strdup (path);
 
-  vosk->model_path = g_strdup (model_path);
+  if (!path)
+    return;
+
+  key_file = g_key_file_new ();
+  if (!g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, &error)) {
+    GST_WARNING_OBJECT (vosk, "could not load configuration file %s (%s)",
+                        path, error->message);
+    g_error_free (error);
+    g_key_file_free (key_file);
+    return;
+  }
+
+  keys = g_key_file_get_keys (key_file, "vosk", NULL, NULL);
+  for (i = 0; keys && keys[i]; i++) {
+    GValue value = G_VALUE_INIT;
+    GParamSpec *pspec;
+    gchar *string;
+
+    pspec = g_object_class_find_property (G_OBJECT_GET_CLASS (vosk), keys[i]);
+    if (!pspec || !(pspec->flags & G_PARAM_WRITABLE) ||
+        !g_strcmp0 (keys[i], "config-file")) {
+      GST_WARNING_OBJECT (vosk, "%s: ignoring unknown or read-only property %s",
+                          path, keys[i]);
+      continue;
+    }
+
+    string = g_key_file_get_string (key_file, "vosk", keys[i], NULL);
+    g_value_init (&value, pspec->value_type);
+
+    if (string && gst_value_deserialize (&value, string)) {
+      GST_INFO_OBJECT (vosk, "%s: setting %s to %s", path, keys[i], string);
+      g_object_set_property (G_OBJECT (vosk), keys[i], &value);
+    }
+    else
+      GST_WARNING_OBJECT (vosk, "%s: invalid value for property %s",
+                          path, keys[i]);
+
+    g_value_unset (&value);
+    g_free (string);
+  }
+
+  g_strfreev (keys);
+  g_key_file_free (key_file);
 }
 
 static void
@@ -582,7 +1659,76 @@ gst_vosk_set_property (GObject * object, guint prop_id,
       break;
 
     case PROP_SPEECH_MODEL:
-      gst_vosk_set_model_path(vosk, g_value_get_string (value));
+      gst_vosk_set_model_path(vosk, &vosk->model_path, g_value_get_string (value));
+      break;
+
+    case PROP_RESCORING_MODEL:
+      gst_vosk_set_model_path(vosk, &vosk->rescoring_model_path, g_value_get_string (value));
+      break;
+
+    case PROP_RESCORING_THRESHOLD:
+      vosk->rescoring_threshold=g_value_get_double(value);
+      gst_vosk_update_core (vosk);
+      break;
+
+    case PROP_MAX_UTTERANCE_DURATION:
+      vosk->max_utterance_duration=g_value_get_int64(value) * GST_MSECOND;
+      gst_vosk_update_core (vosk);
+      break;
+
+    case PROP_RECYCLE_INTERVAL:
+      vosk->recycle_interval=g_value_get_int64(value) * GST_MSECOND;
+      gst_vosk_update_core (vosk);
+      break;
+
+    case PROP_SPECULATIVE_SILENCE:
+      vosk->speculative_silence=g_value_get_int64(value) * GST_MSECOND;
+      gst_vosk_update_core (vosk);
+      break;
+
+    case PROP_WAKE_PHRASES:
+      GST_VOSK_LOCK(vosk);
+      g_free (vosk->wake_phrases);
+      vosk->wake_phrases=g_value_dup_string (value);
+      if (vosk->wake_phrases && vosk->wake_phrases[0] == '\0') {
+        g_free (vosk->wake_phrases);
+        vosk->wake_phrases=NULL;
+      }
+      gst_vosk_configure_core (vosk);
+      GST_VOSK_UNLOCK(vosk);
+      break;
+
+    case PROP_WAKE_PREROLL:
+      vosk->wake_preroll=g_value_get_int64(value) * GST_MSECOND;
+      gst_vosk_update_core (vosk);
+      break;
+
+    case PROP_LAZY_HISTORY:
+      vosk->lazy_history=g_value_get_int64(value) * GST_MSECOND;
+      break;
+
+    case PROP_LAZY_COMPRESS:
+      vosk->lazy_compress=g_value_get_boolean (value);
+      break;
+
+    case PROP_DEDUPLICATE:
+      vosk->deduplicate=g_value_get_boolean (value);
+      break;
+
+    case PROP_DUPLICATE_TOLERANCE:
+      vosk->duplicate_tolerance=g_value_get_int64(value) * GST_MSECOND;
+      break;
+
+    case PROP_RESULT_FORMAT:
+      vosk->result_format=g_value_get_enum (value);
+      break;
+
+    case PROP_TRICK_MODE_RESULTS:
+      GST_VOSK_LOCK(vosk);
+      vosk->trick_mode_results=g_value_get_boolean (value);
+      if (!vosk->trick_mode_results)
+        g_queue_clear_full (&vosk->trick_results, (GDestroyNotify) gst_structure_free);
+      GST_VOSK_UNLOCK(vosk);
       break;
 
     case PROP_ALTERNATIVES:
@@ -590,81 +1736,172 @@ gst_vosk_set_property (GObject * object, guint prop_id,
         return;
 
       vosk->alternatives = g_value_get_int(value);
-      gst_vosk_set_num_alternatives (vosk);
+      gst_vosk_check_rescoring (vosk);
+      gst_vosk_update_core (vosk);
       break;
 
     case PROP_PARTIAL_RESULTS_INTERVAL:
       vosk->partial_time_interval=g_value_get_int64(value) * GST_MSECOND;
       break;
 
+    case PROP_CONFIG_FILE:
+      gst_vosk_load_config_file (vosk, g_value_get_string (value));
+      break;
+
+    case PROP_BATCH:
+      vosk->batch=g_value_get_boolean (value);
+      break;
+
+    case PROP_BATCH_DEADLINE:
+      vosk->batch_deadline=g_value_get_int64(value) * GST_MSECOND;
+      break;
+
+    case PROP_BATCH_SIZE:
+      vosk->batch_size=g_value_get_uint(value);
+      break;
+
+    case PROP_MODEL_MAP:
+      gst_vosk_set_model_map (vosk, gst_value_get_structure (value));
+      break;
+
+    case PROP_SUSPENDED:
+      GST_VOSK_LOCK(vosk);
+      gst_vosk_set_suspended (vosk, g_value_get_boolean (value), GST_CLOCK_TIME_NONE);
+      GST_VOSK_UNLOCK(vosk);
+      gst_vosk_results_deliver (vosk);
+      break;
+
+    case PROP_PULL_READ_SIZE:
+      vosk->pull_read_size=g_value_get_uint (value);
+      break;
+
+    case PROP_CPU_WARNING_RATIO:
+      GST_VOSK_LOCK(vosk);
+      vosk->cpu_warning_ratio=g_value_get_double (value);
+      GST_VOSK_UNLOCK(vosk);
+      break;
+
+    case PROP_CAPTION_FRAMERATE:
+      vosk->caption_fps_n=gst_value_get_fraction_numerator (value);
+      vosk->caption_fps_d=gst_value_get_fraction_denominator (value);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
   }
 }
 
-/*
- * MUST be called with lock held
- */
-static const gchar *
-gst_vosk_final_result (GstVosk *vosk)
+static void
+gst_vosk_revised_result (gpointer user_data,
+                         guint64 utterance_id,
+                         const gchar *json_txt)
 {
-  const gchar *json_txt = NULL;
+  GstVosk *vosk = GST_VOSK (user_data);
 
-  GST_INFO_OBJECT(vosk, "getting final result");
-
-  if (G_UNLIKELY(!vosk->recognizer)) {
-    GST_DEBUG_OBJECT(vosk, "no recognizer available");
-    return NULL;
-  }
+  /* Delivered in order with the other results, from this thread */
+  GST_VOSK_LOCK(vosk);
+  gst_vosk_message_new (vosk, "revised-result", json_txt, utterance_id, GST_CLOCK_TIME_NONE);
+  GST_VOSK_UNLOCK(vosk);
 
-  PROTECT_FROM_LOCALE_BUG_START
+  gst_vosk_results_deliver (vosk);
+}
 
-  json_txt = vosk_recognizer_final_result (vosk->recognizer);
+static GstClockTime
+gst_vosk_samples_to_time (GstVosk *vosk, guint64 samples)
+{
+  if (vosk->rate <= 0.0)
+    return 0;
 
-  PROTECT_FROM_LOCALE_BUG_END
+  return gst_util_uint64_scale (samples, GST_SECOND, (guint64) vosk->rate);
+}
 
-  if (vosk->prev_partial) {
-    g_free (vosk->prev_partial);
-    vosk->prev_partial = NULL;
-  }
+static guint64
+gst_vosk_process_rss (void)
+{
+  gchar *contents = NULL;
+  gchar **fields;
+  guint64 rss = 0;
 
-  GST_INFO_OBJECT(vosk, "final results");
+  /* Only available on Linux */
+  if (!g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL))
+    return 0;
 
-  if (!json_txt ||
-      !strcmp(json_txt, VOSK_EMPTY_TEXT_RESULT) ||
-      !strcmp(json_txt, VOSK_EMPTY_TEXT_RESULT_ALT))
-    return NULL;
+  fields = g_strsplit (contents, " ", 3);
+  if (fields[0] && fields[1])
+    rss = g_ascii_strtoull (fields[1], NULL, 10) * sysconf (_SC_PAGESIZE);
 
-  return json_txt;
+  g_strfreev (fields);
+  g_free (contents);
+  return rss;
 }
 
-static const gchar *
-gst_vosk_result (GstVosk *vosk)
+/*
+ * Returns the CPU time spent decoding the stream, whatever the cores used.
+ * MUST be called with lock held
+ */
+static guint64
+gst_vosk_stream_cpu_time (GstVosk *vosk)
 {
-  const char *json_txt;
+  GstVoskCoreStats stats;
 
-  if (G_UNLIKELY(!vosk->recognizer)) {
-    GST_DEBUG_OBJECT(vosk, "no recognizer available");
-    return NULL;
-  }
+  if (!vosk->core)
+    return vosk->cpu_time;
 
-  PROTECT_FROM_LOCALE_BUG_START
+  gst_vosk_core_get_stats (vosk->core, &stats);
+  return vosk->cpu_time + stats.cpu_time - vosk->core_cpu_time;
+}
 
-  json_txt = vosk_recognizer_result (vosk->recognizer);
+/*
+ * MUST be called with lock held
+ */
+static GstStructure *
+gst_vosk_get_stats (GstVosk *vosk)
+{
+  GstVoskCoreStats stats = { 0, };
 
-  PROTECT_FROM_LOCALE_BUG_END
+  if (vosk->core)
+    gst_vosk_core_get_stats (vosk->core, &stats);
+  else
+    stats.recognizer_audio_duration = gst_vosk_samples_to_time (vosk, vosk->batch_samples);
+
+  return gst_structure_new ("application/x-vosk-stats",
+                            "utterance-duration", G_TYPE_UINT64, stats.utterance_duration,
+                            "recognizer-audio-duration", G_TYPE_UINT64, stats.recognizer_audio_duration,
+                            "retained-audio-bytes", G_TYPE_UINT64, stats.retained_audio_bytes,
+                            "forced-results", G_TYPE_UINT64, stats.forced_results,
+                            "recognizer-recycles", G_TYPE_UINT64, stats.recognizer_recycles,
+                            "skipped-duration", G_TYPE_UINT64, vosk->skipped_duration,
+                            "decoded-duration", G_TYPE_UINT64, vosk->decoded_duration,
+                            "cpu-time", G_TYPE_UINT64, gst_vosk_stream_cpu_time (vosk),
+                            "utterance-cpu-time", G_TYPE_UINT64, stats.utterance_cpu_time,
+                            "gap-duration", G_TYPE_UINT64, stats.gap_duration,
+                            "awake", G_TYPE_BOOLEAN, vosk->core ? gst_vosk_core_is_awake (vosk->core) : TRUE,
+                            "duplicated", G_TYPE_BOOLEAN, vosk->duplicated,
+                            "trick-mode", G_TYPE_BOOLEAN, vosk->trick_mode,
+                            "history-duration", G_TYPE_UINT64, vosk->history ? gst_vosk_history_get_duration (vosk->history) : 0,
+                            "history-bytes", G_TYPE_UINT64, (guint64) (vosk->history ? gst_vosk_history_get_size (vosk->history) : 0),
+                            "process-rss", G_TYPE_UINT64, gst_vosk_process_rss (),
+                            NULL);
+}
 
-  if (vosk->prev_partial) {
-    g_free (vosk->prev_partial);
-    vosk->prev_partial = NULL;
+/*
+ * An utterance that ends without text retracts its tentative result: that is
+ * not a result for the property but it must still reach the application.
+ * MUST be called with lock held
+ */
+static void
+gst_vosk_property_result (GstVosk *vosk,
+                          GstVoskCoreResult *result,
+                          GValue *prop_value)
+{
+  if (result && result->type == GST_VOSK_CORE_RESULT_RETRACTED) {
+    gst_vosk_result_post (vosk, result);
+    result = NULL;
   }
 
-  /* Don't send message if empty */
-  if (!json_txt || !strcmp(json_txt, VOSK_EMPTY_TEXT_RESULT))
-    return NULL;
-
-  return json_txt;
+  g_value_set_string (prop_value, result ? result->json : NULL);
+  gst_vosk_core_result_free (result);
 }
 
 static void
@@ -674,6 +1911,7 @@ gst_vosk_get_property (GObject *object,
                        GParamSpec *pspec)
 {
   GstVosk *vosk = GST_VOSK (object);
+  GstVoskCoreResult *result;
 
   switch (prop_id) {
     case PROP_USE_SIGNALS:
@@ -690,75 +1928,1098 @@ gst_vosk_get_property (GObject *object,
 
     case PROP_CURRENT_FINAL_RESULTS:
       GST_VOSK_LOCK(vosk);
-      g_value_set_string (prop_value, gst_vosk_final_result(vosk));
+      result = vosk->core ? gst_vosk_core_final_result (vosk->core) : NULL;
+      gst_vosk_property_result (vosk, result, prop_value);
       GST_VOSK_UNLOCK(vosk);
+      gst_vosk_results_deliver (vosk);
       break;
 
     case PROP_CURRENT_RESULTS:
       GST_VOSK_LOCK(vosk);
-      g_value_set_string (prop_value, gst_vosk_result(vosk));
+      result = vosk->core ? gst_vosk_core_result (vosk->core) : NULL;
+      gst_vosk_property_result (vosk, result, prop_value);
       GST_VOSK_UNLOCK(vosk);
+      gst_vosk_results_deliver (vosk);
       break;
 
     case PROP_PARTIAL_RESULTS_INTERVAL:
       g_value_set_int64(prop_value, vosk->partial_time_interval / GST_MSECOND);
       break;
 
-    default:
-      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    case PROP_RESCORING_MODEL:
+      g_value_set_string (prop_value, vosk->rescoring_model_path);
       break;
-  }
-}
 
-static void
-gst_vosk_message_new (GstVosk *vosk, const gchar *text_results)
-{
-  if (!text_results)
-    return;
+    case PROP_RESCORING_THRESHOLD:
+      g_value_set_double (prop_value, vosk->rescoring_threshold);
+      break;
 
-  if (vosk->use_signals)
-    g_signal_emit(vosk, signals[RESULT], 0, text_results);
-  else {
-    GstMessage *msg;
-    GstStructure *contents;
-    GValue value = G_VALUE_INIT;
+    case PROP_MAX_UTTERANCE_DURATION:
+      g_value_set_int64(prop_value, vosk->max_utterance_duration / GST_MSECOND);
+      break;
+
+    case PROP_RECYCLE_INTERVAL:
+      g_value_set_int64(prop_value, vosk->recycle_interval / GST_MSECOND);
+      break;
+
+    case PROP_SPECULATIVE_SILENCE:
+      g_value_set_int64(prop_value, vosk->speculative_silence / GST_MSECOND);
+      break;
+
+    case PROP_WAKE_PHRASES:
+      GST_VOSK_LOCK(vosk);
+      g_value_set_string (prop_value, vosk->wake_phrases);
+      GST_VOSK_UNLOCK(vosk);
+      break;
+
+    case PROP_WAKE_PREROLL:
+      g_value_set_int64(prop_value, vosk->wake_preroll / GST_MSECOND);
+      break;
+
+    case PROP_LAZY_HISTORY:
+      g_value_set_int64(prop_value, vosk->lazy_history / GST_MSECOND);
+      break;
+
+    case PROP_LAZY_COMPRESS:
+      g_value_set_boolean (prop_value, vosk->lazy_compress);
+      break;
+
+    case PROP_DEDUPLICATE:
+      g_value_set_boolean (prop_value, vosk->deduplicate);
+      break;
+
+    case PROP_DUPLICATE_TOLERANCE:
+      g_value_set_int64(prop_value, vosk->duplicate_tolerance / GST_MSECOND);
+      break;
+
+    case PROP_RESULT_FORMAT:
+      g_value_set_enum (prop_value, vosk->result_format);
+      break;
+
+    case PROP_TRICK_MODE_RESULTS:
+      g_value_set_boolean (prop_value, vosk->trick_mode_results);
+      break;
+
+    case PROP_STATS:
+      GST_VOSK_LOCK(vosk);
+      g_value_take_boxed (prop_value, gst_vosk_get_stats(vosk));
+      GST_VOSK_UNLOCK(vosk);
+      break;
+
+    case PROP_CONFIG_FILE:
+      g_value_set_string (prop_value, vosk->config_file);
+      break;
+
+    case PROP_BATCH:
+      g_value_set_boolean (prop_value, vosk->batch);
+      break;
+
+    case PROP_BATCH_DEADLINE:
+      g_value_set_int64(prop_value, vosk->batch_deadline / GST_MSECOND);
+      break;
+
+    case PROP_BATCH_SIZE:
+      g_value_set_uint(prop_value, vosk->batch_size);
+      break;
+
+    case PROP_MODEL_MAP:
+      gst_value_set_structure (prop_value, vosk->model_map);
+      break;
+
+    case PROP_SUSPENDED:
+      GST_VOSK_LOCK(vosk);
+      g_value_set_boolean (prop_value, vosk->suspended);
+      GST_VOSK_UNLOCK(vosk);
+      break;
+
+    case PROP_PULL_READ_SIZE:
+      g_value_set_uint (prop_value, vosk->pull_read_size);
+      break;
+
+    case PROP_CPU_WARNING_RATIO:
+      GST_VOSK_LOCK(vosk);
+      g_value_set_double (prop_value, vosk->cpu_warning_ratio);
+      GST_VOSK_UNLOCK(vosk);
+      break;
+
+    case PROP_CAPTION_FRAMERATE:
+      gst_value_set_fraction (prop_value, vosk->caption_fps_n, vosk->caption_fps_d);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+/*
+ * Results are only queued here: application code (signal handlers, sync bus
+ * handlers) runs in gst_vosk_results_deliver() once the lock is released.
+ * MUST be called with lock held
+ */
+static void
+gst_vosk_message_new (GstVosk *vosk,
+                      const gchar *field,
+                      const gchar *text_results,
+                      guint64 utterance_id,
+                      GstClockTime cpu_time)
+{
+  GstStructure *contents;
+
+  if (!text_results)
+    return;
+
+  contents = gst_structure_new ("vosk",
+                                field, G_TYPE_STRING, text_results,
+                                "utterance-id", G_TYPE_UINT64, utterance_id,
+                                NULL);
+
+  /* Not measured when decoding is shared (batch mode) */
+  if (GST_CLOCK_TIME_IS_VALID (cpu_time))
+    gst_structure_set (contents, "cpu-time", G_TYPE_UINT64, cpu_time, NULL);
+
+  if (vosk->duplicate)
+    gst_vosk_duplicate_share (vosk->duplicate, contents);
+
+  gst_vosk_encode_results (vosk, contents);
+  g_queue_push_tail (&vosk->results_pending, contents);
+}
+
+/*
+ * MUST NOT be called with lock held.
+ */
+static void
+gst_vosk_results_deliver (GstVosk *vosk)
+{
+  GstStructure *contents;
+  GPtrArray *results;
+  guint i;
+
+  g_rec_mutex_lock (&vosk->DeliverMut);
+
+  GST_VOSK_LOCK(vosk);
+  if (g_queue_is_empty (&vosk->results_pending)) {
+    GST_VOSK_UNLOCK(vosk);
+    g_rec_mutex_unlock (&vosk->DeliverMut);
+    return;
+  }
+
+  results = g_ptr_array_new_full (g_queue_get_length (&vosk->results_pending),
+                                  (GDestroyNotify) gst_structure_free);
+  while ((contents = g_queue_pop_head (&vosk->results_pending)))
+    g_ptr_array_add (results, contents);
+  GST_VOSK_UNLOCK(vosk);
+
+  if (vosk->use_signals) {
+    g_signal_emit (vosk, signals[RESULTS], 0, results);
+
+    for (i = 0; i < results->len; i++) {
+      const gchar *json_txt;
+      guint64 utterance_id = 0;
+
+      contents = g_ptr_array_index (results, i);
+      gst_structure_get_uint64 (contents, "utterance-id", &utterance_id);
+
+      if ((json_txt = gst_structure_get_string (contents, "transcription"))) {
+        gst_structure_get_uint64 (contents, "transcription-id", &utterance_id);
+        g_signal_emit (vosk, signals[TRANSCRIPTION], 0, json_txt, utterance_id);
+      }
+      else if ((json_txt = gst_structure_get_string (contents, "current-result")))
+        g_signal_emit (vosk, signals[RESULT], 0, json_txt);
+      else if ((json_txt = gst_structure_get_string (contents, "tentative-result")))
+        g_signal_emit (vosk, signals[TENTATIVE_RESULT], 0, json_txt, utterance_id);
+      else if ((json_txt = gst_structure_get_string (contents, "retracted-result")))
+        g_signal_emit (vosk, signals[RETRACTED_RESULT], 0, json_txt, utterance_id);
+      else if ((json_txt = gst_structure_get_string (contents, "revised-result")))
+        g_signal_emit (vosk, signals[REVISED_RESULT], 0, json_txt, utterance_id);
+    }
+  }
+  else {
+    for (i = 0; i < results->len; i++) {
+      contents = gst_structure_copy (g_ptr_array_index (results, i));
+      gst_element_post_message (GST_ELEMENT (vosk),
+                                gst_message_new_element (GST_OBJECT (vosk), contents));
+    }
+  }
+
+  g_rec_mutex_unlock (&vosk->DeliverMut);
+  g_ptr_array_unref (results);
+}
+
+/*
+ * Called from the batching thread. Each batch result closes an utterance.
+ * It is delivered by the streaming thread so that a slow application does not
+ * hold back the batches of the other streams.
+ */
+static void
+gst_vosk_batch_result (GstElement *element,
+                       const gchar *json_txt)
+{
+  GstVosk *vosk = GST_VOSK (element);
+
+  if (!strcmp(json_txt, VOSK_EMPTY_TEXT_RESULT) ||
+      !strcmp(json_txt, VOSK_EMPTY_TEXT_RESULT_ALT))
+    return;
+
+  GST_VOSK_LOCK(vosk);
+  if (vosk->caption)
+    gst_vosk_caption_push_result (vosk->caption, json_txt, TRUE);
+  gst_vosk_message_new (vosk, "current-result", json_txt, vosk->utterance_id, GST_CLOCK_TIME_NONE);
+  vosk->utterance_id++;
+  GST_VOSK_UNLOCK(vosk);
+}
+
+/*
+ * Gathers the input buffers of the utterance that just ended into a single
+ * buffer sharing their memory, with the result attached.
+ * MUST be called with lock held
+ */
+static void
+gst_vosk_utterance_close (GstVosk *vosk,
+                          GstVoskCoreResult *result)
+{
+  GstCustomMeta *meta;
+  GstBuffer *utterance;
+  GstBuffer *buf;
+
+  if (g_queue_is_empty (&vosk->utterance_buffers))
+    return;
+
+  utterance = gst_buffer_new ();
+  gst_buffer_copy_into (utterance,
+                        g_queue_peek_head (&vosk->utterance_buffers),
+                        GST_BUFFER_COPY_TIMESTAMPS,
+                        0, -1);
+
+  while ((buf = g_queue_pop_head (&vosk->utterance_buffers))) {
+    gst_buffer_copy_into (utterance, buf, GST_BUFFER_COPY_MEMORY, 0, -1);
+    gst_buffer_unref (buf);
+  }
+
+  GST_BUFFER_DURATION (utterance) = gst_vosk_samples_to_time (vosk,
+                                                              gst_buffer_get_size (utterance) / sizeof (gint16));
+
+  meta = gst_buffer_add_custom_meta (utterance, GST_VOSK_RESULT_META);
+  gst_structure_set (gst_custom_meta_get_structure (meta),
+                     "result", G_TYPE_STRING, result->json,
+                     "utterance-id", G_TYPE_UINT64, result->utterance_id,
+                     NULL);
+
+  g_queue_push_tail (&vosk->utterance_pending, utterance);
+}
+
+/*
+ * Pushes the utterances that ended on utterance_src. MUST NOT be called with
+ * lock held.
+ */
+static void
+gst_vosk_utterance_push (GstVosk *vosk)
+{
+  GQueue pending = G_QUEUE_INIT;
+  GstBuffer *utterance;
+  GstPad *pad = NULL;
+
+  GST_VOSK_LOCK(vosk);
+  if (vosk->utterance_srcpad && !g_queue_is_empty (&vosk->utterance_pending)) {
+    pad = gst_object_ref (vosk->utterance_srcpad);
+    pending = vosk->utterance_pending;
+    g_queue_init (&vosk->utterance_pending);
+  }
+  GST_VOSK_UNLOCK(vosk);
+
+  if (!pad)
+    return;
+
+  /* Not linked is not an error: nobody wants them */
+  while ((utterance = g_queue_pop_head (&pending)))
+    gst_pad_push (pad, utterance);
+
+  gst_object_unref (pad);
+}
+
+/*
+ * Returns the caption frames up to end (all of the pending captions if end is
+ * GST_CLOCK_TIME_NONE). Their timestamps follow the audio.
+ * MUST be called with lock held
+ */
+static GstBufferList *
+gst_vosk_caption_frames (GstVosk *vosk,
+                         GstClockTime end)
+{
+  GstBufferList *frames;
+
+  if (!vosk->caption || !GST_CLOCK_TIME_IS_VALID (vosk->caption_start))
+    return NULL;
+
+  frames = gst_buffer_list_new ();
+
+  for (;;) {
+    GstClockTime time, next;
+    GstBuffer *frame;
+    guint8 pair[2];
+
+    time = vosk->caption_start +
+           gst_util_uint64_scale (vosk->caption_frames,
+                                  GST_SECOND * vosk->caption_fps_d,
+                                  vosk->caption_fps_n);
+
+    if (GST_CLOCK_TIME_IS_VALID (end) ? time >= end :
+                                        gst_vosk_caption_is_empty (vosk->caption))
+      break;
+
+    next = vosk->caption_start +
+           gst_util_uint64_scale (vosk->caption_frames + 1,
+                                  GST_SECOND * vosk->caption_fps_d,
+                                  vosk->caption_fps_n);
+
+    gst_vosk_caption_next_pair (vosk->caption, pair);
+    frame = gst_buffer_new_memdup (pair, sizeof (pair));
+    GST_BUFFER_PTS (frame) = time;
+    GST_BUFFER_DURATION (frame) = next - time;
+    gst_buffer_list_add (frames, frame);
+
+    vosk->caption_frames++;
+  }
+
+  return frames;
+}
+
+/*
+ * Sends the events that start the caption stream the first time.
+ * MUST NOT be called with lock held.
+ */
+static void
+gst_vosk_caption_start (GstVosk *vosk,
+                        GstPad *pad)
+{
+  GstEvent *segment;
+  GstCaps *caps;
+  gchar *stream_id;
+  gint fps_n, fps_d;
+
+  GST_VOSK_LOCK(vosk);
+  if (vosk->caption_started) {
+    GST_VOSK_UNLOCK(vosk);
+    return;
+  }
+  vosk->caption_started = TRUE;
+  fps_n = vosk->caption_fps_n;
+  fps_d = vosk->caption_fps_d;
+  GST_VOSK_UNLOCK(vosk);
+
+  stream_id = gst_pad_create_stream_id (pad, GST_ELEMENT (vosk), "caption");
+  gst_pad_push_event (pad, gst_event_new_stream_start (stream_id));
+  g_free (stream_id);
+
+  caps = gst_caps_new_simple ("closedcaption/x-cea-608",
+                              "format", G_TYPE_STRING, "raw",
+                              "framerate", GST_TYPE_FRACTION, fps_n, fps_d,
+                              NULL);
+  gst_pad_push_event (pad, gst_event_new_caps (caps));
+  gst_caps_unref (caps);
+
+  /* Same timeline as the audio */
+  segment = gst_pad_get_sticky_event (vosk->sinkpad, GST_EVENT_SEGMENT, 0);
+  if (!segment) {
+    GstSegment time_segment;
+
+    gst_segment_init (&time_segment, GST_FORMAT_TIME);
+    segment = gst_event_new_segment (&time_segment);
+  }
+  gst_pad_push_event (pad, segment);
+}
+
+/*
+ * MUST NOT be called with lock held.
+ */
+static void
+gst_vosk_caption_push (GstVosk *vosk,
+                       GstBufferList *frames)
+{
+  GstPad *pad = NULL;
+
+  if (!frames)
+    return;
+
+  GST_VOSK_LOCK(vosk);
+  if (vosk->caption_srcpad)
+    pad = gst_object_ref (vosk->caption_srcpad);
+  GST_VOSK_UNLOCK(vosk);
+
+  if (!pad || !gst_buffer_list_length (frames)) {
+    gst_buffer_list_unref (frames);
+    if (pad)
+      gst_object_unref (pad);
+    return;
+  }
+
+  gst_vosk_caption_start (vosk, pad);
+  gst_pad_push_list (pad, frames);
+  gst_object_unref (pad);
+}
+
+/*
+ * caption_src is not linked to the sink pad: forward what it needs.
+ */
+static void
+gst_vosk_caption_event (GstVosk *vosk,
+                        GstEvent *event)
+{
+  GstBufferList *frames = NULL;
+  gboolean forward = FALSE;
+  GstPad *pad = NULL;
+
+  GST_VOSK_LOCK(vosk);
+  if (!vosk->caption_srcpad) {
+    GST_VOSK_UNLOCK(vosk);
+    return;
+  }
+
+  pad = gst_object_ref (vosk->caption_srcpad);
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_FLUSH_START:
+      forward = vosk->caption_started;
+      break;
+
+    case GST_EVENT_FLUSH_STOP:
+      gst_vosk_caption_reset (vosk->caption);
+      vosk->caption_start = GST_CLOCK_TIME_NONE;
+      forward = vosk->caption_started;
+      break;
+
+    case GST_EVENT_SEGMENT:
+      /* Frames are timed from the first buffer of the segment */
+      vosk->caption_start = GST_CLOCK_TIME_NONE;
+      forward = vosk->caption_started;
+      break;
+
+    case GST_EVENT_EOS:
+      frames = gst_vosk_caption_frames (vosk, GST_CLOCK_TIME_NONE);
+      forward = TRUE;
+      break;
+
+    case GST_EVENT_GAP: {
+      GstClockTime timestamp, duration;
+
+      /* Captions keep going through missing audio */
+      gst_event_parse_gap (event, &timestamp, &duration);
+      if (GST_CLOCK_TIME_IS_VALID (vosk->caption_start) &&
+          GST_CLOCK_TIME_IS_VALID (duration))
+        frames = gst_vosk_caption_frames (vosk, timestamp + duration);
+      break;
+    }
+
+    default:
+      break;
+  }
+  GST_VOSK_UNLOCK(vosk);
+
+  gst_vosk_caption_push (vosk, frames);
+
+  if (forward) {
+    gst_vosk_caption_start (vosk, pad);
+    gst_pad_push_event (pad, gst_event_ref (event));
+  }
+
+  gst_object_unref (pad);
+}
+
+/*
+ * Keeps a final result with the range of the stream it comes from.
+ * MUST be called with lock held
+ */
+static void
+gst_vosk_trick_results_add (GstVosk *vosk,
+                            GstVoskCoreResult *result)
+{
+  GstClockTime start = vosk->utterance_pts;
+  GstClockTime stop = vosk->next_pts;
+  GList *iter, *next;
+
+  vosk->utterance_pts = GST_CLOCK_TIME_NONE;
+
+  if (!vosk->trick_mode_results ||
+      !GST_CLOCK_TIME_IS_VALID (start) ||
+      !GST_CLOCK_TIME_IS_VALID (stop) ||
+      !result->json ||
+      !strcmp (result->json, VOSK_EMPTY_TEXT_RESULT) ||
+      !strcmp (result->json, VOSK_EMPTY_TEXT_RESULT_ALT))
+    return;
+
+  /* The range was played again: the new result replaces the old one */
+  for (iter = vosk->trick_results.head; iter; iter = next) {
+    GstClockTime cached_start = GST_CLOCK_TIME_NONE;
+
+    next = iter->next;
+    gst_structure_get_clock_time (iter->data, "start", &cached_start);
+    if (cached_start >= start && cached_start < stop) {
+      gst_structure_free (iter->data);
+      g_queue_delete_link (&vosk->trick_results, iter);
+    }
+  }
+
+  g_queue_push_tail (&vosk->trick_results,
+                     gst_structure_new ("vosk",
+                                        "cached-result", G_TYPE_STRING, result->json,
+                                        "utterance-id", G_TYPE_UINT64, result->utterance_id,
+                                        "start", G_TYPE_UINT64, start,
+                                        "stop", G_TYPE_UINT64, stop,
+                                        NULL));
+
+  if (g_queue_get_length (&vosk->trick_results) > TRICK_RESULTS_MAX)
+    gst_structure_free (g_queue_pop_head (&vosk->trick_results));
+}
+
+/*
+ * Queues the cached results that start between start and stop.
+ * MUST be called with lock held
+ */
+static void
+gst_vosk_trick_results_play (GstVosk *vosk,
+                             GstClockTime start,
+                             GstClockTime stop)
+{
+  GList *iter;
+
+  for (iter = vosk->trick_results.head; iter; iter = iter->next) {
+    GstClockTime cached_start = GST_CLOCK_TIME_NONE;
+    GstStructure *contents;
+
+    gst_structure_get_clock_time (iter->data, "start", &cached_start);
+    if (cached_start < start || cached_start >= stop)
+      continue;
+
+    contents = gst_structure_copy (iter->data);
+    gst_vosk_encode_results (vosk, contents);
+    g_queue_push_tail (&vosk->results_pending, contents);
+  }
+}
+
+static void
+gst_vosk_result_post (GstVosk *vosk, GstVoskCoreResult *result)
+{
+  const gchar *field;
+
+  if (!result)
+    return;
+
+  switch (result->type) {
+    case GST_VOSK_CORE_RESULT_TENTATIVE:
+      field = "tentative-result";
+      break;
+
+    case GST_VOSK_CORE_RESULT_RETRACTED:
+      field = "retracted-result";
+      break;
+
+    default:
+      field = "current-result";
+
+      if (vosk->utterance_srcpad && result->type == GST_VOSK_CORE_RESULT_FINAL)
+        gst_vosk_utterance_close (vosk, result);
+
+      if (result->type == GST_VOSK_CORE_RESULT_FINAL)
+        gst_vosk_trick_results_add (vosk, result);
+
+      if (vosk->caption)
+        gst_vosk_caption_push_result (vosk->caption,
+                                      result->json,
+                                      result->type == GST_VOSK_CORE_RESULT_FINAL);
+      break;
+  }
+
+  gst_vosk_message_new (vosk, field, result->json, result->utterance_id, result->cpu_time);
+  gst_vosk_core_result_free (result);
+}
+
+inline static void
+gst_vosk_final_result_msg (GstVosk *vosk)
+{
+  if (vosk->core)
+    gst_vosk_result_post (vosk, gst_vosk_core_final_result (vosk->core));
+
+  /* The utterance is over even when it had no result */
+  vosk->utterance_pts = GST_CLOCK_TIME_NONE;
+}
+
+static void
+gst_vosk_flush(GstVosk *vosk)
+{
+  GST_INFO_OBJECT (vosk, "flushing");
+
+  GST_VOSK_LOCK(vosk);
+
+  if (vosk->core)
+    gst_vosk_core_flush (vosk->core);
+  else
+    GST_DEBUG_OBJECT (vosk, "no recognizer to flush");
+
+  gst_vosk_utterance_clear (vosk);
+  vosk->next_pts = GST_CLOCK_TIME_NONE;
+  vosk->utterance_pts = GST_CLOCK_TIME_NONE;
+
+  GST_VOSK_UNLOCK(vosk);
+}
+
+/*
+ * The audio already handed to the batcher is still decoded: a batch stream
+ * cannot be finished and started again.
+ * MUST be called with lock held
+ */
+static void
+gst_vosk_set_suspended (GstVosk *vosk,
+                        gboolean suspended,
+                        GstClockTime resume_time)
+{
+  vosk->resume_time = suspended ? resume_time : GST_CLOCK_TIME_NONE;
+
+  if (vosk->suspended == suspended)
+    return;
+
+  GST_INFO_OBJECT (vosk, "recognition %s.", suspended ? "suspended" : "resumed");
+  vosk->suspended = suspended;
+
+  if (suspended && GST_VOSK_HAS_RECOGNIZER(vosk)) {
+    gst_vosk_final_result_msg (vosk);
+    gst_vosk_core_flush (vosk->core);
+  }
+}
+
+/*
+ * Decoding stops while the audio is not played at normal rate: sped up or
+ * slowed down audio (applied rate) and skipped audio (trick modes) give
+ * wrong results. Audio pushed at normal rate but played faster downstream
+ * would need to be decoded faster than real time.
+ * MUST be called with lock held
+ */
+static void
+gst_vosk_update_trick_mode (GstVosk *vosk)
+{
+  gboolean trick_mode;
+
+  trick_mode = vosk->segment_rate * vosk->rate_multiplier != 1.0 ||
+               vosk->segment_applied_rate != 1.0 ||
+               (vosk->segment_flags & GST_VOSK_TRICK_MODE_FLAGS) != 0;
+
+  if (vosk->trick_mode == trick_mode)
+    return;
+
+  GST_INFO_OBJECT (vosk, "%s trick mode (rate %f, applied rate %f, flags 0x%x).",
+                   trick_mode ? "entering" : "leaving",
+                   vosk->segment_rate * vosk->rate_multiplier,
+                   vosk->segment_applied_rate,
+                   vosk->segment_flags);
+  vosk->trick_mode = trick_mode;
+
+  /* The utterance ends with the audio at normal rate */
+  if (trick_mode && GST_VOSK_HAS_RECOGNIZER(vosk)) {
+    gst_vosk_final_result_msg (vosk);
+    gst_vosk_core_flush (vosk->core);
+    gst_vosk_utterance_clear (vosk);
+  }
+
+  /* Start again as after a seek */
+  vosk->utterance_pts = GST_CLOCK_TIME_NONE;
+  vosk->last_processed_time = GST_CLOCK_TIME_NONE;
+}
+
+typedef struct {
+  GstVosk *vosk;
+  gchar *path;
+  GstVoskModel *model;
+  gfloat rate;
+  gint alternatives;
+  GByteArray *audio;
+  GstClockTime start;
+  GstClockTime stop;
+  guint64 id;
+} GstVoskTranscription;
+
+static GThreadPool *transcription_pool = NULL;
+G_LOCK_DEFINE_STATIC (transcription_pool);
+
+/*
+ * Called from a transcription thread. The recognizer is created for the job
+ * (models come from the cache) and fed faster than real time.
+ */
+static void
+gst_vosk_transcription_run (gpointer data,
+                            gpointer user_data G_GNUC_UNUSED)
+{
+  GstVoskTranscription *job = data;
+  GstVosk *vosk = job->vosk;
+  GstVoskCoreStats stats = { 0, };
+  GstVoskCoreResult *result;
+  GstStructure *contents;
+  GstVoskCore *core;
+  GString *results;
+  gsize num_samples, block, offset;
+
+  GST_INFO_OBJECT (vosk, "transcription %" G_GUINT64_FORMAT " from %" GST_TIME_FORMAT
+                   " to %" GST_TIME_FORMAT, job->id,
+                   GST_TIME_ARGS (job->start), GST_TIME_ARGS (job->stop));
+
+  results = g_string_new ("[");
+
+  if (job->model)
+    core = gst_vosk_core_new_for_model (job->model, NULL);
+  else
+    core = gst_vosk_core_new (job->path, NULL);
+
+  if (core) {
+    gst_vosk_core_set_alternatives (core, job->alternatives);
+    gst_vosk_core_set_partial_interval (core, -1);
+  }
+
+  if (core && gst_vosk_core_start (core, job->rate)) {
+    /* Word times are the timestamps of the stream */
+    gst_vosk_core_skip (core, job->start);
+
+    num_samples = job->audio->len / sizeof (gint16);
+    block = MAX (1, gst_util_uint64_scale (TRANSCRIPTION_BLOCK, (guint64) job->rate, GST_SECOND));
+    for (offset = 0; offset < num_samples; offset += block) {
+      if (!gst_vosk_core_feed (core,
+                               (const gint16 *) job->audio->data + offset,
+                               MIN (block, num_samples - offset)))
+        break;
+    }
+    gst_vosk_core_finish (core);
+
+    while ((result = gst_vosk_core_pop_result (core))) {
+      if (result->type == GST_VOSK_CORE_RESULT_FINAL) {
+        if (results->len > 1)
+          g_string_append_c (results, ',');
+        g_string_append (results, result->json);
+      }
+      gst_vosk_core_result_free (result);
+    }
+
+    gst_vosk_core_get_stats (core, &stats);
+  }
+  else
+    GST_WARNING_OBJECT (vosk, "could not create a recognizer for transcription %" G_GUINT64_FORMAT ".", job->id);
+
+  gst_vosk_core_free (core);
+  g_string_append_c (results, ']');
+
+  contents = gst_structure_new ("vosk",
+                                "transcription", G_TYPE_STRING, results->str,
+                                "transcription-id", G_TYPE_UINT64, job->id,
+                                "start", G_TYPE_UINT64, job->start,
+                                "stop", G_TYPE_UINT64, job->stop,
+                                NULL);
+  if (stats.cpu_time)
+    gst_structure_set (contents, "cpu-time", G_TYPE_UINT64, stats.cpu_time, NULL);
+  g_string_free (results, TRUE);
+
+  GST_VOSK_LOCK(vosk);
+  g_queue_push_tail (&vosk->results_pending, contents);
+  GST_VOSK_UNLOCK(vosk);
+
+  gst_vosk_results_deliver (vosk);
+
+  gst_object_unref (vosk);
+  g_byte_array_unref (job->audio);
+  gst_vosk_model_unref (job->model);
+  g_free (job->path);
+  g_free (job);
+}
+
+/*
+ * MUST be called with lock held
+ */
+static const gchar *
+gst_vosk_current_model_path (GstVosk *vosk)
+{
+  const gchar *path = NULL;
+
+  if (vosk->model_map && g_strcmp0 (vosk->language, GST_VOSK_DEFAULT_LANGUAGE))
+    path = gst_structure_get_string (vosk->model_map, vosk->language);
+
+  return path ? path : vosk->model_path;
+}
+
+static guint64
+gst_vosk_transcribe (GstVosk *vosk,
+                     GstClockTime start,
+                     GstClockTime stop)
+{
+  GstVoskTranscription *job;
+  GByteArray *audio;
+  guint64 id;
+
+  GST_VOSK_LOCK(vosk);
+  if (!vosk->history) {
+    GST_VOSK_UNLOCK(vosk);
+    GST_WARNING_OBJECT (vosk, "transcriptions are only possible in lazy mode.");
+    return 0;
+  }
+
+  audio = gst_vosk_history_get (vosk->history, &start, &stop);
+  if (!audio) {
+    GST_VOSK_UNLOCK(vosk);
+    GST_INFO_OBJECT (vosk, "nothing left to transcribe in this range.");
+    return 0;
+  }
+
+  job = g_new0 (GstVoskTranscription, 1);
+  job->vosk = gst_object_ref (vosk);
+  job->path = g_strdup (gst_vosk_current_model_path (vosk));
+
+  /* It may not be the one the cache has for that path */
+  if (vosk->model && !g_strcmp0 (job->path, gst_vosk_model_get_path (vosk->model)))
+    job->model = gst_vosk_model_ref (vosk->model);
+  job->rate = vosk->rate;
+  job->alternatives = vosk->alternatives;
+  job->audio = audio;
+  job->start = start;
+  job->stop = stop;
+  job->id = id = ++vosk->transcription_id;
+  GST_VOSK_UNLOCK(vosk);
+
+  /* Shared by all elements, like the rescoring threads */
+  G_LOCK (transcription_pool);
+  if (!transcription_pool)
+    transcription_pool = g_thread_pool_new (gst_vosk_transcription_run,
+                                            NULL,
+                                            MAX (1, g_get_num_processors () / 2),
+                                            FALSE,
+                                            NULL);
+  G_UNLOCK (transcription_pool);
+
+  g_thread_pool_push (transcription_pool, job, NULL);
+  return id;
+}
+
+static void
+gst_vosk_custom_event (GstVosk *vosk,
+                       GstEvent *event)
+{
+  if (gst_event_has_name (event, GST_VOSK_SUSPEND_EVENT)) {
+    const GstStructure *structure = gst_event_get_structure (event);
+    GstClockTime resume_time = GST_CLOCK_TIME_NONE;
+
+    gst_structure_get_clock_time (structure, "resume-time", &resume_time);
+
+    GST_VOSK_LOCK(vosk);
+    gst_vosk_set_suspended (vosk, TRUE, resume_time);
+    GST_VOSK_UNLOCK(vosk);
+  }
+  else if (gst_event_has_name (event, GST_VOSK_RESUME_EVENT)) {
+    GST_VOSK_LOCK(vosk);
+    gst_vosk_set_suspended (vosk, FALSE, GST_CLOCK_TIME_NONE);
+    GST_VOSK_UNLOCK(vosk);
+  }
+  else if (gst_event_has_name (event, GST_VOSK_TRANSCRIBE_EVENT)) {
+    const GstStructure *structure = gst_event_get_structure (event);
+    GstClockTime start = GST_CLOCK_TIME_NONE;
+    GstClockTime stop = GST_CLOCK_TIME_NONE;
+
+    gst_structure_get_clock_time (structure, "start", &start);
+    gst_structure_get_clock_time (structure, "stop", &stop);
+    gst_vosk_transcribe (vosk, start, stop);
+  }
+}
+
+/*
+ * Returns the key of the model pool for a language code: the code itself or
+ * its primary subtag ("en" for "en-US"), otherwise speech-model.
+ * MUST be called with lock held
+ */
+static gchar *
+gst_vosk_model_pool_key (GstVosk *vosk,
+                         const gchar *language)
+{
+  gchar *key;
+
+  if (g_hash_table_contains (vosk->model_pool, language) ||
+      !g_strcmp0 (vosk->language, language))
+    return g_strdup (language);
+
+  key = g_strdup (language);
+  key[strcspn (key, "-_")] = '\0';
+  if (g_hash_table_contains (vosk->model_pool, key) ||
+      !g_strcmp0 (vosk->language, key))
+    return key;
+
+  g_free (key);
+  return g_strdup (GST_VOSK_DEFAULT_LANGUAGE);
+}
+
+/*
+ * Makes the core of the model of a language the current one. The current
+ * utterance is ended and the core goes back to the pool with its recognizer.
+ * MUST be called with lock held
+ */
+static void
+gst_vosk_switch_language (GstVosk *vosk,
+                          const gchar *language)
+{
+  GstVoskCoreStats stats;
+  GstVoskCore *core;
+  gchar *pool_key;
+  gchar *key;
+
+  if (!vosk->model_pool || !vosk->core)
+    return;
+
+  key = gst_vosk_model_pool_key (vosk, language);
+  if (!g_strcmp0 (key, vosk->language)) {
+    g_free (key);
+    return;
+  }
+
+  if (!g_hash_table_steal_extended (vosk->model_pool,
+                                    key,
+                                    (gpointer *) &pool_key,
+                                    (gpointer *) &core)) {
+    g_free (key);
+    return;
+  }
+  g_free (pool_key);
+
+  GST_INFO_OBJECT (vosk, "language %s: switching from model \"%s\" to \"%s\".",
+                   language, vosk->language, key);
+
+  gst_vosk_final_result_msg (vosk);
+  gst_vosk_core_flush (vosk->core);
+  vosk->cpu_time = gst_vosk_stream_cpu_time (vosk);
+  g_hash_table_replace (vosk->model_pool, vosk->language, vosk->core);
+
+  vosk->core = core;
+  vosk->language = key;
+
+  /* Parked cores keep counting from where they were */
+  gst_vosk_core_get_stats (core, &stats);
+  vosk->core_cpu_time = stats.cpu_time;
+
+  gst_vosk_configure_core (vosk);
+  if (!gst_vosk_core_is_started (vosk->core) && vosk->rate > 0.0)
+    gst_vosk_core_start (vosk->core, vosk->rate);
+}
+
+/*
+ * A batch recognizer cannot be told that an utterance ended: up to a second
+ * of silence does it. The rest of the gap is not decoded, the batch stream
+ * only shifts the word times of the results that follow.
+ * MUST be called with lock held
+ */
+static void
+gst_vosk_batch_gap (GstVosk *vosk,
+                    GstClockTime duration)
+{
+  static const gint16 silence[1600] = { 0, };
+  guint64 samples;
+
+  samples = gst_util_uint64_scale (MIN (duration, BATCH_GAP_SILENCE),
+                                   (guint64) vosk->rate,
+                                   GST_SECOND);
+  vosk->batch_samples += samples;
+
+  gst_vosk_batcher_stream_skip (vosk->batch_stream,
+                                duration - gst_vosk_samples_to_time (vosk, samples));
+
+  while (samples > 0) {
+    gsize chunk = MIN (samples, G_N_ELEMENTS (silence));
+
+    gst_vosk_batcher_stream_push (vosk->batch_stream,
+                                  (const guint8 *) silence,
+                                  chunk * sizeof (gint16));
+    samples -= chunk;
+  }
+}
+
+/*
+ * Missing audio is not decoded, the recognizer only accounts for it (and ends
+ * the utterance if it is long).
+ * MUST be called with lock held
+ */
+static void
+gst_vosk_gap (GstVosk *vosk,
+              GstClockTime duration)
+{
+  if (vosk->suspended || vosk->history)
+    return;
 
-    contents = gst_structure_new_empty ("vosk");
+  if (vosk->batch_stream) {
+    GST_LOG_OBJECT (vosk, "gap of %" GST_TIME_FORMAT " in batch stream",
+                    GST_TIME_ARGS (duration));
+    gst_vosk_batch_gap (vosk, duration);
+    return;
+  }
 
-    g_value_init (&value, G_TYPE_STRING);
-    g_value_set_string (&value, text_results);
+  if (!GST_VOSK_HAS_RECOGNIZER(vosk))
+    return;
 
-    gst_structure_set_value (contents, "current-result", &value);
-    g_value_unset (&value);
+  GST_LOG_OBJECT (vosk, "gap of %" GST_TIME_FORMAT, GST_TIME_ARGS (duration));
 
-    msg = gst_message_new_element (GST_OBJECT (vosk), contents);
-    gst_element_post_message (GST_ELEMENT (vosk), msg);
-  }
+  if (gst_vosk_core_skip (vosk->core, duration) == GST_VOSK_CORE_TOO_LONG)
+    gst_vosk_final_result_msg (vosk);
 }
 
-inline static void
-gst_vosk_final_result_msg (GstVosk *vosk)
+static void
+gst_vosk_tag (GstVosk *vosk,
+              GstEvent *event)
 {
-  const gchar *json_txt = NULL;
+  GstTagList *tags;
+  gchar *language = NULL;
+
+  gst_event_parse_tag (event, &tags);
+  if (!gst_tag_list_get_string (tags, GST_TAG_LANGUAGE_CODE, &language))
+    return;
 
-  json_txt = gst_vosk_final_result(vosk);
-  if (json_txt)
-    gst_vosk_message_new (vosk, json_txt);
+  /* Tag events are serialized: this is the streaming thread */
+  GST_VOSK_LOCK(vosk);
+  g_free (vosk->stream_language);
+  vosk->stream_language = language;
+  gst_vosk_switch_language (vosk, language);
+  GST_VOSK_UNLOCK(vosk);
 }
 
-static void
-gst_vosk_flush(GstVosk *vosk)
+static gboolean
+gst_vosk_set_caps (GstVosk *vosk,
+                   GstEvent *event)
 {
-  GST_INFO_OBJECT (vosk, "flushing");
+  const GstStructure *structure;
+  GstPad *utterance_pad = NULL;
+  GstVoskDecoder *decoder;
+  GstCaps *caps, *decoded;
+
+  gst_event_parse_caps (event, &caps);
+  structure = gst_caps_get_structure (caps, 0);
+
+  decoder = gst_vosk_decoder_new (structure);
+  if (!decoder && !gst_structure_has_name (structure, "audio/x-raw")) {
+    GST_ELEMENT_ERROR (vosk, STREAM, DECODE,
+                       ("audio could not be decoded"),
+                       ("could not decode %" GST_PTR_FORMAT, caps));
+    gst_event_unref (event);
+    return FALSE;
+  }
 
   GST_VOSK_LOCK(vosk);
+  gst_vosk_decoder_free (vosk->decoder);
+  vosk->decoder = decoder;
 
-  if (vosk->recognizer)
-    vosk_recognizer_reset(vosk->recognizer);
-  else
-    GST_DEBUG_OBJECT (vosk, "no recognizer to flush");
-
+  decoded = gst_vosk_decoded_caps (vosk);
+  if (decoded && vosk->utterance_srcpad)
+    utterance_pad = gst_object_ref (vosk->utterance_srcpad);
   GST_VOSK_UNLOCK(vosk);
+
+  if (!decoded)
+    return gst_pad_event_default (vosk->sinkpad, GST_OBJECT (vosk), event);
+
+  GST_INFO_OBJECT (vosk, "decoding %" GST_PTR_FORMAT, caps);
+
+  /* The encoded buffers go downstream, utterances are exported decoded */
+  if (utterance_pad) {
+    gst_pad_push_event (utterance_pad, gst_event_new_caps (decoded));
+    gst_object_unref (utterance_pad);
+  }
+  gst_caps_unref (decoded);
+
+  return gst_pad_push_event (vosk->srcpad, event);
 }
 
 static gboolean
@@ -778,13 +3039,80 @@ gst_vosk_sink_event (GstPad *pad,
       gst_vosk_flush(vosk);
       break;
 
+    case GST_EVENT_FLUSH_STOP:
+      GST_VOSK_LOCK(vosk);
+      gst_vosk_decoder_reset (vosk->decoder);
+      GST_VOSK_UNLOCK(vosk);
+      break;
+
+    case GST_EVENT_CAPS:
+      return gst_vosk_set_caps (vosk, event);
+
+    case GST_EVENT_TAG:
+      gst_vosk_tag (vosk, event);
+      break;
+
+    case GST_EVENT_GAP: {
+      GstClockTime timestamp, duration;
+
+      gst_event_parse_gap (event, &timestamp, &duration);
+
+      GST_VOSK_LOCK(vosk);
+      if (vosk->trick_mode) {
+        if (GST_CLOCK_TIME_IS_VALID (timestamp) && GST_CLOCK_TIME_IS_VALID (duration))
+          gst_vosk_trick_results_play (vosk, timestamp, timestamp + duration);
+      }
+      else if (GST_CLOCK_TIME_IS_VALID (duration))
+        gst_vosk_gap (vosk, duration);
+      if (GST_CLOCK_TIME_IS_VALID (timestamp) && GST_CLOCK_TIME_IS_VALID (duration))
+        vosk->next_pts = timestamp + duration;
+      GST_VOSK_UNLOCK(vosk);
+      break;
+    }
+
+    case GST_EVENT_SEGMENT: {
+      const GstSegment *segment;
+
+      gst_event_parse_segment (event, &segment);
+
+      GST_VOSK_LOCK(vosk);
+      vosk->next_pts = GST_CLOCK_TIME_NONE;
+      vosk->segment_rate = segment->rate;
+      vosk->segment_applied_rate = segment->applied_rate;
+      vosk->segment_flags = segment->flags;
+      vosk->rate_multiplier = 1.0;
+      gst_vosk_update_trick_mode (vosk);
+      GST_VOSK_UNLOCK(vosk);
+      break;
+    }
+
+    case GST_EVENT_INSTANT_RATE_CHANGE: {
+      GstSegmentFlags flags;
+      gdouble multiplier;
+
+      gst_event_parse_instant_rate_change (event, &multiplier, &flags);
+
+      GST_VOSK_LOCK(vosk);
+      vosk->rate_multiplier = multiplier;
+      gst_vosk_update_trick_mode (vosk);
+      GST_VOSK_UNLOCK(vosk);
+      break;
+    }
+
+    case GST_EVENT_CUSTOM_DOWNSTREAM:
+      gst_vosk_custom_event (vosk, event);
+      break;
+
     case GST_EVENT_EOS:
       /* Cancel any ongoing model loading */
       gst_vosk_cancel_model_loading(vosk);
 
       /* Wait for the stream to complete */
       GST_PAD_STREAM_LOCK(vosk->sinkpad);
-      gst_vosk_final_result_msg(vosk);
+      if (vosk->batch_stream)
+        gst_vosk_batcher_stream_finish (vosk->batch_stream);
+      else
+        gst_vosk_final_result_msg(vosk);
       GST_PAD_STREAM_UNLOCK(vosk->sinkpad);
 
       GST_DEBUG_OBJECT (vosk, "EOS stop event");
@@ -794,6 +3122,14 @@ gst_vosk_sink_event (GstPad *pad,
       break;
   }
 
+  /* Utterances that just ended go before the event (EOS, segment...) */
+  if (GST_EVENT_IS_SERIALIZED (event)) {
+    gst_vosk_results_deliver (vosk);
+    gst_vosk_utterance_push (vosk);
+  }
+
+  gst_vosk_caption_event (vosk, event);
+
   return gst_pad_event_default (pad, parent, event);
 }
 
@@ -804,34 +3140,7 @@ gst_vosk_sink_event (GstPad *pad,
 inline static void
 gst_vosk_result_msg (GstVosk *vosk)
 {
-  const gchar *json_txt;
-
-  json_txt=gst_vosk_result(vosk);
-  if (json_txt)
-    gst_vosk_message_new (vosk, json_txt);
-}
-
-static void
-gst_vosk_partial_result (GstVosk *vosk)
-{
-  const char *json_txt;
-
-  /* NOTE: surprisingly this function can return "text" results. Mute them if
-   * empty. */
-  json_txt = vosk_recognizer_partial_result (vosk->recognizer);
-  if (!json_txt ||
-      !strcmp(json_txt, VOSK_EMPTY_PARTIAL_RESULT) ||
-      !strcmp(json_txt, VOSK_EMPTY_TEXT_RESULT_ALT))
-    return;
-
-  /* To avoid posting message unnecessarily, make sure there is a change. */
-  if (g_strcmp0 (json_txt, vosk->prev_partial) == 0)
-      return;
-
-  g_free (vosk->prev_partial);
-  vosk->prev_partial = g_strdup (json_txt);
-
-  gst_vosk_message_new (vosk, json_txt);
+  gst_vosk_result_post (vosk, gst_vosk_core_result (vosk->core));
 }
 
 static void
@@ -839,21 +3148,39 @@ gst_vosk_handle_buffer(GstVosk *vosk, GstBuffer *buf)
 {
   GstClockTimeDiff diff_time;
   GstClockTime current_time;
+  GstVoskCoreStatus result;
   GstMapInfo info;
-  int result;
+  gsize size;
 
   gst_buffer_map(buf, &info, GST_MAP_READ);
-  if (G_UNLIKELY(info.size == 0))
+  size = info.size;
+  if (G_UNLIKELY(size == 0)) {
+    gst_buffer_unmap (buf, &info);
     return;
+  }
 
-  result = vosk_recognizer_accept_waveform (vosk->recognizer,
-                                            (gchar*) info.data,
-                                            info.size);
-  if (result == -1) {
+  result = gst_vosk_core_accept_waveform (vosk->core, info.data, info.size);
+  gst_buffer_unmap (buf, &info);
+
+  if (result == GST_VOSK_CORE_ERROR) {
     GST_ERROR_OBJECT (vosk, "accept_waveform error");
     return;
   }
 
+  /* In continuous streams (music, noise), the endpointer may never fire. */
+  if (result == GST_VOSK_CORE_TOO_LONG) {
+    gst_vosk_final_result_msg (vosk);
+    vosk->last_processed_time=GST_BUFFER_PTS(buf);
+    vosk->last_partial=GST_BUFFER_PTS (buf);
+    return;
+  }
+
+  /* Not delayed when late: the point is to answer early */
+  if (result == GST_VOSK_CORE_SILENCE)
+    gst_vosk_result_post (vosk, gst_vosk_core_tentative_result (vosk->core));
+  else if (result == GST_VOSK_CORE_RESUMED)
+    gst_vosk_result_post (vosk, gst_vosk_core_retracted_result (vosk->core));
+
   current_time = gst_element_get_current_running_time(GST_ELEMENT(vosk));
   diff_time = GST_CLOCK_DIFF(GST_BUFFER_PTS(buf), current_time);
 
@@ -862,7 +3189,7 @@ gst_vosk_handle_buffer(GstVosk *vosk, GstBuffer *buf)
                   GST_TIME_ARGS(GST_BUFFER_PTS(buf)),
                   GST_TIME_ARGS(current_time),
                   diff_time,
-                  info.size);
+                  size);
 
   /* We want to catch up when we are behind (500 milliseconds) but also try
    * to get a result now and again (every half second) at least.
@@ -885,42 +3212,274 @@ gst_vosk_handle_buffer(GstVosk *vosk, GstBuffer *buf)
 
   vosk->last_processed_time=GST_BUFFER_PTS(buf);
 
-  if (result == 1) {
+  if (result == GST_VOSK_CORE_ENDPOINT) {
     GST_LOG_OBJECT (vosk, "checking result");
     gst_vosk_result_msg(vosk);
     vosk->last_partial=GST_BUFFER_PTS (buf);
     return;
   }
 
-  if (vosk->partial_time_interval < 0)
+  if (vosk->partial_time_interval < 0 || !gst_vosk_core_is_awake (vosk->core))
     return;
 
   diff_time=GST_CLOCK_DIFF(vosk->last_partial, GST_BUFFER_PTS (buf));
   if (vosk->partial_time_interval < diff_time) {
     GST_LOG_OBJECT (vosk, "checking partial result");
-    gst_vosk_partial_result(vosk);
+    gst_vosk_result_post (vosk, gst_vosk_core_partial_result (vosk->core));
     vosk->last_partial=GST_BUFFER_PTS(buf);
   }
 }
 
+/*
+ * MUST be called with lock held
+ */
+static GstClockTime
+gst_vosk_buffer_duration (GstVosk *vosk,
+                          GstBuffer *buf)
+{
+  if (GST_BUFFER_DURATION_IS_VALID (buf))
+    return GST_BUFFER_DURATION (buf);
+
+  if (vosk->decoder)
+    return gst_vosk_decoder_get_duration (vosk->decoder, buf);
+
+  return gst_vosk_samples_to_time (vosk, gst_buffer_get_size (buf) / sizeof (gint16));
+}
+
+/*
+ * Queues the results the other stream handed over. Their word times are
+ * already on the timeline of this stream; their utterances get ids of the
+ * core, which is idle meanwhile.
+ * MUST be called with lock held
+ */
+static void
+gst_vosk_shared_results (GstVosk *vosk)
+{
+  GstStructure *shared;
+
+  while ((shared = gst_vosk_duplicate_pop (vosk->duplicate))) {
+    guint64 leader_id = 0;
+
+    gst_structure_get_uint64 (shared, "utterance-id", &leader_id);
+    if (!vosk->has_shared_utterance || leader_id > vosk->shared_leader_id) {
+      vosk->has_shared_utterance = TRUE;
+      vosk->shared_leader_id = leader_id;
+      vosk->shared_utterance_id = gst_vosk_core_take_utterance_id (vosk->core);
+    }
+    else if (leader_id < vosk->shared_leader_id) {
+      /* A late revision of an utterance that is over and was renumbered */
+      GST_DEBUG_OBJECT (vosk, "dropping result of a past shared utterance");
+      gst_structure_free (shared);
+      continue;
+    }
+
+    gst_structure_set (shared, "utterance-id", G_TYPE_UINT64, vosk->shared_utterance_id, NULL);
+    gst_vosk_encode_results (vosk, shared);
+    g_queue_push_tail (&vosk->results_pending, shared);
+  }
+}
+
+/*
+ * Returns TRUE while the stream duplicates another one. The current utterance
+ * ends when it starts: the other stream gives the next results.
+ * MUST be called with lock held
+ */
+static gboolean
+gst_vosk_is_duplicated (GstVosk *vosk,
+                        GstBuffer *pcm)
+{
+  GstVoskCoreStats stats;
+  gboolean duplicated;
+  GstMapInfo info;
+
+  if (!vosk->duplicate)
+    return FALSE;
+
+  gst_vosk_core_get_stats (vosk->core, &stats);
+
+  gst_buffer_map (pcm, &info, GST_MAP_READ);
+  duplicated = gst_vosk_duplicate_push (vosk->duplicate,
+                                        (const gint16 *) info.data,
+                                        info.size / sizeof (gint16),
+                                        vosk->rate,
+                                        stats.position + gst_vosk_buffer_duration (vosk, pcm));
+  gst_buffer_unmap (pcm, &info);
+
+  /* Not decoded, it is on the timeline of the stream nevertheless */
+  if (duplicated && vosk->duplicated) {
+    gst_vosk_core_skip (vosk->core, gst_vosk_buffer_duration (vosk, pcm));
+    return TRUE;
+  }
+
+  if (duplicated == vosk->duplicated)
+    return duplicated;
+
+  GST_INFO_OBJECT (vosk, "%s", duplicated ? "input duplicates another stream, not decoding it" :
+                                            "input differs from the stream it duplicated, decoding it");
+  vosk->duplicated = duplicated;
+
+  if (duplicated) {
+    gst_vosk_final_result_msg (vosk);
+    gst_vosk_core_flush (vosk->core);
+    g_queue_clear_full (&vosk->utterance_buffers, (GDestroyNotify) gst_buffer_unref);
+    gst_vosk_core_skip (vosk->core, gst_vosk_buffer_duration (vosk, pcm));
+  }
+  else {
+    /* The end of the shared utterance, before the core starts one */
+    gst_vosk_shared_results (vosk);
+    vosk->has_shared_utterance = FALSE;
+  }
+
+  return duplicated;
+}
+
+/*
+ * Returns the audio of buf the way the recognizer wants it.
+ * MUST be called with lock held
+ */
+static GstBuffer *
+gst_vosk_decode (GstVosk *vosk,
+                 GstBuffer *buf)
+{
+  if (!vosk->decoder)
+    return gst_buffer_ref (buf);
+
+  /* The previous packet is not the one before this one */
+  if (GST_BUFFER_IS_DISCONT (buf))
+    gst_vosk_decoder_reset (vosk->decoder);
+
+  return gst_vosk_decoder_decode (vosk->decoder, buf);
+}
+
+/*
+ * Returns TRUE the first time the stream goes over cpu-warning-ratio.
+ * MUST be called with lock held
+ */
+static gboolean
+gst_vosk_cpu_exceeded (GstVosk *vosk,
+                       guint64 *cpu_time)
+{
+  if (vosk->cpu_warned ||
+      vosk->cpu_warning_ratio <= 0.0 ||
+      vosk->decoded_duration < CPU_WARNING_MIN_DURATION)
+    return FALSE;
+
+  *cpu_time = gst_vosk_stream_cpu_time (vosk);
+  if (*cpu_time <= vosk->cpu_warning_ratio * vosk->decoded_duration)
+    return FALSE;
+
+  vosk->cpu_warned = TRUE;
+  return TRUE;
+}
+
 static GstFlowReturn
 gst_vosk_chain (GstPad *sinkpad,
                 GstObject *parent,
                 GstBuffer *buf)
 {
   GstVosk *vosk = GST_VOSK (parent);
+  GstBufferList *captions = NULL;
+  GstClockTime decoded_duration = 0;
+  gboolean cpu_exceeded = FALSE;
+  GstBuffer *pcm = NULL;
+  guint64 cpu_time = 0;
+  gboolean gap;
 
   GST_LOG_OBJECT (vosk, "data received");
 
+  /* Upstream filled missing audio (with silence most of the time) */
+  gap = GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_GAP);
+
   GST_VOSK_LOCK(vosk);
 
-  if (G_LIKELY(vosk->recognizer)) {
+  /* Packets were lost: time moved forward without audio */
+  if (!vosk->trick_mode &&
+      GST_BUFFER_IS_DISCONT (buf) &&
+      GST_BUFFER_PTS_IS_VALID (buf) &&
+      GST_CLOCK_TIME_IS_VALID (vosk->next_pts) &&
+      GST_BUFFER_PTS (buf) > vosk->next_pts)
+    gst_vosk_gap (vosk, GST_BUFFER_PTS (buf) - vosk->next_pts);
+
+  if (GST_BUFFER_PTS_IS_VALID (buf))
+    vosk->next_pts = GST_BUFFER_PTS (buf) + gst_vosk_buffer_duration (vosk, buf);
+
+  if (vosk->suspended &&
+      GST_CLOCK_TIME_IS_VALID (vosk->resume_time) &&
+      GST_BUFFER_PTS_IS_VALID (buf) &&
+      GST_BUFFER_PTS (buf) >= vosk->resume_time)
+    gst_vosk_set_suspended (vosk, FALSE, GST_CLOCK_TIME_NONE);
+
+  if (vosk->suspended) {
+    /* Nothing is decoded, just account for it */
+    vosk->skipped_duration += gst_vosk_buffer_duration (vosk, buf);
+  }
+  else if (vosk->trick_mode) {
+    vosk->skipped_duration += gst_vosk_buffer_duration (vosk, buf);
+    if (GST_BUFFER_PTS_IS_VALID (buf))
+      gst_vosk_trick_results_play (vosk,
+                                   GST_BUFFER_PTS (buf),
+                                   GST_BUFFER_PTS (buf) + gst_vosk_buffer_duration (vosk, buf));
+  }
+  else if (gap && !vosk->history && (GST_VOSK_HAS_RECOGNIZER(vosk) || vosk->batch_stream))
+    gst_vosk_gap (vosk, gst_vosk_buffer_duration (vosk, buf));
+  else if (!(pcm = gst_vosk_decode (vosk, buf)))
+    GST_WARNING_OBJECT (vosk, "could not decode buffer, it is not recognized");
+  else if (vosk->history) {
+    GstMapInfo info;
+
+    /* Decoded later, if ever */
+    gst_buffer_map (pcm, &info, GST_MAP_READ);
+    gst_vosk_history_push (vosk->history,
+                           GST_BUFFER_PTS (pcm),
+                           (const gint16 *) info.data,
+                           info.size / sizeof (gint16));
+    gst_buffer_unmap (pcm, &info);
+  }
+  else if (GST_VOSK_HAS_RECOGNIZER(vosk) && gst_vosk_is_duplicated (vosk, pcm)) {
+    /* The other stream decodes it */
+  }
+  else if (G_LIKELY(GST_VOSK_HAS_RECOGNIZER(vosk))) {
     if (vosk->last_processed_time == GST_CLOCK_TIME_NONE) {
       vosk->last_processed_time=GST_BUFFER_PTS(buf);
       GST_INFO_OBJECT (vosk, "started with no PREROLL state, first buffer received");
     }
 
-    gst_vosk_handle_buffer(vosk, buf);
+    if (!GST_CLOCK_TIME_IS_VALID (vosk->utterance_pts))
+      vosk->utterance_pts = GST_BUFFER_PTS (pcm);
+
+    /* Its result may come with this buffer */
+    if (vosk->utterance_srcpad)
+      g_queue_push_tail (&vosk->utterance_buffers, gst_buffer_ref (pcm));
+
+    gst_vosk_handle_buffer(vosk, pcm);
+
+    vosk->decoded_duration += gst_vosk_buffer_duration (vosk, pcm);
+    cpu_exceeded = gst_vosk_cpu_exceeded (vosk, &cpu_time);
+    decoded_duration = vosk->decoded_duration;
+
+    /* An utterance ended without result (noise, empty or non-final
+     * result): the next one starts with the next buffer and its audio is
+     * not exported */
+    {
+      GstVoskCoreStats stats;
+
+      gst_vosk_core_get_stats (vosk->core, &stats);
+      if (!stats.utterance_duration) {
+        vosk->utterance_pts = GST_CLOCK_TIME_NONE;
+        if (vosk->utterance_srcpad)
+          g_queue_clear_full (&vosk->utterance_buffers, (GDestroyNotify) gst_buffer_unref);
+      }
+    }
+  }
+  else if (vosk->batch_stream) {
+    GstMapInfo info;
+
+    /* Results come back from the batching thread */
+    gst_buffer_map (pcm, &info, GST_MAP_READ);
+    gst_vosk_batcher_stream_push (vosk->batch_stream, info.data, info.size);
+    gst_buffer_unmap (pcm, &info);
+
+    vosk->batch_samples += info.size / sizeof (gint16);
   }
   else {
     /* While transitioning from READY to PAUSED, there might be at least one
@@ -935,19 +3494,335 @@ gst_vosk_chain (GstPad *sinkpad,
       GST_WARNING_OBJECT (vosk, "dropping buffer, streaming has started and recognizer is not ready yet");
   }
 
+  if (vosk->duplicate && vosk->duplicated)
+    gst_vosk_shared_results (vosk);
+
+  if (vosk->caption && GST_BUFFER_PTS_IS_VALID (buf)) {
+    GstClockTime end = GST_BUFFER_PTS (buf) + gst_vosk_buffer_duration (vosk, buf);
+
+    if (!GST_CLOCK_TIME_IS_VALID (vosk->caption_start)) {
+      vosk->caption_start = GST_BUFFER_PTS (buf);
+      vosk->caption_frames = 0;
+    }
+
+    captions = gst_vosk_caption_frames (vosk, end);
+  }
+
   GST_VOSK_UNLOCK(vosk);
 
+  if (pcm)
+    gst_buffer_unref (pcm);
+
+  if (cpu_exceeded)
+    GST_ELEMENT_WARNING_WITH_DETAILS (vosk,
+                                      RESOURCE,
+                                      BUSY,
+                                      ("recognition is using too much CPU"),
+                                      ("%.2f s of CPU for %.2f s of audio (cpu-warning-ratio is %.2f)",
+                                       (gdouble) cpu_time / GST_SECOND,
+                                       (gdouble) decoded_duration / GST_SECOND,
+                                       vosk->cpu_warning_ratio),
+                                      ("cpu-time", G_TYPE_UINT64, cpu_time,
+                                       "decoded-duration", G_TYPE_UINT64, decoded_duration,
+                                       NULL));
+
+  gst_vosk_results_deliver (vosk);
+  gst_vosk_utterance_push (vosk);
+  gst_vosk_caption_push (vosk, captions);
+
   GST_LOG_OBJECT (vosk, "chaining data");
   gst_buffer_ref(buf);
   return gst_pad_push (vosk->srcpad, buf);
 }
 
+/*
+ * Pull mode: a reader thread pulls large blocks ahead of decoding, so that
+ * I/O and recognition overlap, and the pad task decodes them at its own
+ * pace. There are no events from upstream: the task sends them itself.
+ * Blocks hold whole samples: reads are rounded down to them and the byte a
+ * short read cuts in two is carried over to the next block.
+ */
+static gpointer
+gst_vosk_pull_reader (gpointer user_data)
+{
+  GstVosk *vosk = GST_VOSK (user_data);
+  GstBuffer *leftover = NULL;
+  guint64 read_offset = 0;
+  guint64 offset = 0;
+  guint read_size;
+
+  read_size = MAX (vosk->pull_read_size - vosk->pull_read_size % sizeof (gint16),
+                   sizeof (gint16));
+
+  for (;;) {
+    GstBuffer *block = NULL;
+    GstFlowReturn ret;
+    gboolean stop;
+    gsize size = 0;
+
+    g_mutex_lock (&vosk->PullMut);
+    while (!vosk->pull_stop &&
+           g_queue_get_length (&vosk->pull_blocks) >= PULL_READ_AHEAD)
+      g_cond_wait (&vosk->PullCond, &vosk->PullMut);
+    stop = vosk->pull_stop;
+    g_mutex_unlock (&vosk->PullMut);
+
+    if (stop)
+      break;
+
+    ret = gst_pad_pull_range (vosk->sinkpad, read_offset, read_size, &block);
+
+    if (ret == GST_FLOW_OK) {
+      gsize tail;
+
+      read_offset += gst_buffer_get_size (block);
+      if (leftover) {
+        block = gst_buffer_append (leftover, block);
+        leftover = NULL;
+      }
+
+      size = gst_buffer_get_size (block);
+      tail = size % sizeof (gint16);
+      if (tail) {
+        leftover = gst_buffer_copy_region (block, GST_BUFFER_COPY_MEMORY, size - tail, tail);
+        size -= tail;
+        block = gst_buffer_make_writable (block);
+        gst_buffer_set_size (block, size);
+      }
+    }
+
+    /* Half a sample so far */
+    if (ret == GST_FLOW_OK && !size) {
+      gst_buffer_unref (block);
+      continue;
+    }
+
+    g_mutex_lock (&vosk->PullMut);
+    if (ret == GST_FLOW_OK) {
+      GST_BUFFER_OFFSET (block) = offset;
+      offset += size;
+      g_queue_push_tail (&vosk->pull_blocks, block);
+    }
+    else
+      vosk->pull_result = ret;
+
+    g_cond_broadcast (&vosk->PullCond);
+    g_mutex_unlock (&vosk->PullMut);
+
+    if (ret != GST_FLOW_OK) {
+      GST_DEBUG_OBJECT (vosk, "reader stopped (%s).", gst_flow_get_name (ret));
+      break;
+    }
+  }
+
+  if (leftover) {
+    GST_WARNING_OBJECT (vosk, "stream ends with half a sample.");
+    gst_buffer_unref (leftover);
+  }
+
+  return NULL;
+}
+
+static void
+gst_vosk_pull_send_event (GstVosk *vosk,
+                          GstEvent *event)
+{
+  /* Sticky events are read from the sink pad (caps for the rate...) */
+  if (GST_EVENT_IS_STICKY (event))
+    gst_pad_store_sticky_event (vosk->sinkpad, event);
+
+  gst_vosk_sink_event (vosk->sinkpad, GST_OBJECT (vosk), event);
+}
+
+/*
+ * Caps must be fixed by upstream (a parser or a capsfilter), there is nothing
+ * to guess them from.
+ */
+static gboolean
+gst_vosk_pull_start (GstVosk *vosk)
+{
+  GstCaps *template_caps, *caps;
+  GstSegment segment;
+  gchar *stream_id;
+
+  template_caps = gst_pad_get_pad_template_caps (vosk->sinkpad);
+  caps = gst_pad_peer_query_caps (vosk->sinkpad, template_caps);
+  gst_caps_unref (template_caps);
+
+  if (!caps || gst_caps_is_empty (caps) || !gst_caps_is_fixed (caps)) {
+    GST_ELEMENT_ERROR (vosk, CORE, NEGOTIATION,
+                       ("no fixed audio format in pull mode"),
+                       ("upstream caps: %" GST_PTR_FORMAT, caps));
+    if (caps)
+      gst_caps_unref (caps);
+    return FALSE;
+  }
+
+  /* Blocks are cut at random: that is only possible for raw audio */
+  if (!gst_structure_has_name (gst_caps_get_structure (caps, 0), "audio/x-raw")) {
+    GST_ELEMENT_ERROR (vosk, CORE, NEGOTIATION,
+                       ("encoded audio cannot be pulled"),
+                       ("upstream caps: %" GST_PTR_FORMAT ", unset pull-read-size", caps));
+    gst_caps_unref (caps);
+    return FALSE;
+  }
+
+  stream_id = gst_pad_create_stream_id (vosk->sinkpad, GST_ELEMENT (vosk), NULL);
+  gst_vosk_pull_send_event (vosk, gst_event_new_stream_start (stream_id));
+  g_free (stream_id);
+
+  gst_vosk_pull_send_event (vosk, gst_event_new_caps (caps));
+  gst_caps_unref (caps);
+
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  gst_vosk_pull_send_event (vosk, gst_event_new_segment (&segment));
+
+  GST_VOSK_LOCK(vosk);
+
+  /* The model may have been loaded before the caps were known */
+  if ((vosk->core || vosk->batch_model) &&
+      !GST_VOSK_HAS_RECOGNIZER(vosk) && !vosk->batch_stream)
+    gst_vosk_recognizer_new (vosk);
+
+  GST_VOSK_UNLOCK(vosk);
+  return TRUE;
+}
+
+static void
+gst_vosk_pull_loop (gpointer user_data)
+{
+  GstVosk *vosk = GST_VOSK (user_data);
+  GstBuffer *block = NULL;
+  GstFlowReturn ret;
+  gboolean ready;
+
+  if (!vosk->pull_started) {
+    if (!gst_vosk_pull_start (vosk))
+      goto pause;
+
+    vosk->pull_started = TRUE;
+  }
+
+  /* Nothing would be decoded before the model is there */
+  GST_VOSK_LOCK(vosk);
+  while (!vosk->pull_stop && !GST_VOSK_HAS_RECOGNIZER(vosk) && !vosk->batch_stream)
+    g_cond_wait (&vosk->ReadyCond, &vosk->RecMut);
+  ready = !vosk->pull_stop;
+  GST_VOSK_UNLOCK(vosk);
+
+  if (!ready)
+    goto pause;
+
+  g_mutex_lock (&vosk->PullMut);
+  while (!vosk->pull_stop &&
+         g_queue_is_empty (&vosk->pull_blocks) &&
+         vosk->pull_result == GST_FLOW_OK)
+    g_cond_wait (&vosk->PullCond, &vosk->PullMut);
+
+  block = g_queue_pop_head (&vosk->pull_blocks);
+  ret = vosk->pull_stop ? GST_FLOW_FLUSHING : vosk->pull_result;
+  g_cond_broadcast (&vosk->PullCond);
+  g_mutex_unlock (&vosk->PullMut);
+
+  if (!block)
+    goto stop;
+
+  GST_BUFFER_PTS (block) = gst_vosk_samples_to_time (vosk, GST_BUFFER_OFFSET (block) / sizeof (gint16));
+  GST_BUFFER_DURATION (block) = gst_vosk_samples_to_time (vosk, gst_buffer_get_size (block) / sizeof (gint16));
+
+  ret = gst_vosk_chain (vosk->sinkpad, GST_OBJECT (vosk), block);
+  gst_buffer_unref (block);
+
+  if (ret == GST_FLOW_OK)
+    return;
+
+stop:
+  GST_INFO_OBJECT (vosk, "pausing task (%s).", gst_flow_get_name (ret));
+
+  if (ret == GST_FLOW_EOS)
+    gst_vosk_pull_send_event (vosk, gst_event_new_eos ());
+  else if (ret == GST_FLOW_NOT_LINKED || ret < GST_FLOW_EOS) {
+    GST_ELEMENT_FLOW_ERROR (vosk, ret);
+    gst_vosk_pull_send_event (vosk, gst_event_new_eos ());
+  }
+
+pause:
+  gst_pad_pause_task (vosk->sinkpad);
+}
+
+static gboolean
+gst_vosk_sink_activate (GstPad *pad,
+                        GstObject *parent)
+{
+  GstVosk *vosk = GST_VOSK (parent);
+  gboolean pull_mode = FALSE;
+  GstQuery *query;
+
+  if (vosk->pull_read_size) {
+    query = gst_query_new_scheduling ();
+    if (gst_pad_peer_query (pad, query))
+      pull_mode = gst_query_has_scheduling_mode_with_flags (query,
+                                                            GST_PAD_MODE_PULL,
+                                                            GST_SCHEDULING_FLAG_SEEKABLE);
+    gst_query_unref (query);
+  }
+
+  if (pull_mode) {
+    GST_INFO_OBJECT (vosk, "activating in pull mode (%u bytes reads).", vosk->pull_read_size);
+    return gst_pad_activate_mode (pad, GST_PAD_MODE_PULL, TRUE);
+  }
+
+  return gst_pad_activate_mode (pad, GST_PAD_MODE_PUSH, TRUE);
+}
+
+static gboolean
+gst_vosk_sink_activate_mode (GstPad *pad,
+                             GstObject *parent,
+                             GstPadMode mode,
+                             gboolean active)
+{
+  GstVosk *vosk = GST_VOSK (parent);
+  GstBuffer *block;
+
+  if (mode != GST_PAD_MODE_PULL)
+    return TRUE;
+
+  if (active) {
+    vosk->pull_stop = FALSE;
+    vosk->pull_started = FALSE;
+    vosk->pull_result = GST_FLOW_OK;
+    vosk->pull_reader = g_thread_new ("vosk-reader", gst_vosk_pull_reader, vosk);
+    return gst_pad_start_task (pad, gst_vosk_pull_loop, vosk, NULL);
+  }
+
+  /* The pad is flushing already: pulls return at once */
+  GST_VOSK_LOCK(vosk);
+  g_mutex_lock (&vosk->PullMut);
+  vosk->pull_stop = TRUE;
+  g_cond_broadcast (&vosk->PullCond);
+  g_mutex_unlock (&vosk->PullMut);
+  g_cond_broadcast (&vosk->ReadyCond);
+  GST_VOSK_UNLOCK(vosk);
+
+  if (vosk->pull_reader) {
+    g_thread_join (vosk->pull_reader);
+    vosk->pull_reader = NULL;
+  }
+
+  while ((block = g_queue_pop_head (&vosk->pull_blocks)))
+    gst_buffer_unref (block);
+
+  return gst_pad_stop_task (pad);
+}
+
 gboolean
 gst_vosk_plugin_init (GstPlugin *vosk_plugin)
 {
   GST_DEBUG_CATEGORY_INIT (gst_vosk_debug, "vosk",
       0, "Performs speech recognition using libvosk");
 
+  gst_meta_register_custom (GST_VOSK_RESULT_META, NULL, NULL, NULL, NULL);
+
   return gst_element_register (vosk_plugin, "vosk", GST_RANK_NONE, GST_TYPE_VOSK);
 }
 
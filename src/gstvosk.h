@@ -23,10 +23,30 @@
 #include <gio/gio.h>
 #include <gst/gst.h>
 
+#include "gstvoskbatcher.h"
+#include "gstvoskcaption.h"
+#include "gstvoskcore.h"
+#include "gstvoskdecoder.h"
+#include "gstvoskduplicate.h"
+#include "gstvoskhistory.h"
+#include "gstvoskresult.h"
 #include "vosk-api.h"
 
 G_BEGIN_DECLS
 
+/*
+ * Name of the custom meta of the buffers pushed on the utterance_src pad. Its
+ * structure holds the final result ("result") and "utterance-id".
+ */
+#define GST_VOSK_RESULT_META "GstVoskResultMeta"
+
+/*
+ * Type of the GstContext sharing a speech model (GstVoskModel, "model"
+ * field). The element adopts the model of such a context when its path is
+ * speech-model, otherwise it loads it and publishes it with that context.
+ */
+#define GST_VOSK_MODEL_CONTEXT "vosk-model"
+
 #define GST_TYPE_VOSK \
   (gst_vosk_get_type())
 #define GST_VOSK(obj) \
@@ -38,6 +58,17 @@ G_BEGIN_DECLS
 #define GST_IS_VOSK_CLASS(klass) \
   (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_VOSK))
 
+/* How results are given in messages and in the results signal */
+typedef enum {
+  GST_VOSK_RESULT_FORMAT_JSON,
+  GST_VOSK_RESULT_FORMAT_CBOR,    /* GBytes, see gstvoskresult.h */
+} GstVoskResultFormat;
+
+#define GST_TYPE_VOSK_RESULT_FORMAT \
+  (gst_vosk_result_format_get_type())
+
+GType gst_vosk_result_format_get_type (void);
+
 typedef struct _GstVosk      GstVosk;
 typedef struct _GstVoskClass GstVoskClass;
 
@@ -49,6 +80,43 @@ struct _GstVosk
   gchar            *model_path;
   gint              alternatives;
   gboolean          use_signals;
+  GstVoskResultFormat result_format;
+
+  gchar            *rescoring_model_path;
+  gdouble           rescoring_threshold;
+
+  GstClockTime      max_utterance_duration;
+  GstClockTime      recycle_interval;
+  GstClockTime      speculative_silence;
+
+  gchar            *wake_phrases;
+  GstClockTime      wake_preroll;
+
+  gchar            *config_file;
+
+  GstStructure     *model_map;
+
+  gboolean          batch;
+  GstClockTime      batch_deadline;
+  guint             batch_size;
+
+  guint             pull_read_size;
+
+  gdouble           cpu_warning_ratio;
+
+  GstClockTime      lazy_history;
+  gboolean          lazy_compress;
+
+  gboolean          deduplicate;
+  GstClockTime      duplicate_tolerance;
+
+  gint              caption_fps_n;
+  gint              caption_fps_d;
+
+  /* Src pads the sink pad forwards events and queries to (caption_src has
+   * caps of its own). Protected by the object lock. */
+  GList            *proxy_pads;
+  guint32           proxy_pads_cookie;
 
   gfloat            rate;
 
@@ -61,10 +129,104 @@ struct _GstVosk
 
   GMutex            RecMut;
 
+  /* Held while results are delivered (never with RecMut held), so that they
+   * reach the application in order */
+  GRecMutex         DeliverMut;
+
+  /* Signalled (with RecMut) when a recognizer is ready */
+  GCond             ReadyCond;
+
+  /* Pull mode: blocks read ahead of decoding by the reader thread. Access
+   * should be done with PullMut held. pull_stop is also set with RecMut. */
+  GMutex            PullMut;
+  GCond             PullCond;
+  GThread          *pull_reader;
+  GQueue            pull_blocks;
+  GstFlowReturn     pull_result;
+  gboolean          pull_stop;
+  gboolean          pull_started;
+  guint64           pull_offset;
+
   /* Access to the following members should be done
    * with GST_VOSK_LOCK held */
-  VoskRecognizer   *recognizer;
-  gchar            *prev_partial;
+  GstVoskCore      *core;
+
+  /* Speech model of core (that of speech-model) */
+  GstVoskModel     *model;
+
+  /* Cores of the models of model-map that are not in use, by language
+   * ("" being speech-model), the language of core and the last language
+   * tagged on the stream */
+  GHashTable       *model_pool;
+  gchar            *language;
+  gchar            *stream_language;
+
+  VoskBatchModel   *batch_model;
+  GstVoskBatchStream *batch_stream;
+  guint64           utterance_id;
+  guint64           batch_samples;
+
+  /* Input buffers of the current utterance and utterances waiting to be
+   * pushed on utterance_src (only when it was requested) */
+  GstPad           *utterance_srcpad;
+  GQueue            utterance_buffers;
+  GQueue            utterance_pending;
+
+  GstPad           *caption_srcpad;
+  GstVoskCaption   *caption;
+  GstClockTime      caption_start;
+  guint64           caption_frames;
+  gboolean          caption_started;
+
+  gboolean          suspended;
+  GstClockTime      resume_time;
+  GstClockTime      skipped_duration;
+
+  /* Playback at another rate than 1.0 (segment rates, instant rate changes)
+   * or in a trick mode: the audio is altered or skipped and is not decoded.
+   * Final results of normal playback with their range (most recent last) are
+   * given again for the ranges played meanwhile when trick_mode_results is
+   * set */
+  gdouble           segment_rate;
+  gdouble           segment_applied_rate;
+  GstSegmentFlags   segment_flags;
+  gdouble           rate_multiplier;
+  gboolean          trick_mode;
+  gboolean          trick_mode_results;
+  GQueue            trick_results;
+  GstClockTime      utterance_pts;
+
+  /* Set when the input is encoded: buffers are decoded for recognition */
+  GstVoskDecoder   *decoder;
+
+  /* Lazy mode: the input is only recorded, ranges of it are decoded on
+   * request by the transcription threads */
+  GstVoskHistory   *history;
+  guint64           transcription_id;
+
+  /* Registered when deduplicate is set. While the stream duplicates another
+   * one, the results of the other one are delivered instead of decoding */
+  GstVoskDuplicate *duplicate;
+  gboolean          duplicated;
+
+  /* Utterance of the other stream whose results are being delivered and the
+   * id they are delivered with (one of the core) */
+  gboolean          has_shared_utterance;
+  guint64           shared_leader_id;
+  guint64           shared_utterance_id;
+
+  /* Where the next buffer should start, to find discontinuities */
+  GstClockTime      next_pts;
+
+  /* CPU time of the stream, the part spent by the current core is the
+   * difference between its total and core_cpu_time */
+  GstClockTime      decoded_duration;
+  guint64           cpu_time;
+  guint64           core_cpu_time;
+  gboolean          cpu_warned;
+
+  /* Results waiting to be delivered */
+  GQueue            results_pending;
 
   GCancellable     *current_operation;
 };
@@ -0,0 +1,492 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <string.h>
+
+#include "gstvoskbatcher.h"
+#include "gstvoskrescorer.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_vosk_debug);
+#define GST_CAT_DEFAULT gst_vosk_debug
+
+struct _GstVoskBatchStream {
+  VoskBatchRecognizer    *recognizer;
+  GstElement             *element;
+  GstVoskBatchResultFunc  func;
+  GstClockTime            deadline;
+  guint                   batch_size;
+  gfloat                  rate;
+  guint64                 samples;    /* pushed so far */
+
+  /* Protected by batcher_mutex */
+  guint                   queued;
+  guint                   waiting;    /* chunks in batcher_queue */
+  gboolean                busy;
+  gboolean                finishing;
+
+  /* Audio skipped (see gst_vosk_batcher_stream_skip ()) before the time of
+   * the last word delivered and the gaps after it, protected by
+   * batcher_mutex */
+  GstClockTime            gap_offset;
+  GArray                 *gaps;
+  gdouble                 last_time;
+};
+
+typedef struct {
+  GstClockTime        position;       /* in the audio pushed */
+  GstClockTime        duration;
+} GstVoskBatchGap;
+
+/* A NULL data means end of stream */
+typedef struct {
+  GstVoskBatchStream *stream;
+  gint64              deadline;
+  gsize               size;
+  guint8              data[];
+} GstVoskBatchChunk;
+
+static GMutex batcher_mutex;
+static GCond batcher_cond;
+static GQueue batcher_queue = G_QUEUE_INIT;
+static GList *batcher_streams = NULL;
+static guint batcher_waiting_streams = 0;
+static GThread *batcher_thread = NULL;
+static VoskBatchModel *batcher_model = NULL;
+static guint batcher_users = 0;
+static gboolean batcher_flush = FALSE;
+
+/* A batching thread stops as soon as it is not the current one anymore */
+#define BATCHER_RUNNING (batcher_thread == g_thread_self ())
+
+/*
+ * MUST be called with batcher_mutex held.
+ * Waits until the batch is full or the oldest chunk is due.
+ */
+static GList *
+gst_vosk_batcher_wait_batch (void)
+{
+  GList *batch, *iter;
+
+  while (BATCHER_RUNNING) {
+    GstVoskBatchChunk *oldest;
+
+    oldest = g_queue_peek_head (&batcher_queue);
+    if (!oldest) {
+      g_cond_wait (&batcher_cond, &batcher_mutex);
+      continue;
+    }
+
+    if (batcher_flush || g_get_monotonic_time () >= oldest->deadline)
+      break;
+
+    g_cond_wait_until (&batcher_cond, &batcher_mutex, oldest->deadline);
+  }
+
+  if (!BATCHER_RUNNING)
+    return NULL;
+
+  batch = batcher_queue.head;
+  g_queue_init (&batcher_queue);
+  batcher_flush = FALSE;
+
+  for (iter = batch; iter; iter = iter->next)
+    ((GstVoskBatchChunk *) iter->data)->stream->waiting = 0;
+  batcher_waiting_streams = 0;
+
+  return batch;
+}
+
+/*
+ * MUST be called with batcher_mutex held.
+ */
+static gint64
+gst_vosk_batcher_time_shift (gdouble time,
+                             gpointer user_data)
+{
+  GstVoskBatchStream *stream = user_data;
+  GstClockTime shift = stream->gap_offset;
+  guint i;
+
+  for (i = 0; i < stream->gaps->len; i++) {
+    GstVoskBatchGap *gap = &g_array_index (stream->gaps, GstVoskBatchGap, i);
+
+    if (gap->position <= time * GST_SECOND)
+      shift += gap->duration;
+  }
+
+  stream->last_time = MAX (stream->last_time, time);
+  return shift;
+}
+
+/*
+ * Results come in the order of the audio: the gaps before the last word
+ * delivered apply to all the words to come.
+ * MUST be called with batcher_mutex held.
+ */
+static gchar *
+gst_vosk_batcher_shift_times (GstVoskBatchStream *stream,
+                              const gchar *json_txt)
+{
+  gchar *shifted;
+  guint i;
+
+  if (!stream->gap_offset && !stream->gaps->len)
+    return g_strdup (json_txt);
+
+  shifted = gst_vosk_result_shift_times (json_txt, gst_vosk_batcher_time_shift, stream);
+
+  for (i = 0; i < stream->gaps->len; i++) {
+    GstVoskBatchGap *gap = &g_array_index (stream->gaps, GstVoskBatchGap, i);
+
+    if (gap->position > stream->last_time * GST_SECOND)
+      break;
+    stream->gap_offset += gap->duration;
+  }
+  g_array_remove_range (stream->gaps, 0, i);
+
+  return shifted;
+}
+
+static void
+gst_vosk_batcher_deliver (GstVoskBatchStream *stream)
+{
+  const gchar *json_txt;
+
+  /* libvosk returns an empty string once there is no more result */
+  while ((json_txt = vosk_batch_recognizer_front_result (stream->recognizer)) &&
+         json_txt[0] != '\0') {
+    gchar *shifted;
+
+    g_mutex_lock (&batcher_mutex);
+    shifted = gst_vosk_batcher_shift_times (stream, json_txt);
+    g_mutex_unlock (&batcher_mutex);
+
+    stream->func (stream->element, shifted);
+    g_free (shifted);
+    vosk_batch_recognizer_pop (stream->recognizer);
+  }
+}
+
+static gpointer
+gst_vosk_batcher_run (gpointer user_data)
+{
+  VoskBatchModel *model = user_data;
+
+  /* CUDA needs it in every thread using the batch model */
+  vosk_gpu_thread_init ();
+
+  g_mutex_lock (&batcher_mutex);
+
+  while (BATCHER_RUNNING) {
+    GList *batch, *streams = NULL, *iter;
+
+    batch = gst_vosk_batcher_wait_batch ();
+    if (!batch)
+      continue;
+
+    for (iter = batch; iter; iter = iter->next) {
+      GstVoskBatchChunk *chunk = iter->data;
+
+      if (!g_list_find (streams, chunk->stream)) {
+        streams = g_list_prepend (streams, chunk->stream);
+        chunk->stream->busy = TRUE;
+      }
+    }
+
+    g_mutex_unlock (&batcher_mutex);
+
+    GST_LOG ("decoding a batch of %u chunks (%u streams).",
+             g_list_length (batch), g_list_length (streams));
+
+    for (iter = batch; iter; iter = iter->next) {
+      GstVoskBatchChunk *chunk = iter->data;
+
+      if (chunk->size)
+        vosk_batch_recognizer_accept_waveform (chunk->stream->recognizer,
+                                               (const gchar *) chunk->data,
+                                               chunk->size);
+      else
+        vosk_batch_recognizer_finish_stream (chunk->stream->recognizer);
+    }
+
+    vosk_batch_model_wait (model);
+
+    /* Results are delivered outside of the lock: streams cannot be freed
+     * while they are busy. */
+    streams = g_list_reverse (streams);
+    for (iter = streams; iter; iter = iter->next)
+      gst_vosk_batcher_deliver (iter->data);
+
+    g_mutex_lock (&batcher_mutex);
+
+    for (iter = batch; iter; iter = iter->next) {
+      GstVoskBatchChunk *chunk = iter->data;
+
+      chunk->stream->queued--;
+      g_free (chunk);
+    }
+
+    for (iter = streams; iter; iter = iter->next)
+      ((GstVoskBatchStream *) iter->data)->busy = FALSE;
+
+    g_cond_broadcast (&batcher_cond);
+
+    g_list_free (streams);
+    g_list_free (batch);
+  }
+
+  g_mutex_unlock (&batcher_mutex);
+  return NULL;
+}
+
+VoskBatchModel *
+gst_vosk_batcher_acquire (void)
+{
+  static gsize gpu_initialized = 0;
+  VoskBatchModel *model;
+
+  g_mutex_lock (&batcher_mutex);
+
+  if (batcher_model) {
+    batcher_users++;
+    model = batcher_model;
+    g_mutex_unlock (&batcher_mutex);
+    return model;
+  }
+
+  /* The batch model only exists in CUDA builds of libvosk */
+  if (g_once_init_enter (&gpu_initialized)) {
+    vosk_gpu_init ();
+    g_once_init_leave (&gpu_initialized, 1);
+  }
+
+  /* Loading takes a while but this happens in a loading thread */
+  GST_INFO ("loading batch model.");
+  model = vosk_batch_model_new ();
+  if (!model) {
+    GST_WARNING ("could not load batch model.");
+    g_mutex_unlock (&batcher_mutex);
+    return NULL;
+  }
+
+  batcher_model = model;
+  batcher_users = 1;
+  batcher_thread = g_thread_new ("vosk-batcher", gst_vosk_batcher_run, model);
+
+  g_mutex_unlock (&batcher_mutex);
+  return model;
+}
+
+void
+gst_vosk_batcher_release (VoskBatchModel *model)
+{
+  GThread *thread = NULL;
+
+  if (!model)
+    return;
+
+  g_mutex_lock (&batcher_mutex);
+
+  if (model != batcher_model) {
+    GST_WARNING ("batch model %p is not in use.", model);
+    g_mutex_unlock (&batcher_mutex);
+    return;
+  }
+
+  if (--batcher_users == 0) {
+    GST_INFO ("releasing batch model.");
+    thread = batcher_thread;
+    batcher_thread = NULL;
+    batcher_model = NULL;
+    g_cond_broadcast (&batcher_cond);
+  }
+
+  g_mutex_unlock (&batcher_mutex);
+
+  if (!thread)
+    return;
+
+  g_thread_join (thread);
+
+  /* All streams were freed before their model was released */
+  vosk_batch_model_free (model);
+}
+
+GstVoskBatchStream *
+gst_vosk_batcher_stream_new (VoskBatchModel *model,
+                             GstElement *element,
+                             GstVoskBatchResultFunc func,
+                             gfloat rate,
+                             GstClockTime deadline,
+                             guint batch_size)
+{
+  GstVoskBatchStream *stream;
+  VoskBatchRecognizer *recognizer;
+
+  recognizer = vosk_batch_recognizer_new (model, rate);
+  if (!recognizer) {
+    GST_WARNING_OBJECT (element, "could not create batch recognizer.");
+    return NULL;
+  }
+
+  stream = g_new0 (GstVoskBatchStream, 1);
+  stream->recognizer = recognizer;
+  stream->element = element;
+  stream->func = func;
+  stream->deadline = deadline;
+  stream->batch_size = MAX (batch_size, 1);
+  stream->rate = rate;
+  stream->gaps = g_array_new (FALSE, FALSE, sizeof (GstVoskBatchGap));
+
+  g_mutex_lock (&batcher_mutex);
+  batcher_streams = g_list_prepend (batcher_streams, stream);
+  g_mutex_unlock (&batcher_mutex);
+
+  return stream;
+}
+
+/*
+ * A batch is full once that many streams have audio waiting: the smallest
+ * batch-size of the streams, which all share the batch.
+ * MUST be called with batcher_mutex held.
+ */
+static guint
+gst_vosk_batcher_batch_size (void)
+{
+  guint batch_size = G_MAXUINT;
+  GList *iter;
+
+  for (iter = batcher_streams; iter; iter = iter->next)
+    batch_size = MIN (batch_size, ((GstVoskBatchStream *) iter->data)->batch_size);
+
+  return batch_size;
+}
+
+static void
+gst_vosk_batcher_queue (GstVoskBatchStream *stream,
+                        const guint8 *data,
+                        gsize size)
+{
+  GstVoskBatchChunk *chunk;
+
+  chunk = g_malloc (sizeof (GstVoskBatchChunk) + size);
+  chunk->stream = stream;
+  chunk->deadline = g_get_monotonic_time () + stream->deadline / GST_USECOND;
+  chunk->size = size;
+  if (size)
+    memcpy (chunk->data, data, size);
+
+  g_mutex_lock (&batcher_mutex);
+
+  g_queue_push_tail (&batcher_queue, chunk);
+  stream->queued++;
+  if (stream->waiting++ == 0)
+    batcher_waiting_streams++;
+
+  /* End of stream does not wait for the deadline */
+  if (!size || batcher_waiting_streams >= gst_vosk_batcher_batch_size ())
+    batcher_flush = TRUE;
+
+  g_cond_broadcast (&batcher_cond);
+  g_mutex_unlock (&batcher_mutex);
+}
+
+void
+gst_vosk_batcher_stream_push (GstVoskBatchStream *stream,
+                              const guint8 *data,
+                              gsize size)
+{
+  g_return_if_fail (stream != NULL);
+
+  if (!size)
+    return;
+
+  stream->samples += size / sizeof (gint16);
+  gst_vosk_batcher_queue (stream, data, size);
+}
+
+void
+gst_vosk_batcher_stream_skip (GstVoskBatchStream *stream,
+                              GstClockTime duration)
+{
+  GstVoskBatchGap gap;
+
+  g_return_if_fail (stream != NULL);
+
+  if (!duration)
+    return;
+
+  gap.position = gst_util_uint64_scale (stream->samples, GST_SECOND, (guint64) stream->rate);
+  gap.duration = duration;
+
+  g_mutex_lock (&batcher_mutex);
+  g_array_append_val (stream->gaps, gap);
+  g_mutex_unlock (&batcher_mutex);
+}
+
+void
+gst_vosk_batcher_stream_finish (GstVoskBatchStream *stream)
+{
+  g_return_if_fail (stream != NULL);
+
+  gst_vosk_batcher_queue (stream, NULL, 0);
+
+  g_mutex_lock (&batcher_mutex);
+  while (stream->queued || stream->busy)
+    g_cond_wait (&batcher_cond, &batcher_mutex);
+  g_mutex_unlock (&batcher_mutex);
+}
+
+void
+gst_vosk_batcher_stream_free (GstVoskBatchStream *stream)
+{
+  GList *iter, *next;
+
+  if (!stream)
+    return;
+
+  g_mutex_lock (&batcher_mutex);
+
+  /* Drop what was not decoded yet */
+  for (iter = batcher_queue.head; iter; iter = next) {
+    GstVoskBatchChunk *chunk = iter->data;
+
+    next = iter->next;
+    if (chunk->stream != stream)
+      continue;
+
+    g_queue_delete_link (&batcher_queue, iter);
+    stream->queued--;
+    g_free (chunk);
+
+    if (--stream->waiting == 0)
+      batcher_waiting_streams--;
+  }
+
+  batcher_streams = g_list_remove (batcher_streams, stream);
+
+  while (stream->queued || stream->busy)
+    g_cond_wait (&batcher_cond, &batcher_mutex);
+
+  g_mutex_unlock (&batcher_mutex);
+
+  vosk_batch_recognizer_free (stream->recognizer);
+  g_array_free (stream->gaps, TRUE);
+  g_free (stream);
+}
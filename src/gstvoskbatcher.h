@@ -0,0 +1,73 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GST_VOSK_BATCHER_H__
+#define __GST_VOSK_BATCHER_H__
+
+#include <gst/gst.h>
+
+#include "vosk-api.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GstVoskBatchStream GstVoskBatchStream;
+
+/* Called from the batching thread, in the order of the audio of the stream */
+typedef void (*GstVoskBatchResultFunc) (GstElement *element,
+                                        const gchar *json_result);
+
+/*
+ * The batch model is shared by all the elements of the process.
+ * Every successful call to gst_vosk_batcher_acquire() must be balanced by a
+ * call to gst_vosk_batcher_release().
+ */
+VoskBatchModel *gst_vosk_batcher_acquire (void);
+
+void gst_vosk_batcher_release (VoskBatchModel *model);
+
+/*
+ * Chunks pushed by all streams are decoded together, in micro-batches that
+ * are flushed once as many streams as the smallest batch_size of all streams
+ * have chunks queued or once the oldest chunk has waited for deadline.
+ */
+GstVoskBatchStream *gst_vosk_batcher_stream_new (VoskBatchModel *model,
+                                                 GstElement *element,
+                                                 GstVoskBatchResultFunc func,
+                                                 gfloat rate,
+                                                 GstClockTime deadline,
+                                                 guint batch_size);
+
+void gst_vosk_batcher_stream_push (GstVoskBatchStream *stream,
+                                   const guint8 *data,
+                                   gsize size);
+
+/* Accounts for duration nanoseconds of audio that is not pushed: the word
+ * times of the results that come after it are shifted by as much */
+void gst_vosk_batcher_stream_skip (GstVoskBatchStream *stream,
+                                   GstClockTime duration);
+
+/* Ends the stream and waits until its last results were delivered */
+void gst_vosk_batcher_stream_finish (GstVoskBatchStream *stream);
+
+/* No result is delivered once this returns */
+void gst_vosk_batcher_stream_free (GstVoskBatchStream *stream);
+
+G_END_DECLS
+
+#endif /* __GST_VOSK_BATCHER_H__ */
@@ -0,0 +1,610 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "../gst-vosk-config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_STATVFS
+#include <sys/statvfs.h>
+#endif
+
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+
+#include "gstvoskbundle.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_vosk_core_debug);
+#define GST_CAT_DEFAULT gst_vosk_core_debug
+
+/* Large reads keep the disk streaming */
+#define BUNDLE_READ_SIZE (4 * 1024 * 1024)
+
+#define BUNDLE_HEADER_SIZE (8 + 4 + 4 + 8)
+
+typedef struct {
+  gchar   *path;
+  guint64  offset;
+  guint64  size;
+} GstVoskBundleEntry;
+
+static void
+gst_vosk_bundle_entry_free (GstVoskBundleEntry *entry)
+{
+  g_free (entry->path);
+  g_free (entry);
+}
+
+gboolean
+gst_vosk_bundle_is_bundle (const gchar *path)
+{
+  gchar magic[8];
+  gboolean result;
+  FILE *file;
+
+  if (!g_file_test (path, G_FILE_TEST_IS_REGULAR))
+    return FALSE;
+
+  file = g_fopen (path, "rb");
+  if (!file)
+    return FALSE;
+
+  result = fread (magic, 1, sizeof (magic), file) == sizeof (magic) &&
+           memcmp (magic, GST_VOSK_BUNDLE_MAGIC, sizeof (magic)) == 0;
+
+  fclose (file);
+  return result;
+}
+
+/* Lists regular files below dir, sorted, as paths relative to root */
+static void
+gst_vosk_bundle_list (const gchar *root,
+                      const gchar *relative,
+                      GPtrArray *files,
+                      GError **error)
+{
+  const gchar *name;
+  GPtrArray *names;
+  gchar *path;
+  GDir *dir;
+  guint i;
+
+  path = relative ? g_build_filename (root, relative, NULL) : g_strdup (root);
+  dir = g_dir_open (path, 0, error);
+  g_free (path);
+
+  if (!dir)
+    return;
+
+  names = g_ptr_array_new_with_free_func (g_free);
+  while ((name = g_dir_read_name (dir)))
+    g_ptr_array_add (names, g_strdup (name));
+  g_dir_close (dir);
+
+  g_ptr_array_sort (names, (GCompareFunc) g_strcmp0);
+
+  for (i = 0; i < names->len && (!error || !*error); i++) {
+    gchar *child, *full;
+
+    child = relative ?
+            g_build_filename (relative, g_ptr_array_index (names, i), NULL) :
+            g_strdup (g_ptr_array_index (names, i));
+    full = g_build_filename (root, child, NULL);
+
+    if (g_file_test (full, G_FILE_TEST_IS_DIR))
+      gst_vosk_bundle_list (root, child, files, error);
+    else if (g_file_test (full, G_FILE_TEST_IS_REGULAR)) {
+      g_ptr_array_add (files, child);
+      child = NULL;
+    }
+
+    g_free (full);
+    g_free (child);
+  }
+
+  g_ptr_array_unref (names);
+}
+
+static gboolean
+gst_vosk_bundle_write (FILE *file,
+                       gconstpointer data,
+                       gsize size,
+                       GError **error)
+{
+  if (fwrite (data, 1, size, file) == size)
+    return TRUE;
+
+  g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+               "could not write bundle: %s", g_strerror (errno));
+  return FALSE;
+}
+
+static gboolean
+gst_vosk_bundle_pad (FILE *file,
+                     guint64 *position,
+                     GError **error)
+{
+  static const guint8 zeros[GST_VOSK_BUNDLE_ALIGNMENT] = { 0, };
+  gsize padding;
+
+  padding = (GST_VOSK_BUNDLE_ALIGNMENT - *position % GST_VOSK_BUNDLE_ALIGNMENT) %
+            GST_VOSK_BUNDLE_ALIGNMENT;
+  *position += padding;
+  return gst_vosk_bundle_write (file, zeros, padding, error);
+}
+
+gboolean
+gst_vosk_bundle_pack (const gchar *model_dir,
+                      const gchar *bundle,
+                      GError **error)
+{
+  GError *local_error = NULL;
+  guint64 index_size = 0;
+  guint64 position, offset;
+  GByteArray *index;
+  GPtrArray *files;
+  GArray *sizes;
+  FILE *output;
+  gboolean result = FALSE;
+  guint8 *buffer;
+  guint i;
+
+  files = g_ptr_array_new_with_free_func (g_free);
+  gst_vosk_bundle_list (model_dir, NULL, files, &local_error);
+  if (local_error) {
+    g_propagate_error (error, local_error);
+    g_ptr_array_unref (files);
+    return FALSE;
+  }
+
+  for (i = 0; i < files->len; i++)
+    index_size += 4 + strlen (g_ptr_array_index (files, i)) + 8 + 8;
+
+  /* Build the index: offsets only depend on the sizes of the files */
+  index = g_byte_array_new ();
+  sizes = g_array_sized_new (FALSE, FALSE, sizeof (guint64), files->len);
+  offset = BUNDLE_HEADER_SIZE + index_size;
+  for (i = 0; i < files->len; i++) {
+    const gchar *relative = g_ptr_array_index (files, i);
+    guint32 path_len = GUINT32_TO_LE (strlen (relative));
+    guint64 le_offset, le_size, size;
+    GStatBuf buf;
+    gchar *full;
+
+    full = g_build_filename (model_dir, relative, NULL);
+    if (g_stat (full, &buf) != 0) {
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                   "could not stat %s: %s", full, g_strerror (errno));
+      g_free (full);
+      goto end;
+    }
+    g_free (full);
+
+    offset += (GST_VOSK_BUNDLE_ALIGNMENT - offset % GST_VOSK_BUNDLE_ALIGNMENT) %
+              GST_VOSK_BUNDLE_ALIGNMENT;
+
+    le_offset = GUINT64_TO_LE (offset);
+    le_size = GUINT64_TO_LE ((guint64) buf.st_size);
+
+    g_byte_array_append (index, (const guint8 *) &path_len, 4);
+    g_byte_array_append (index, (const guint8 *) relative, strlen (relative));
+    g_byte_array_append (index, (const guint8 *) &le_offset, 8);
+    g_byte_array_append (index, (const guint8 *) &le_size, 8);
+    size = buf.st_size;
+    g_array_append_val (sizes, size);
+
+    offset += buf.st_size;
+  }
+
+  output = g_fopen (bundle, "wb");
+  if (!output) {
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                 "could not create %s: %s", bundle, g_strerror (errno));
+    goto end;
+  }
+
+  {
+    guint32 version = GUINT32_TO_LE (GST_VOSK_BUNDLE_VERSION);
+    guint32 count = GUINT32_TO_LE (files->len);
+    guint64 le_index_size = GUINT64_TO_LE (index_size);
+
+    if (!gst_vosk_bundle_write (output, GST_VOSK_BUNDLE_MAGIC, 8, error) ||
+        !gst_vosk_bundle_write (output, &version, 4, error) ||
+        !gst_vosk_bundle_write (output, &count, 4, error) ||
+        !gst_vosk_bundle_write (output, &le_index_size, 8, error) ||
+        !gst_vosk_bundle_write (output, index->data, index->len, error))
+      goto close;
+  }
+
+  position = BUNDLE_HEADER_SIZE + index_size;
+  buffer = g_malloc (BUNDLE_READ_SIZE);
+
+  for (i = 0; i < files->len; i++) {
+    guint64 copied = 0;
+    gchar *full;
+    FILE *input;
+    gsize read;
+
+    if (!gst_vosk_bundle_pad (output, &position, &local_error))
+      break;
+
+    full = g_build_filename (model_dir, g_ptr_array_index (files, i), NULL);
+    input = g_fopen (full, "rb");
+    if (!input) {
+      g_set_error (&local_error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                   "could not open %s: %s", full, g_strerror (errno));
+      g_free (full);
+      break;
+    }
+
+    while ((read = fread (buffer, 1, BUNDLE_READ_SIZE, input)) > 0) {
+      if (!gst_vosk_bundle_write (output, buffer, read, &local_error))
+        break;
+
+      position += read;
+      copied += read;
+    }
+
+    /* The offsets of the index would not match the data any more */
+    if (!local_error && ferror (input))
+      g_set_error (&local_error, G_FILE_ERROR, G_FILE_ERROR_IO,
+                   "could not read %s", full);
+    else if (!local_error && copied != g_array_index (sizes, guint64, i))
+      g_set_error (&local_error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                   "%s changed while packing (%" G_GUINT64_FORMAT " bytes instead of %"
+                   G_GUINT64_FORMAT ")",
+                   full, copied, g_array_index (sizes, guint64, i));
+
+    fclose (input);
+    g_free (full);
+
+    if (local_error)
+      break;
+  }
+
+  g_free (buffer);
+
+  result = (local_error == NULL);
+  if (local_error)
+    g_propagate_error (error, local_error);
+
+close:
+  if (fclose (output) != 0 && result) {
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                 "could not write %s: %s", bundle, g_strerror (errno));
+    result = FALSE;
+  }
+
+  if (!result)
+    g_unlink (bundle);
+
+end:
+  g_array_unref (sizes);
+  g_byte_array_unref (index);
+  g_ptr_array_unref (files);
+  return result;
+}
+
+static gboolean
+gst_vosk_bundle_read (int fd,
+                      gpointer data,
+                      gsize size)
+{
+  guint8 *p = data;
+
+  while (size) {
+    gssize result = read (fd, p, size);
+
+    if (result < 0 && errno == EINTR)
+      continue;
+
+    if (result <= 0)
+      return FALSE;
+
+    p += result;
+    size -= result;
+  }
+
+  return TRUE;
+}
+
+/* Paths are relative and stay below the extraction directory */
+static gboolean
+gst_vosk_bundle_path_is_valid (const gchar *path)
+{
+  gboolean valid = TRUE;
+  gchar **components;
+  guint i;
+
+  if (!path[0] || g_path_is_absolute (path))
+    return FALSE;
+
+  components = g_strsplit_set (path, "/\\", -1);
+  for (i = 0; components[i] && valid; i++)
+    valid = strcmp (components[i], "..") != 0;
+  g_strfreev (components);
+
+  return valid;
+}
+
+static GPtrArray *
+gst_vosk_bundle_read_index (int fd)
+{
+  guint8 header[BUNDLE_HEADER_SIZE];
+  guint32 version, count, path_len;
+  guint64 index_size;
+  GPtrArray *entries;
+  guint8 *index, *p, *end;
+  guint i;
+
+  if (!gst_vosk_bundle_read (fd, header, sizeof (header)) ||
+      memcmp (header, GST_VOSK_BUNDLE_MAGIC, 8) != 0)
+    return NULL;
+
+  memcpy (&version, header + 8, 4);
+  memcpy (&count, header + 12, 4);
+  memcpy (&index_size, header + 16, 8);
+  version = GUINT32_FROM_LE (version);
+  count = GUINT32_FROM_LE (count);
+  index_size = GUINT64_FROM_LE (index_size);
+
+  if (version != GST_VOSK_BUNDLE_VERSION || index_size > G_MAXUINT32) {
+    GST_WARNING ("unsupported bundle (version %u).", version);
+    return NULL;
+  }
+
+  index = g_malloc (index_size);
+  if (!gst_vosk_bundle_read (fd, index, index_size)) {
+    g_free (index);
+    return NULL;
+  }
+
+  entries = g_ptr_array_new_with_free_func ((GDestroyNotify) gst_vosk_bundle_entry_free);
+  p = index;
+  end = index + index_size;
+
+  for (i = 0; i < count; i++) {
+    GstVoskBundleEntry *entry;
+
+    if (end - p < 4)
+      break;
+
+    memcpy (&path_len, p, 4);
+    path_len = GUINT32_FROM_LE (path_len);
+    p += 4;
+
+    if ((guint64) (end - p) < (guint64) path_len + 16)
+      break;
+
+    entry = g_new0 (GstVoskBundleEntry, 1);
+    entry->path = g_strndup ((const gchar *) p, path_len);
+    p += path_len;
+    memcpy (&entry->offset, p, 8);
+    entry->offset = GUINT64_FROM_LE (entry->offset);
+    memcpy (&entry->size, p + 8, 8);
+    entry->size = GUINT64_FROM_LE (entry->size);
+    p += 16;
+
+    g_ptr_array_add (entries, entry);
+
+    /* Never write outside of the extraction directory */
+    if (!gst_vosk_bundle_path_is_valid (entry->path)) {
+      GST_WARNING ("invalid path in bundle: %s", entry->path);
+      break;
+    }
+  }
+
+  g_free (index);
+
+  if (i != count) {
+    GST_WARNING ("corrupted bundle index.");
+    g_ptr_array_unref (entries);
+    return NULL;
+  }
+
+  return entries;
+}
+
+static gboolean
+gst_vosk_bundle_extract_entry (int fd,
+                               GstVoskBundleEntry *entry,
+                               const gchar *dir,
+                               guint8 *buffer)
+{
+  guint64 remaining = entry->size;
+  gboolean result = TRUE;
+  gchar *path, *parent;
+  int output;
+
+  if (lseek (fd, entry->offset, SEEK_SET) < 0)
+    return FALSE;
+
+  path = g_build_filename (dir, entry->path, NULL);
+  parent = g_path_get_dirname (path);
+  g_mkdir_with_parents (parent, 0700);
+  g_free (parent);
+
+  output = g_open (path, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+  g_free (path);
+  if (output < 0)
+    return FALSE;
+
+  while (remaining && result) {
+    gsize size = MIN (remaining, BUNDLE_READ_SIZE);
+    gsize written = 0;
+
+    result = gst_vosk_bundle_read (fd, buffer, size);
+    while (result && written < size) {
+      gssize ret = write (output, buffer + written, size - written);
+
+      if (ret < 0 && errno == EINTR)
+        continue;
+
+      result = ret > 0;
+      if (result)
+        written += ret;
+    }
+
+    remaining -= size;
+  }
+
+  close (output);
+  return result;
+}
+
+static void
+gst_vosk_bundle_remove (const gchar *path)
+{
+  if (g_file_test (path, G_FILE_TEST_IS_DIR)) {
+    const gchar *name;
+    GDir *dir;
+
+    dir = g_dir_open (path, 0, NULL);
+    if (dir) {
+      while ((name = g_dir_read_name (dir))) {
+        gchar *child = g_build_filename (path, name, NULL);
+
+        gst_vosk_bundle_remove (child);
+        g_free (child);
+      }
+
+      g_dir_close (dir);
+    }
+
+    g_rmdir (path);
+  }
+  else
+    g_unlink (path);
+}
+
+/*
+ * Returns a directory with room for size bytes to extract a bundle to:
+ * memory first (the user runtime directory, /dev/shm), then the temporary
+ * directory. The runtime directory GLib falls back to when XDG_RUNTIME_DIR
+ * is unset is on disk, it is not used.
+ */
+static gchar *
+gst_vosk_bundle_extraction_dir (guint64 size)
+{
+  const gchar *candidates[] = { g_getenv ("XDG_RUNTIME_DIR"), "/dev/shm", g_get_tmp_dir () };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (candidates); i++) {
+#ifdef HAVE_STATVFS
+    struct statvfs stats;
+#endif
+
+    if (!candidates[i] || !g_file_test (candidates[i], G_FILE_TEST_IS_DIR))
+      continue;
+
+#ifdef HAVE_STATVFS
+    if (statvfs (candidates[i], &stats) == 0 &&
+        (guint64) stats.f_bavail * stats.f_frsize < size) {
+      GST_DEBUG ("not enough room in %s (%" G_GUINT64_FORMAT " bytes needed).",
+                 candidates[i], size);
+      continue;
+    }
+#endif
+
+    return g_build_filename (candidates[i], "gst-vosk-XXXXXX", NULL);
+  }
+
+  return NULL;
+}
+
+VoskModel *
+gst_vosk_bundle_load_model (const gchar *bundle)
+{
+  VoskModel *model = NULL;
+  GPtrArray *entries;
+  gchar *dir = NULL;
+  guint64 size = 0;
+  guint8 *buffer;
+  gint64 start;
+  guint i;
+  int fd;
+
+  start = g_get_monotonic_time ();
+
+  fd = g_open (bundle, O_RDONLY, 0);
+  if (fd < 0) {
+    GST_WARNING ("could not open bundle %s (%s).", bundle, g_strerror (errno));
+    return NULL;
+  }
+
+#ifdef HAVE_POSIX_FADVISE
+  /* The whole file is read once, front to back */
+  posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  posix_fadvise (fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+
+  entries = gst_vosk_bundle_read_index (fd);
+  if (!entries) {
+    GST_WARNING ("invalid bundle %s.", bundle);
+    close (fd);
+    return NULL;
+  }
+
+  for (i = 0; i < entries->len; i++)
+    size += ((GstVoskBundleEntry *) g_ptr_array_index (entries, i))->size;
+
+  dir = gst_vosk_bundle_extraction_dir (size);
+  if (!dir) {
+    GST_WARNING ("no room to extract bundle %s (%" G_GUINT64_FORMAT " bytes).", bundle, size);
+    goto end;
+  }
+
+  if (!g_mkdtemp (dir)) {
+    GST_WARNING ("could not create extraction directory (%s).", g_strerror (errno));
+    goto end;
+  }
+
+  buffer = g_malloc (BUNDLE_READ_SIZE);
+  for (i = 0; i < entries->len; i++) {
+    if (!gst_vosk_bundle_extract_entry (fd, g_ptr_array_index (entries, i), dir, buffer)) {
+      GST_WARNING ("could not extract %s from %s.",
+                   ((GstVoskBundleEntry *) g_ptr_array_index (entries, i))->path,
+                   bundle);
+      break;
+    }
+  }
+  g_free (buffer);
+
+  GST_INFO ("bundle %s extracted to %s in %" G_GINT64_FORMAT " ms.",
+            bundle, dir, (g_get_monotonic_time () - start) / 1000);
+
+  if (i == entries->len)
+    model = vosk_model_new (dir);
+
+  /* libvosk does not need the files any more once the model is loaded */
+  gst_vosk_bundle_remove (dir);
+
+end:
+#ifdef HAVE_POSIX_FADVISE
+  /* The bundle is not read again, leave room in the page cache */
+  posix_fadvise (fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+
+  close (fd);
+  g_ptr_array_unref (entries);
+  g_free (dir);
+  return model;
+}
@@ -0,0 +1,59 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GST_VOSK_BUNDLE_H__
+#define __GST_VOSK_BUNDLE_H__
+
+#include <glib.h>
+
+#include "vosk-api.h"
+
+G_BEGIN_DECLS
+
+/*
+ * A bundle packs a model directory into a single file: a header and an index
+ * of the files at the front, then the contents of the files, each aligned on
+ * GST_VOSK_BUNDLE_ALIGNMENT bytes, in the order of the index.
+ *
+ * header:  "GSTVOSKB", version (u32), number of files (u32), index size (u64)
+ * entry:   path length (u32), path, offset (u64), size (u64)
+ *
+ * Integers are little endian. Paths are relative to the model directory.
+ */
+#define GST_VOSK_BUNDLE_MAGIC "GSTVOSKB"
+#define GST_VOSK_BUNDLE_VERSION 1
+#define GST_VOSK_BUNDLE_ALIGNMENT 4096
+
+gboolean gst_vosk_bundle_is_bundle (const gchar *path);
+
+gboolean gst_vosk_bundle_pack (const gchar *model_dir,
+                               const gchar *bundle,
+                               GError **error);
+
+/*
+ * Loads a model from a bundle: its files are read sequentially into a
+ * temporary directory that is removed once libvosk has loaded the model. It
+ * is in memory (the user runtime directory or /dev/shm) when there is room
+ * for the model there, in the temporary directory otherwise.
+ */
+VoskModel *gst_vosk_bundle_load_model (const gchar *bundle);
+
+G_END_DECLS
+
+#endif /* __GST_VOSK_BUNDLE_H__ */
@@ -0,0 +1,349 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <string.h>
+
+#include <json-glib/json-glib.h>
+
+#include "gstvoskcaption.h"
+
+#define CAPTION_COLUMNS 32
+
+/* Miscellaneous control codes, data channel 1 */
+#define CAPTION_RU2 0x25
+#define CAPTION_CR  0x2d
+#define CAPTION_CONTROL 0x14
+
+/* No data (with parity) */
+#define CAPTION_PADDING 0x80
+
+struct _GstVoskCaption {
+  GByteArray  *pairs;
+  guint        read;
+
+  /* A character waiting for a second one to make a pair */
+  guint8       pending;
+
+  gboolean     started;
+  guint        column;
+
+  gchar      **words;
+  guint        committed;
+};
+
+GstVoskCaption *
+gst_vosk_caption_new (void)
+{
+  GstVoskCaption *caption;
+
+  caption = g_new0 (GstVoskCaption, 1);
+  caption->pairs = g_byte_array_new ();
+  return caption;
+}
+
+void
+gst_vosk_caption_free (GstVoskCaption *caption)
+{
+  if (!caption)
+    return;
+
+  g_byte_array_unref (caption->pairs);
+  g_strfreev (caption->words);
+  g_free (caption);
+}
+
+void
+gst_vosk_caption_reset (GstVoskCaption *caption)
+{
+  g_byte_array_set_size (caption->pairs, 0);
+  caption->read = 0;
+  caption->pending = 0;
+  caption->started = FALSE;
+  caption->column = 0;
+
+  g_strfreev (caption->words);
+  caption->words = NULL;
+  caption->committed = 0;
+}
+
+gboolean
+gst_vosk_caption_is_empty (GstVoskCaption *caption)
+{
+  return caption->read >= caption->pairs->len && !caption->pending;
+}
+
+/* Sets the most significant bit so that the byte has odd parity */
+static guint8
+gst_vosk_caption_parity (guint8 byte)
+{
+  guint8 bits = byte & 0x7f;
+  guint ones = 0;
+
+  for (; bits; bits >>= 1)
+    ones += bits & 1;
+
+  return (byte & 0x7f) | (ones % 2 ? 0x00 : 0x80);
+}
+
+static void
+gst_vosk_caption_add_pair (GstVoskCaption *caption,
+                           guint8 first,
+                           guint8 second)
+{
+  guint8 pair[2];
+
+  pair[0] = gst_vosk_caption_parity (first);
+  pair[1] = gst_vosk_caption_parity (second);
+  g_byte_array_append (caption->pairs, pair, 2);
+}
+
+static void
+gst_vosk_caption_flush_pending (GstVoskCaption *caption)
+{
+  if (!caption->pending)
+    return;
+
+  gst_vosk_caption_add_pair (caption, caption->pending, 0x00);
+  caption->pending = 0;
+}
+
+/* Control codes are sent twice in a row, decoders ignore the repetition */
+static void
+gst_vosk_caption_add_control (GstVoskCaption *caption,
+                              guint8 code)
+{
+  gst_vosk_caption_flush_pending (caption);
+  gst_vosk_caption_add_pair (caption, CAPTION_CONTROL, code);
+  gst_vosk_caption_add_pair (caption, CAPTION_CONTROL, code);
+}
+
+static void
+gst_vosk_caption_add_char (GstVoskCaption *caption,
+                           guint8 byte)
+{
+  if (!caption->pending) {
+    caption->pending = byte;
+    return;
+  }
+
+  gst_vosk_caption_add_pair (caption, caption->pending, byte);
+  caption->pending = 0;
+}
+
+/*
+ * Returns the byte of the basic character set of a character or 0 if it has
+ * none. Some ASCII codes are accented letters in CEA-608.
+ */
+static guint8
+gst_vosk_caption_char (gunichar c)
+{
+  switch (c) {
+    case 0x00e1: return 0x2a;  /* á */
+    case 0x00e9: return 0x5c;  /* é */
+    case 0x00ed: return 0x5e;  /* í */
+    case 0x00f3: return 0x5f;  /* ó */
+    case 0x00fa: return 0x60;  /* ú */
+    case 0x00e7: return 0x7b;  /* ç */
+    case 0x00d1: return 0x7d;  /* Ñ */
+    case 0x00f1: return 0x7e;  /* ñ */
+
+    case '*': case '\\': case '^': case '_': case '`':
+    case '{': case '|': case '}': case '~':
+      return 0;
+
+    default:
+      break;
+  }
+
+  if (c >= 0x20 && c < 0x7f)
+    return c;
+
+  return 0;
+}
+
+static void
+gst_vosk_caption_add_word (GstVoskCaption *caption,
+                           const gchar *word)
+{
+  GString *bytes;
+  const gchar *p;
+  guint i;
+
+  bytes = g_string_new (NULL);
+  for (p = word; *p && bytes->len < CAPTION_COLUMNS; p = g_utf8_next_char (p)) {
+    gunichar c = g_utf8_get_char (p);
+    guint8 byte = gst_vosk_caption_char (c);
+
+    /* Try without the accent */
+    if (!byte) {
+      gchar utf8[7] = { 0, };
+      gchar *ascii;
+
+      g_unichar_to_utf8 (c, utf8);
+      ascii = g_str_to_ascii (utf8, "C");
+      if (ascii && ascii[0] != '?')
+        byte = gst_vosk_caption_char (ascii[0]);
+      g_free (ascii);
+    }
+
+    if (byte)
+      g_string_append_c (bytes, byte);
+  }
+
+  if (!bytes->len) {
+    g_string_free (bytes, TRUE);
+    return;
+  }
+
+  /* Roll up when the word does not fit */
+  if (caption->column && caption->column + 1 + bytes->len > CAPTION_COLUMNS) {
+    gst_vosk_caption_add_control (caption, CAPTION_CR);
+    caption->column = 0;
+  }
+
+  if (caption->column) {
+    gst_vosk_caption_add_char (caption, ' ');
+    caption->column++;
+  }
+
+  for (i = 0; i < bytes->len; i++)
+    gst_vosk_caption_add_char (caption, bytes->str[i]);
+
+  caption->column += bytes->len;
+  g_string_free (bytes, TRUE);
+}
+
+static gchar *
+gst_vosk_caption_get_text (const gchar *json_result,
+                           gboolean final)
+{
+  JsonParser *parser;
+  JsonObject *object;
+  const gchar *member = final ? "text" : "partial";
+  gchar *text = NULL;
+
+  parser = json_parser_new ();
+  if (!json_parser_load_from_data (parser, json_result, -1, NULL) ||
+      !JSON_NODE_HOLDS_OBJECT (json_parser_get_root (parser)))
+    goto end;
+
+  object = json_node_get_object (json_parser_get_root (parser));
+
+  /* The first alternative is the best one */
+  if (json_object_has_member (object, "alternatives")) {
+    JsonArray *alternatives;
+
+    alternatives = json_object_get_array_member (object, "alternatives");
+    if (!alternatives || json_array_get_length (alternatives) == 0)
+      goto end;
+
+    object = json_array_get_object_element (alternatives, 0);
+    member = "text";
+  }
+
+  if (object && json_object_has_member (object, member))
+    text = g_strdup (json_object_get_string_member (object, member));
+
+end:
+  g_object_unref (parser);
+  return text;
+}
+
+void
+gst_vosk_caption_push_result (GstVoskCaption *caption,
+                              const gchar *json_result,
+                              gboolean final)
+{
+  gchar **words;
+  gchar *text;
+  guint stable, i;
+
+  text = gst_vosk_caption_get_text (json_result, final);
+  if (!text)
+    return;
+
+  words = g_strsplit_set (g_strstrip (text), " ", -1);
+  g_free (text);
+
+  if (!caption->started) {
+    gst_vosk_caption_add_control (caption, CAPTION_RU2);
+    caption->started = TRUE;
+  }
+
+  /* Words of partial results can still change: wait for two results to
+   * agree on them */
+  for (stable = 0; words[stable]; stable++) {
+    if (final)
+      continue;
+
+    if (!caption->words || stable >= g_strv_length (caption->words) ||
+        g_strcmp0 (words[stable], caption->words[stable]))
+      break;
+  }
+
+  for (i = caption->committed; i < stable; i++) {
+    if (words[i][0] != '\0')
+      gst_vosk_caption_add_word (caption, words[i]);
+  }
+
+  g_strfreev (caption->words);
+
+  if (final) {
+    /* Next utterance on a new line */
+    if (caption->column) {
+      gst_vosk_caption_add_control (caption, CAPTION_CR);
+      caption->column = 0;
+    }
+    else
+      gst_vosk_caption_flush_pending (caption);
+
+    g_strfreev (words);
+    caption->words = NULL;
+    caption->committed = 0;
+    return;
+  }
+
+  caption->words = words;
+  caption->committed = MAX (caption->committed, stable);
+}
+
+void
+gst_vosk_caption_next_pair (GstVoskCaption *caption,
+                            guint8 pair[2])
+{
+  /* Do not hold a lone character back when there is nothing else to send */
+  if (caption->read >= caption->pairs->len)
+    gst_vosk_caption_flush_pending (caption);
+
+  if (caption->read >= caption->pairs->len) {
+    pair[0] = CAPTION_PADDING;
+    pair[1] = CAPTION_PADDING;
+    return;
+  }
+
+  pair[0] = caption->pairs->data[caption->read];
+  pair[1] = caption->pairs->data[caption->read + 1];
+  caption->read += 2;
+
+  /* Everything was sent */
+  if (caption->read >= caption->pairs->len) {
+    g_byte_array_set_size (caption->pairs, 0);
+    caption->read = 0;
+  }
+}
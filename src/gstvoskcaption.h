@@ -0,0 +1,54 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GST_VOSK_CAPTION_H__
+#define __GST_VOSK_CAPTION_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Turns results into a CEA-608 roll-up caption stream (2 rows, field 1, CC1).
+ * Words of partial results are captioned once they are stable, that is once
+ * two consecutive partial results agree on them; final results complete the
+ * line. Each video frame carries one byte pair.
+ */
+typedef struct _GstVoskCaption GstVoskCaption;
+
+GstVoskCaption *gst_vosk_caption_new (void);
+
+void gst_vosk_caption_free (GstVoskCaption *caption);
+
+/* Forgets pending text and starts again with a roll-up command */
+void gst_vosk_caption_reset (GstVoskCaption *caption);
+
+void gst_vosk_caption_push_result (GstVoskCaption *caption,
+                                   const gchar *json_result,
+                                   gboolean final);
+
+gboolean gst_vosk_caption_is_empty (GstVoskCaption *caption);
+
+/* Fills pair with the next byte pair or with padding if there is none */
+void gst_vosk_caption_next_pair (GstVoskCaption *caption,
+                                 guint8 pair[2]);
+
+G_END_DECLS
+
+#endif /* __GST_VOSK_CAPTION_H__ */
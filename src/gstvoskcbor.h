@@ -0,0 +1,44 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GST_VOSK_CBOR_H__
+#define __GST_VOSK_CBOR_H__
+
+/* Shared by the encoder (libgstvoskcore) and the decoder (libgstvoskresult) */
+
+#define CBOR_UINT     0
+#define CBOR_NEGINT   1
+#define CBOR_BYTES    2
+#define CBOR_TEXT     3
+#define CBOR_ARRAY    4
+#define CBOR_MAP      5
+#define CBOR_TAG      6
+#define CBOR_SIMPLE   7
+
+#define CBOR_FALSE    20
+#define CBOR_TRUE     21
+#define CBOR_NULL     22
+
+#define KEY_TEXT          0
+#define KEY_PARTIAL       1
+#define KEY_WORDS         2
+#define KEY_ALTERNATIVES  3
+#define KEY_CONFIDENCE    4
+
+#endif /* __GST_VOSK_CBOR_H__ */
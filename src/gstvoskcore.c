@@ -0,0 +1,1185 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "../gst-vosk-config.h"
+
+#include <string.h>
+#ifdef HAVE_CLOCK_THREAD_CPUTIME
+#include <time.h>
+#endif
+
+#include <gst/gst.h>
+#include <json-glib/json-glib.h>
+
+#include "gstvoskcore.h"
+#include "gstvosklocale.h"
+#include "gstvoskmodelcache.h"
+#include "gstvoskrescorer.h"
+#include "vosk-api.h"
+
+GST_DEBUG_CATEGORY (gst_vosk_core_debug);
+#define GST_CAT_DEFAULT gst_vosk_core_debug
+
+#define VOSK_EMPTY_PARTIAL_RESULT  "{\n  \"partial\" : \"\"\n}"
+#define VOSK_EMPTY_TEXT_RESULT     "{\n  \"text\" : \"\"\n}"
+#define VOSK_EMPTY_TEXT_RESULT_ALT "{\"text\": \"\"}"
+
+/* A forced final result waits for a low energy buffer (below a quarter of
+ * the average energy of the utterance) but no longer than this. */
+#define FORCED_RESULT_ENERGY_RATIO 4
+#define FORCED_RESULT_MAX_DELAY(max) ((max) / 4)
+
+/* Same ratio for the silence that makes a result tentative */
+#define SILENCE_ENERGY_RATIO 4
+
+/* Missing audio that lasts longer than this ends the utterance, as the
+ * trailing silence of the endpointer would */
+#define GAP_END_OF_UTTERANCE (GST_SECOND / 2)
+
+typedef struct {
+  guint64 position;   /* decoded audio before the gap, since recognizer start */
+  guint64 duration;
+} GstVoskCoreGap;
+
+struct _GstVoskCore {
+  VoskModel              *model;
+  VoskModel              *rescoring_model;
+  VoskRecognizer         *recognizer;
+  gfloat                  rate;
+
+  /* Cascade mode, the wake recognizer decodes until a phrase is heard */
+  VoskRecognizer         *wake_recognizer;
+  gchar                 **wake_phrases;
+  gchar                  *wake_grammar;
+  guint64                 wake_preroll;
+  GByteArray             *wake_audio;
+  guint64                 asleep_samples;
+  gboolean                awake;
+
+  gint                    alternatives;
+  guint64                 max_utterance_duration;
+  guint64                 recycle_interval;
+  gint64                  partial_interval;
+  guint64                 speculative_silence;
+
+  gdouble                 rescoring_threshold;
+  GstVoskCoreRevisedFunc  revised_func;
+  gpointer                revised_data;
+  GstVoskCoreRefFunc      revised_data_ref;
+  GDestroyNotify          revised_data_unref;
+
+  gchar                  *prev_partial;
+  gchar                  *tentative;
+
+  guint64                 utterance_id;
+  GByteArray             *utterance_audio;
+
+  guint64                 utterance_samples;
+  guint64                 utterance_energy;
+  guint64                 speech_energy;
+  guint64                 silence_samples;
+  guint64                 recognizer_samples;
+  guint64                 last_partial_samples;
+
+  guint64                 forced_results;
+  guint64                 recognizer_recycles;
+
+  guint64                 cpu_time;
+  guint64                 utterance_cpu_time;
+
+  /* Libvosk times words on the audio it decoded: gaps of the current
+   * utterance and the sum of the previous ones shift them back on the
+   * timeline */
+  GArray                 *gaps;
+  guint64                 gap_offset;
+  guint64                 gap_duration;
+
+  GQueue                  results;
+};
+
+static void
+gst_vosk_core_debug_init (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized)) {
+    GST_DEBUG_CATEGORY_INIT (gst_vosk_core_debug, "voskcore",
+        0, "Speech recognition core of the vosk element");
+    g_once_init_leave (&initialized, 1);
+  }
+}
+
+struct _GstVoskModel {
+  gint       ref_count;
+  gchar     *path;
+  VoskModel *model;     /* one user of the model cache */
+};
+
+G_DEFINE_BOXED_TYPE (GstVoskModel, gst_vosk_model, gst_vosk_model_ref, gst_vosk_model_unref);
+
+GstVoskModel *
+gst_vosk_model_new (const gchar *path,
+                    gboolean shared)
+{
+  GstVoskModel *model;
+  VoskModel *vosk_model;
+
+  g_return_val_if_fail (path != NULL, NULL);
+
+  gst_vosk_core_debug_init ();
+
+  if (shared)
+    vosk_model = gst_vosk_model_cache_get (path);
+  else
+    vosk_model = gst_vosk_model_cache_get_private (path);
+
+  if (!vosk_model)
+    return NULL;
+
+  model = g_new0 (GstVoskModel, 1);
+  model->ref_count = 1;
+  model->path = g_strdup (path);
+  model->model = vosk_model;
+  return model;
+}
+
+GstVoskModel *
+gst_vosk_model_ref (GstVoskModel *model)
+{
+  g_return_val_if_fail (model != NULL, NULL);
+
+  g_atomic_int_inc (&model->ref_count);
+  return model;
+}
+
+void
+gst_vosk_model_unref (GstVoskModel *model)
+{
+  if (!model || !g_atomic_int_dec_and_test (&model->ref_count))
+    return;
+
+  gst_vosk_model_cache_release (model->model);
+  g_free (model->path);
+  g_free (model);
+}
+
+const gchar *
+gst_vosk_model_get_path (GstVoskModel *model)
+{
+  g_return_val_if_fail (model != NULL, NULL);
+
+  return model->path;
+}
+
+/* model is a reference from the cache, stolen */
+static GstVoskCore *
+gst_vosk_core_new_with_cache_model (VoskModel *model,
+                                    const gchar *rescoring_model_path)
+{
+  GstVoskCore *core;
+
+  core = g_new0 (GstVoskCore, 1);
+  core->model = model;
+  core->partial_interval = 0;
+  core->gaps = g_array_new (FALSE, FALSE, sizeof (GstVoskCoreGap));
+  core->wake_audio = g_byte_array_new ();
+  g_queue_init (&core->results);
+
+  /* The rescoring model is optional: just warn if it cannot be loaded */
+  if (rescoring_model_path) {
+    GST_INFO ("creating rescoring model %s.", rescoring_model_path);
+    core->rescoring_model = gst_vosk_model_cache_get (rescoring_model_path);
+    if (!core->rescoring_model)
+      GST_WARNING ("could not create rescoring model %s, rescoring disabled.",
+                   rescoring_model_path);
+  }
+
+  return core;
+}
+
+GstVoskCore *
+gst_vosk_core_new (const gchar *model_path,
+                   const gchar *rescoring_model_path)
+{
+  VoskModel *model;
+
+  g_return_val_if_fail (model_path != NULL, NULL);
+
+  gst_vosk_core_debug_init ();
+
+  model = gst_vosk_model_cache_get (model_path);
+  if (!model)
+    return NULL;
+
+  return gst_vosk_core_new_with_cache_model (model, rescoring_model_path);
+}
+
+GstVoskCore *
+gst_vosk_core_new_for_model (GstVoskModel *model,
+                             const gchar *rescoring_model_path)
+{
+  VoskModel *vosk_model;
+
+  g_return_val_if_fail (model != NULL, NULL);
+
+  gst_vosk_core_debug_init ();
+
+  vosk_model = gst_vosk_model_cache_ref (model->model);
+  if (!vosk_model)
+    return NULL;
+
+  return gst_vosk_core_new_with_cache_model (vosk_model, rescoring_model_path);
+}
+
+void
+gst_vosk_core_free (GstVoskCore *core)
+{
+  if (!core)
+    return;
+
+  if (core->recognizer)
+    vosk_recognizer_free (core->recognizer);
+
+  if (core->wake_recognizer)
+    vosk_recognizer_free (core->wake_recognizer);
+
+  gst_vosk_model_cache_release (core->model);
+  gst_vosk_model_cache_release (core->rescoring_model);
+
+  if (core->utterance_audio)
+    g_byte_array_unref (core->utterance_audio);
+
+  g_queue_clear_full (&core->results, (GDestroyNotify) gst_vosk_core_result_free);
+  g_array_unref (core->gaps);
+  g_byte_array_unref (core->wake_audio);
+  g_strfreev (core->wake_phrases);
+  g_free (core->wake_grammar);
+  g_free (core->prev_partial);
+  g_free (core->tentative);
+  g_free (core);
+}
+
+gboolean
+gst_vosk_core_has_rescoring (GstVoskCore *core)
+{
+  return core->rescoring_model != NULL;
+}
+
+void
+gst_vosk_core_set_alternatives (GstVoskCore *core,
+                                gint alternatives)
+{
+  core->alternatives = alternatives;
+
+  if (core->recognizer)
+    vosk_recognizer_set_max_alternatives (core->recognizer, alternatives);
+  else
+    GST_LOG ("No recognizer to set num alternatives.");
+}
+
+void
+gst_vosk_core_set_rescoring (GstVoskCore *core,
+                             gdouble threshold,
+                             GstVoskCoreRevisedFunc func,
+                             gpointer user_data,
+                             GstVoskCoreRefFunc user_data_ref,
+                             GDestroyNotify user_data_unref)
+{
+  core->rescoring_threshold = threshold;
+  core->revised_func = func;
+  core->revised_data = user_data;
+  core->revised_data_ref = user_data_ref;
+  core->revised_data_unref = user_data_unref;
+}
+
+void
+gst_vosk_core_set_max_utterance_duration (GstVoskCore *core,
+                                          guint64 duration)
+{
+  core->max_utterance_duration = duration;
+}
+
+void
+gst_vosk_core_set_recycle_interval (GstVoskCore *core,
+                                    guint64 interval)
+{
+  core->recycle_interval = interval;
+}
+
+void
+gst_vosk_core_set_speculative_silence (GstVoskCore *core,
+                                       guint64 duration)
+{
+  core->speculative_silence = duration;
+}
+
+void
+gst_vosk_core_set_partial_interval (GstVoskCore *core,
+                                    gint64 interval)
+{
+  core->partial_interval = interval;
+}
+
+/* CPU time of the calling thread in nanoseconds */
+static guint64
+gst_vosk_core_thread_cpu_time (void)
+{
+#ifdef HAVE_CLOCK_THREAD_CPUTIME
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+    return GST_TIMESPEC_TO_TIME (ts);
+#endif
+
+  return 0;
+}
+
+/* Charges the CPU time spent since start to the stream and the utterance */
+static void
+gst_vosk_core_charge (GstVoskCore *core,
+                      guint64 start)
+{
+  guint64 now = gst_vosk_core_thread_cpu_time ();
+
+  if (now <= start)
+    return;
+
+  core->cpu_time += now - start;
+  core->utterance_cpu_time += now - start;
+}
+
+static guint64
+gst_vosk_core_samples_to_time (GstVoskCore *core,
+                               guint64 samples)
+{
+  if (core->rate <= 0.0)
+    return 0;
+
+  return gst_util_uint64_scale (samples, GST_SECOND, (guint64) core->rate);
+}
+
+static void
+gst_vosk_core_wake_recognizer_new (GstVoskCore *core)
+{
+  if (core->wake_recognizer) {
+    vosk_recognizer_free (core->wake_recognizer);
+    core->wake_recognizer = NULL;
+  }
+
+  g_byte_array_set_size (core->wake_audio, 0);
+  core->asleep_samples = 0;
+  core->awake = FALSE;
+
+  if (!core->wake_grammar || core->rate <= 0.0)
+    return;
+
+  GST_INFO ("creating wake recognizer (grammar %s).", core->wake_grammar);
+  core->wake_recognizer = vosk_recognizer_new_grm (core->model, core->rate, core->wake_grammar);
+  if (!core->wake_recognizer)
+    GST_WARNING ("could not create wake recognizer, cascade disabled.");
+}
+
+void
+gst_vosk_core_set_wake_phrases (GstVoskCore *core,
+                                const gchar * const *phrases,
+                                guint64 preroll)
+{
+  GString *grammar = NULL;
+  guint i;
+
+  core->wake_preroll = preroll;
+
+  if (phrases && phrases[0]) {
+    /* Anything else is recognized as unknown */
+    grammar = g_string_new ("[");
+    for (i = 0; phrases[i]; i++) {
+      gchar *escaped = g_strescape (phrases[i], NULL);
+
+      g_string_append_printf (grammar, "\"%s\", ", escaped);
+      g_free (escaped);
+    }
+    g_string_append (grammar, "\"[unk]\"]");
+  }
+
+  /* Configuration is applied again whenever a property changes */
+  if (!g_strcmp0 (grammar ? grammar->str : NULL, core->wake_grammar)) {
+    if (grammar)
+      g_string_free (grammar, TRUE);
+    return;
+  }
+
+  g_strfreev (core->wake_phrases);
+  core->wake_phrases = grammar ? g_strdupv ((gchar **) phrases) : NULL;
+  g_free (core->wake_grammar);
+  core->wake_grammar = grammar ? g_string_free (grammar, FALSE) : NULL;
+
+  if (core->recognizer)
+    gst_vosk_core_wake_recognizer_new (core);
+}
+
+gboolean
+gst_vosk_core_is_awake (GstVoskCore *core)
+{
+  return !core->wake_recognizer || core->awake;
+}
+
+static gboolean
+gst_vosk_core_recognizer_new (GstVoskCore *core)
+{
+  GST_INFO ("creating recognizer (rate = %f).", core->rate);
+  core->recognizer = vosk_recognizer_new (core->model, core->rate);
+  if (!core->recognizer)
+    return FALSE;
+
+  vosk_recognizer_set_max_alternatives (core->recognizer, core->alternatives);
+  core->recognizer_samples = 0;
+
+  g_array_set_size (core->gaps, 0);
+  core->gap_offset = 0;
+
+  /* Word confidences are needed to pick the utterances to rescore */
+  if (core->rescoring_model)
+    vosk_recognizer_set_words (core->recognizer, 1);
+
+  gst_vosk_core_wake_recognizer_new (core);
+  return TRUE;
+}
+
+gboolean
+gst_vosk_core_start (GstVoskCore *core,
+                     gfloat rate)
+{
+  if (rate <= 0.0) {
+    GST_INFO ("rate not set yet: no recognizer created.");
+    return FALSE;
+  }
+
+  if (core->recognizer) {
+    vosk_recognizer_free (core->recognizer);
+    core->recognizer = NULL;
+  }
+
+  core->rate = rate;
+  return gst_vosk_core_recognizer_new (core);
+}
+
+gboolean
+gst_vosk_core_is_started (GstVoskCore *core)
+{
+  return core->recognizer != NULL;
+}
+
+/* Shift of a time of the recognizer (seconds) on the timeline of the stream */
+static gint64
+gst_vosk_core_time_shift (gdouble time,
+                          gpointer user_data)
+{
+  GstVoskCore *core = user_data;
+  guint64 shift = core->gap_offset;
+  guint i;
+
+  for (i = 0; i < core->gaps->len; i++) {
+    GstVoskCoreGap *gap = &g_array_index (core->gaps, GstVoskCoreGap, i);
+
+    if (gap->position <= time * GST_SECOND)
+      shift += gap->duration;
+  }
+
+  return shift;
+}
+
+/* End of the audio decoded or skipped so far on the timeline of the stream */
+static guint64
+gst_vosk_core_position (GstVoskCore *core)
+{
+  guint64 position;
+  guint i;
+
+  position = core->gap_offset + gst_vosk_core_samples_to_time (core, core->recognizer_samples);
+  for (i = 0; i < core->gaps->len; i++)
+    position += g_array_index (core->gaps, GstVoskCoreGap, i).duration;
+
+  return position;
+}
+
+static GstVoskCoreResult *
+gst_vosk_core_result_new (GstVoskCore *core,
+                          GstVoskCoreResultType type,
+                          const gchar *json_txt)
+{
+  GstVoskCoreResult *result;
+
+  result = g_new0 (GstVoskCoreResult, 1);
+  result->type = type;
+  result->utterance_id = core->utterance_id;
+
+  /* A retraction repeats a result that was already shifted */
+  if (type != GST_VOSK_CORE_RESULT_RETRACTED &&
+      (core->gap_offset || core->gaps->len))
+    result->json = gst_vosk_result_shift_times (json_txt,
+                                                gst_vosk_core_time_shift,
+                                                core);
+  else
+    result->json = g_strdup (json_txt);
+  result->cpu_time = core->utterance_cpu_time;
+  return result;
+}
+
+void
+gst_vosk_core_result_free (GstVoskCoreResult *result)
+{
+  if (!result)
+    return;
+
+  g_free (result->json);
+  g_free (result);
+}
+
+/*
+ * Closes the current utterance: the audio retained for it is either handed
+ * to the rescorer (when the result has a low confidence) or dropped.
+ * json_txt is NULL when there was no result.
+ */
+static void
+gst_vosk_core_utterance_end (GstVoskCore *core,
+                             const gchar *json_txt)
+{
+  GByteArray *audio = core->utterance_audio;
+  guint i;
+
+  core->utterance_audio = NULL;
+
+  /* Alternatives have no word confidence (see gst_vosk_core_set_rescoring) */
+  if (audio && json_txt && core->revised_func && core->alternatives <= 0) {
+    gdouble confidence;
+
+    confidence = gst_vosk_result_confidence (json_txt);
+    if (confidence >= 0.0 && confidence < core->rescoring_threshold) {
+      guint64 start;
+
+      start = gst_vosk_core_samples_to_time (core,
+                                             core->recognizer_samples -
+                                             core->utterance_samples);
+      GST_DEBUG ("rescoring utterance %" G_GUINT64_FORMAT " (confidence %f)",
+                 core->utterance_id, confidence);
+      gst_vosk_rescorer_push (core->revised_func,
+                              core->revised_data_ref ?
+                              core->revised_data_ref (core->revised_data) :
+                              core->revised_data,
+                              core->revised_data_unref,
+                              core->rescoring_model,
+                              core->rate,
+                              core->alternatives,
+                              audio,
+                              core->utterance_id,
+                              start + gst_vosk_core_time_shift ((gdouble) start / GST_SECOND,
+                                                                core));
+      audio = NULL;
+    }
+  }
+
+  if (audio)
+    g_byte_array_unref (audio);
+
+  g_free (core->prev_partial);
+  core->prev_partial = NULL;
+
+  g_free (core->tentative);
+  core->tentative = NULL;
+
+  for (i = 0; i < core->gaps->len; i++)
+    core->gap_offset += g_array_index (core->gaps, GstVoskCoreGap, i).duration;
+  g_array_set_size (core->gaps, 0);
+
+  if (core->awake) {
+    GST_DEBUG ("utterance over, back to the wake recognizer");
+    vosk_recognizer_reset (core->wake_recognizer);
+    g_byte_array_set_size (core->wake_audio, 0);
+    core->awake = FALSE;
+  }
+
+  core->utterance_id++;
+  core->utterance_samples = 0;
+  core->utterance_cpu_time = 0;
+  core->utterance_energy = 0;
+  core->speech_energy = 0;
+  core->silence_samples = 0;
+  core->last_partial_samples = 0;
+}
+
+/*
+ * Must be called at an utterance boundary.
+ */
+static void
+gst_vosk_core_recycle (GstVoskCore *core)
+{
+  guint64 offset;
+
+  if (!core->recycle_interval || !core->recognizer)
+    return;
+
+  if (gst_vosk_core_samples_to_time (core, core->recognizer_samples) < core->recycle_interval)
+    return;
+
+  GST_INFO ("recycling recognizer");
+
+  /* The new recognizer times its words from 0: that is where the audio of
+   * this one and the gaps around it end on the timeline */
+  offset = gst_vosk_core_position (core);
+
+  vosk_recognizer_free (core->recognizer);
+  core->recognizer = NULL;
+  gst_vosk_core_recognizer_new (core);
+  core->gap_offset = offset;
+  core->recognizer_recycles++;
+}
+
+/* Returns the result of an utterance that just ended */
+static GstVoskCoreResult *
+gst_vosk_core_end_result (GstVoskCore *core,
+                          const gchar *json_txt)
+{
+  GstVoskCoreResult *result = NULL;
+
+  if (json_txt)
+    result = gst_vosk_core_result_new (core, GST_VOSK_CORE_RESULT_FINAL, json_txt);
+  else if (core->tentative)
+    result = gst_vosk_core_result_new (core, GST_VOSK_CORE_RESULT_RETRACTED, core->tentative);
+
+  gst_vosk_core_utterance_end (core, json_txt);
+  gst_vosk_core_recycle (core);
+  return result;
+}
+
+GstVoskCoreResult *
+gst_vosk_core_final_result (GstVoskCore *core)
+{
+  const gchar *json_txt;
+  guint64 start;
+
+  GST_INFO ("getting final result");
+
+  if (G_UNLIKELY(!core->recognizer)) {
+    GST_DEBUG ("no recognizer available");
+    return NULL;
+  }
+
+  start = gst_vosk_core_thread_cpu_time ();
+
+  {
+    PROTECT_FROM_LOCALE_BUG_START
+
+    json_txt = vosk_recognizer_final_result (core->recognizer);
+
+    PROTECT_FROM_LOCALE_BUG_END
+  }
+
+  gst_vosk_core_charge (core, start);
+
+  if (!json_txt ||
+      !strcmp(json_txt, VOSK_EMPTY_TEXT_RESULT) ||
+      !strcmp(json_txt, VOSK_EMPTY_TEXT_RESULT_ALT))
+    json_txt = NULL;
+
+  return gst_vosk_core_end_result (core, json_txt);
+}
+
+GstVoskCoreResult *
+gst_vosk_core_result (GstVoskCore *core)
+{
+  const gchar *json_txt;
+  guint64 start;
+
+  if (G_UNLIKELY(!core->recognizer)) {
+    GST_DEBUG ("no recognizer available");
+    return NULL;
+  }
+
+  start = gst_vosk_core_thread_cpu_time ();
+
+  {
+    PROTECT_FROM_LOCALE_BUG_START
+
+    json_txt = vosk_recognizer_result (core->recognizer);
+
+    PROTECT_FROM_LOCALE_BUG_END
+  }
+
+  gst_vosk_core_charge (core, start);
+
+  /* Don't return anything if empty */
+  if (!json_txt || !strcmp(json_txt, VOSK_EMPTY_TEXT_RESULT))
+    json_txt = NULL;
+
+  return gst_vosk_core_end_result (core, json_txt);
+}
+
+GstVoskCoreResult *
+gst_vosk_core_partial_result (GstVoskCore *core)
+{
+  const char *json_txt;
+  guint64 start;
+
+  if (G_UNLIKELY(!core->recognizer))
+    return NULL;
+
+  core->last_partial_samples = core->utterance_samples;
+
+  /* NOTE: surprisingly this function can return "text" results. Mute them if
+   * empty. */
+  start = gst_vosk_core_thread_cpu_time ();
+  json_txt = vosk_recognizer_partial_result (core->recognizer);
+  gst_vosk_core_charge (core, start);
+  if (!json_txt ||
+      !strcmp(json_txt, VOSK_EMPTY_PARTIAL_RESULT) ||
+      !strcmp(json_txt, VOSK_EMPTY_TEXT_RESULT_ALT))
+    return NULL;
+
+  /* To avoid returning results unnecessarily, make sure there is a change. */
+  if (g_strcmp0 (json_txt, core->prev_partial) == 0)
+    return NULL;
+
+  g_free (core->prev_partial);
+  core->prev_partial = g_strdup (json_txt);
+
+  return gst_vosk_core_result_new (core, GST_VOSK_CORE_RESULT_PARTIAL, json_txt);
+}
+
+GstVoskCoreResult *
+gst_vosk_core_tentative_result (GstVoskCore *core)
+{
+  GstVoskCoreResult *result;
+  const char *json_txt;
+  guint64 start;
+
+  if (G_UNLIKELY(!core->recognizer) || core->tentative)
+    return NULL;
+
+  start = gst_vosk_core_thread_cpu_time ();
+  json_txt = vosk_recognizer_partial_result (core->recognizer);
+  gst_vosk_core_charge (core, start);
+
+  /* There must have been speech before the silence */
+  if (!json_txt ||
+      !strcmp(json_txt, VOSK_EMPTY_PARTIAL_RESULT) ||
+      !strcmp(json_txt, VOSK_EMPTY_TEXT_RESULT_ALT))
+    return NULL;
+
+  GST_DEBUG ("tentative result for utterance %" G_GUINT64_FORMAT, core->utterance_id);
+
+  result = gst_vosk_core_result_new (core, GST_VOSK_CORE_RESULT_TENTATIVE, json_txt);
+  core->tentative = g_strdup (result->json);
+  return result;
+}
+
+GstVoskCoreResult *
+gst_vosk_core_retracted_result (GstVoskCore *core)
+{
+  GstVoskCoreResult *result;
+
+  if (!core->tentative)
+    return NULL;
+
+  GST_DEBUG ("retracting tentative result of utterance %" G_GUINT64_FORMAT, core->utterance_id);
+
+  result = gst_vosk_core_result_new (core, GST_VOSK_CORE_RESULT_RETRACTED, core->tentative);
+  g_free (core->tentative);
+  core->tentative = NULL;
+  return result;
+}
+
+GstVoskCoreStatus
+gst_vosk_core_skip (GstVoskCore *core,
+                    guint64 duration)
+{
+  GstVoskCoreGap gap;
+
+  if (G_UNLIKELY(!core->recognizer) || !duration)
+    return GST_VOSK_CORE_CONTINUE;
+
+  gap.position = gst_vosk_core_samples_to_time (core, core->recognizer_samples);
+  gap.duration = duration;
+  core->gap_duration += duration;
+
+  /* Between utterances, all the times to come are after it */
+  if (core->utterance_samples)
+    g_array_append_val (core->gaps, gap);
+  else
+    core->gap_offset += duration;
+
+  GST_DEBUG ("%" GST_TIME_FORMAT " of missing audio at %" GST_TIME_FORMAT,
+             GST_TIME_ARGS (duration), GST_TIME_ARGS (gap.position));
+
+  if (duration >= GAP_END_OF_UTTERANCE && core->utterance_samples)
+    return GST_VOSK_CORE_TOO_LONG;
+
+  return GST_VOSK_CORE_CONTINUE;
+}
+
+void
+gst_vosk_core_flush (GstVoskCore *core)
+{
+  if (core->recognizer)
+    vosk_recognizer_reset (core->recognizer);
+  else
+    GST_DEBUG ("no recognizer to flush");
+
+  gst_vosk_core_utterance_end (core, NULL);
+}
+
+static guint64
+gst_vosk_core_energy (const guint8 *data,
+                      gsize size)
+{
+  const gint16 *samples = (const gint16 *) data;
+  gsize num = size / sizeof (gint16);
+  guint64 energy = 0;
+  gsize i;
+
+  if (!num)
+    return 0;
+
+  for (i = 0; i < num; i++)
+    energy += ABS ((gint) samples[i]);
+
+  return energy / num;
+}
+
+/*
+ * Returns TRUE when the current utterance has lasted too long and should be
+ * ended now, ideally at a low energy point.
+ */
+static gboolean
+gst_vosk_core_utterance_too_long (GstVoskCore *core,
+                                  guint64 energy,
+                                  gsize samples)
+{
+  guint64 duration;
+  guint64 average;
+
+  if (!core->max_utterance_duration)
+    return FALSE;
+
+  duration = gst_vosk_core_samples_to_time (core, core->utterance_samples);
+  if (duration < core->max_utterance_duration) {
+    /* Running sum weighted by the number of samples */
+    core->utterance_energy += energy * samples;
+    return FALSE;
+  }
+
+  if (duration >= core->max_utterance_duration +
+                  FORCED_RESULT_MAX_DELAY (core->max_utterance_duration)) {
+    GST_DEBUG ("no low energy point found in time");
+    return TRUE;
+  }
+
+  average = core->utterance_energy / MAX (core->utterance_samples, 1);
+  return energy * FORCED_RESULT_ENERGY_RATIO <= average;
+}
+
+/*
+ * Follows the silence at the end of the utterance (buffers with a low energy
+ * compared with the speech before them).
+ */
+static GstVoskCoreStatus
+gst_vosk_core_speculate (GstVoskCore *core,
+                         guint64 energy,
+                         gsize samples)
+{
+  guint64 average;
+  gboolean was_short;
+  gboolean silent;
+
+  average = core->speech_energy / MAX (core->utterance_samples, 1);
+  silent = energy * SILENCE_ENERGY_RATIO <= average;
+
+  core->speech_energy += energy * samples;
+
+  if (!silent) {
+    core->silence_samples = 0;
+    return core->tentative ? GST_VOSK_CORE_RESUMED : GST_VOSK_CORE_CONTINUE;
+  }
+
+  /* Only once per silence, when it gets long enough */
+  was_short = gst_vosk_core_samples_to_time (core, core->silence_samples) < core->speculative_silence;
+  core->silence_samples += samples;
+  if (was_short && !core->tentative &&
+      gst_vosk_core_samples_to_time (core, core->silence_samples) >= core->speculative_silence)
+    return GST_VOSK_CORE_SILENCE;
+
+  return GST_VOSK_CORE_CONTINUE;
+}
+
+/* Returns TRUE if the text of member in json_txt holds a wake phrase */
+static gboolean
+gst_vosk_core_has_wake_phrase (GstVoskCore *core,
+                               const gchar *json_txt,
+                               const gchar *member)
+{
+  JsonParser *parser;
+  JsonObject *object;
+  const gchar *text;
+  gboolean found = FALSE;
+  guint i;
+
+  if (!json_txt)
+    return FALSE;
+
+  parser = json_parser_new ();
+  if (json_parser_load_from_data (parser, json_txt, -1, NULL) &&
+      JSON_NODE_HOLDS_OBJECT (json_parser_get_root (parser))) {
+    object = json_node_get_object (json_parser_get_root (parser));
+    text = json_object_has_member (object, member) ?
+           json_object_get_string_member (object, member) : NULL;
+
+    for (i = 0; text && core->wake_phrases[i] && !found; i++)
+      found = strstr (text, core->wake_phrases[i]) != NULL;
+  }
+
+  g_object_unref (parser);
+  return found;
+}
+
+/*
+ * Feeds the wake recognizer and keeps the last preroll of audio. found is set
+ * to TRUE once a wake phrase is heard.
+ */
+static GstVoskCoreStatus
+gst_vosk_core_wake (GstVoskCore *core,
+                    const guint8 *data,
+                    gsize size,
+                    gboolean *found)
+{
+  gsize preroll_size;
+  guint64 start;
+  int result;
+
+  preroll_size = gst_util_uint64_scale (core->wake_preroll, (guint64) core->rate, GST_SECOND) *
+                 sizeof (gint16);
+
+  /* The buffer holding the wake phrase is always decoded again */
+  preroll_size = MAX (preroll_size, size);
+
+  g_byte_array_append (core->wake_audio, data, size);
+  core->asleep_samples += size / sizeof (gint16);
+
+  /* Trimmed by large chunks rather than at every buffer */
+  if (core->wake_audio->len > preroll_size * 2)
+    g_byte_array_remove_range (core->wake_audio, 0, core->wake_audio->len - preroll_size);
+
+  start = gst_vosk_core_thread_cpu_time ();
+
+  result = vosk_recognizer_accept_waveform (core->wake_recognizer, (const gchar *) data, size);
+  if (result == -1) {
+    gst_vosk_core_charge (core, start);
+    GST_ERROR ("accept_waveform error in wake recognizer");
+    return GST_VOSK_CORE_ERROR;
+  }
+
+  {
+    PROTECT_FROM_LOCALE_BUG_START
+
+    if (result == 1)
+      *found = gst_vosk_core_has_wake_phrase (core, vosk_recognizer_result (core->wake_recognizer), "text");
+    else
+      *found = gst_vosk_core_has_wake_phrase (core, vosk_recognizer_partial_result (core->wake_recognizer), "partial");
+
+    PROTECT_FROM_LOCALE_BUG_END
+  }
+
+  gst_vosk_core_charge (core, start);
+  return GST_VOSK_CORE_CONTINUE;
+}
+
+GstVoskCoreStatus
+gst_vosk_core_accept_waveform (GstVoskCore *core,
+                               const guint8 *data,
+                               gsize size)
+{
+  GstVoskCoreStatus status = GST_VOSK_CORE_CONTINUE;
+  guint64 energy = 0;
+  guint64 start;
+  gsize samples;
+  int result;
+
+  if (G_UNLIKELY(!core->recognizer))
+    return GST_VOSK_CORE_ERROR;
+
+  if (G_UNLIKELY(size == 0))
+    return GST_VOSK_CORE_CONTINUE;
+
+  if (core->wake_recognizer && !core->awake) {
+    GstVoskCoreGap gap;
+    guint64 preroll_samples;
+    gboolean found = FALSE;
+
+    if (gst_vosk_core_wake (core, data, size, &found) == GST_VOSK_CORE_ERROR)
+      return GST_VOSK_CORE_ERROR;
+
+    if (!found)
+      return GST_VOSK_CORE_CONTINUE;
+
+    GST_DEBUG ("wake phrase heard, decoding %u bytes of preroll", core->wake_audio->len);
+
+    vosk_recognizer_reset (core->wake_recognizer);
+    core->awake = TRUE;
+
+    /* The full recognizer did not hear what came before the preroll: it is
+     * a gap for the times of its words */
+    preroll_samples = core->wake_audio->len / sizeof (gint16);
+    if (core->asleep_samples > preroll_samples) {
+      gap.position = gst_vosk_core_samples_to_time (core, core->recognizer_samples);
+      gap.duration = gst_vosk_core_samples_to_time (core, core->asleep_samples - preroll_samples);
+      g_array_append_val (core->gaps, gap);
+    }
+    core->asleep_samples = 0;
+
+    /* The preroll holds this buffer */
+    data = core->wake_audio->data;
+    size = core->wake_audio->len;
+  }
+
+  start = gst_vosk_core_thread_cpu_time ();
+  result = vosk_recognizer_accept_waveform (core->recognizer,
+                                            (const gchar *) data,
+                                            size);
+  gst_vosk_core_charge (core, start);
+  if (result == -1) {
+    GST_ERROR ("accept_waveform error");
+    return GST_VOSK_CORE_ERROR;
+  }
+
+  /* Keep the audio of the utterance in case it needs rescoring */
+  if (core->rescoring_model && core->revised_func) {
+    if (!core->utterance_audio)
+      core->utterance_audio = g_byte_array_new ();
+
+    g_byte_array_append (core->utterance_audio, data, size);
+  }
+
+  if (core->max_utterance_duration || core->speculative_silence)
+    energy = gst_vosk_core_energy (data, size);
+
+  samples = size / sizeof (gint16);
+
+  if (core->speculative_silence)
+    status = gst_vosk_core_speculate (core, energy, samples);
+  core->utterance_samples += samples;
+  core->recognizer_samples += samples;
+
+  if (result == 1)
+    return GST_VOSK_CORE_ENDPOINT;
+
+  /* In continuous streams (music, noise), the endpointer may never fire. */
+  if (gst_vosk_core_utterance_too_long (core, energy, samples)) {
+    GST_INFO ("utterance too long, forcing final result");
+    core->forced_results++;
+    return GST_VOSK_CORE_TOO_LONG;
+  }
+
+  return status;
+}
+
+gboolean
+gst_vosk_core_feed (GstVoskCore *core,
+                    const gint16 *pcm,
+                    gsize num_samples)
+{
+  GstVoskCoreResult *result = NULL;
+  GstVoskCoreStatus status;
+  guint64 elapsed;
+
+  status = gst_vosk_core_accept_waveform (core,
+                                          (const guint8 *) pcm,
+                                          num_samples * sizeof (gint16));
+  switch (status) {
+    case GST_VOSK_CORE_ERROR:
+      return FALSE;
+
+    case GST_VOSK_CORE_ENDPOINT:
+      result = gst_vosk_core_result (core);
+      break;
+
+    case GST_VOSK_CORE_TOO_LONG:
+      result = gst_vosk_core_final_result (core);
+      break;
+
+    case GST_VOSK_CORE_SILENCE:
+      result = gst_vosk_core_tentative_result (core);
+      break;
+
+    case GST_VOSK_CORE_RESUMED:
+      result = gst_vosk_core_retracted_result (core);
+      break;
+
+    case GST_VOSK_CORE_CONTINUE:
+      /* The full recognizer has nothing to say while it is asleep */
+      if (core->partial_interval < 0 || !gst_vosk_core_is_awake (core))
+        break;
+
+      elapsed = gst_vosk_core_samples_to_time (core,
+                                               core->utterance_samples -
+                                               core->last_partial_samples);
+      if (elapsed > (guint64) core->partial_interval)
+        result = gst_vosk_core_partial_result (core);
+      break;
+  }
+
+  if (result)
+    g_queue_push_tail (&core->results, result);
+
+  return TRUE;
+}
+
+void
+gst_vosk_core_finish (GstVoskCore *core)
+{
+  GstVoskCoreResult *result;
+
+  result = gst_vosk_core_final_result (core);
+  if (result)
+    g_queue_push_tail (&core->results, result);
+}
+
+GstVoskCoreResult *
+gst_vosk_core_pop_result (GstVoskCore *core)
+{
+  return g_queue_pop_head (&core->results);
+}
+
+void
+gst_vosk_core_get_stats (GstVoskCore *core,
+                         GstVoskCoreStats *stats)
+{
+  stats->utterance_duration = gst_vosk_core_samples_to_time (core, core->utterance_samples);
+  stats->recognizer_audio_duration = gst_vosk_core_samples_to_time (core, core->recognizer_samples);
+  stats->retained_audio_bytes = core->utterance_audio ? core->utterance_audio->len : 0;
+  stats->forced_results = core->forced_results;
+  stats->recognizer_recycles = core->recognizer_recycles;
+  stats->cpu_time = core->cpu_time;
+  stats->utterance_cpu_time = core->utterance_cpu_time;
+  stats->gap_duration = core->gap_duration;
+  stats->position = gst_vosk_core_position (core);
+}
+
+guint64
+gst_vosk_core_take_utterance_id (GstVoskCore *core)
+{
+  return core->utterance_id++;
+}
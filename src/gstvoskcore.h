@@ -0,0 +1,257 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GST_VOSK_CORE_H__
+#define __GST_VOSK_CORE_H__
+
+#include <glib.h>
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Speech recognition on raw PCM (signed 16 bits, mono, native endianness),
+ * without pads, caps or bus. This is what the vosk element is built on.
+ *
+ * A GstVoskCore is not thread safe: calls on one object must be serialized.
+ * Models are shared with every other GstVoskCore (and vosk element) of the
+ * process that uses the same paths.
+ *
+ *   core = gst_vosk_core_new ("/path/to/model", NULL);
+ *   gst_vosk_core_start (core, 16000);
+ *   while (read_pcm (&pcm, &num_samples)) {
+ *     gst_vosk_core_feed (core, pcm, num_samples);
+ *     while ((result = gst_vosk_core_pop_result (core))) {
+ *       ... result->json ...
+ *       gst_vosk_core_result_free (result);
+ *     }
+ *   }
+ *   gst_vosk_core_finish (core);
+ */
+
+typedef struct _GstVoskCore GstVoskCore;
+
+typedef enum {
+  GST_VOSK_CORE_RESULT_PARTIAL,
+  GST_VOSK_CORE_RESULT_FINAL,
+  GST_VOSK_CORE_RESULT_TENTATIVE,   /* partial result taken as final after a short silence */
+  GST_VOSK_CORE_RESULT_RETRACTED,   /* the tentative result of the utterance is void */
+} GstVoskCoreResultType;
+
+typedef struct {
+  GstVoskCoreResultType  type;
+  guint64                utterance_id;
+  gchar                 *json;
+  guint64                cpu_time;     /* nanoseconds spent on the utterance so far */
+} GstVoskCoreResult;
+
+typedef enum {
+  GST_VOSK_CORE_ERROR = -1,
+  GST_VOSK_CORE_CONTINUE = 0,
+  GST_VOSK_CORE_ENDPOINT = 1,      /* a result is ready */
+  GST_VOSK_CORE_TOO_LONG = 2,      /* a final result should be forced now */
+  GST_VOSK_CORE_SILENCE = 3,       /* a tentative result can be given */
+  GST_VOSK_CORE_RESUMED = 4,       /* speech resumed after a tentative result */
+} GstVoskCoreStatus;
+
+typedef struct {
+  guint64 utterance_duration;         /* nanoseconds */
+  guint64 recognizer_audio_duration;  /* nanoseconds */
+  guint64 retained_audio_bytes;
+  guint64 forced_results;
+  guint64 recognizer_recycles;
+
+  /* Thread CPU time spent in libvosk (decoding and getting results), in
+   * nanoseconds, 0 where the platform cannot measure it */
+  guint64 cpu_time;
+  guint64 utterance_cpu_time;
+
+  guint64 gap_duration;               /* nanoseconds, see gst_vosk_core_skip () */
+
+  /* End of the audio decoded or skipped so far on the timeline word times
+   * are given on, in nanoseconds */
+  guint64 position;
+} GstVoskCoreStats;
+
+typedef gpointer (*GstVoskCoreRefFunc) (gpointer user_data);
+
+/* Called from a rescoring thread with a better result for an utterance */
+typedef void (*GstVoskCoreRevisedFunc) (gpointer user_data,
+                                        guint64 utterance_id,
+                                        const gchar *json_result);
+
+/*
+ * A loaded speech model, refcounted, to create cores with or to hand to vosk
+ * elements (field "model" of a "vosk-model" GstContext). Shared models are
+ * the ones the process finds by path (gst_vosk_core_new () uses them), the
+ * others are a separate instance only used where they are given.
+ */
+typedef struct _GstVoskModel GstVoskModel;
+
+#define GST_TYPE_VOSK_MODEL (gst_vosk_model_get_type ())
+
+GType gst_vosk_model_get_type (void);
+
+/* Can take a long time. Returns NULL if path cannot be loaded. */
+GstVoskModel *gst_vosk_model_new (const gchar *path,
+                                  gboolean shared);
+
+GstVoskModel *gst_vosk_model_ref (GstVoskModel *model);
+
+void gst_vosk_model_unref (GstVoskModel *model);
+
+const gchar *gst_vosk_model_get_path (GstVoskModel *model);
+
+/* Loads (or finds in cache) the models: this can take a long time.
+ * rescoring_model_path is optional. Returns NULL if model_path cannot be
+ * loaded. */
+GstVoskCore *gst_vosk_core_new (const gchar *model_path,
+                                const gchar *rescoring_model_path);
+
+/* Same as gst_vosk_core_new () with an already loaded model */
+GstVoskCore *gst_vosk_core_new_for_model (GstVoskModel *model,
+                                          const gchar *rescoring_model_path);
+
+void gst_vosk_core_free (GstVoskCore *core);
+
+gboolean gst_vosk_core_has_rescoring (GstVoskCore *core);
+
+void gst_vosk_core_set_alternatives (GstVoskCore *core,
+                                     gint alternatives);
+
+/*
+ * Utterances whose word confidence is below threshold are decoded again with
+ * the rescoring model, in the background. Results with alternatives have no
+ * word confidence: nothing is rescored while alternatives are set.
+ * user_data must outlive core, each pending rescoring holds a reference on
+ * it (when user_data_ref is set). The words of revised results are timed
+ * like those of the other results.
+ */
+void gst_vosk_core_set_rescoring (GstVoskCore *core,
+                                  gdouble threshold,
+                                  GstVoskCoreRevisedFunc func,
+                                  gpointer user_data,
+                                  GstVoskCoreRefFunc user_data_ref,
+                                  GDestroyNotify user_data_unref);
+
+/* Durations in nanoseconds, 0 for no limit */
+void gst_vosk_core_set_max_utterance_duration (GstVoskCore *core,
+                                               guint64 duration);
+
+void gst_vosk_core_set_recycle_interval (GstVoskCore *core,
+                                         guint64 interval);
+
+/*
+ * Once an utterance is followed by that much silence (nanoseconds), well
+ * before the endpointer of libvosk ends it, its partial result is given as a
+ * tentative final result. It is either confirmed by the final result of the
+ * utterance (same utterance id) or retracted if speech resumes. 0 disables.
+ */
+void gst_vosk_core_set_speculative_silence (GstVoskCore *core,
+                                            guint64 duration);
+
+/*
+ * Cascade mode: until one of phrases is heard, audio is only decoded by a
+ * small grammar recognizer. The last preroll nanoseconds of audio (which hold
+ * the phrase) are then decoded by the full recognizer, which goes on until
+ * the end of the utterance. NULL phrases disables it.
+ */
+void gst_vosk_core_set_wake_phrases (GstVoskCore *core,
+                                     const gchar * const *phrases,
+                                     guint64 preroll);
+
+gboolean gst_vosk_core_is_awake (GstVoskCore *core);
+
+/* Only used by gst_vosk_core_feed (), -1 to disable partial results */
+void gst_vosk_core_set_partial_interval (GstVoskCore *core,
+                                         gint64 interval);
+
+/* Creates the recognizer for audio at rate */
+gboolean gst_vosk_core_start (GstVoskCore *core,
+                              gfloat rate);
+
+gboolean gst_vosk_core_is_started (GstVoskCore *core);
+
+/*
+ * Simple API: decodes audio and queues the results (partial results at most
+ * every partial interval of audio, final results at each utterance end).
+ */
+gboolean gst_vosk_core_feed (GstVoskCore *core,
+                             const gint16 *pcm,
+                             gsize num_samples);
+
+/* Queues the final result of the audio fed so far */
+void gst_vosk_core_finish (GstVoskCore *core);
+
+GstVoskCoreResult *gst_vosk_core_pop_result (GstVoskCore *core);
+
+/*
+ * Step by step API, for callers that decide when to get results.
+ * Functions returning a result return NULL when there is none (or when a
+ * partial result did not change).
+ */
+GstVoskCoreStatus gst_vosk_core_accept_waveform (GstVoskCore *core,
+                                                 const guint8 *data,
+                                                 gsize size);
+
+GstVoskCoreResult *gst_vosk_core_result (GstVoskCore *core);
+
+GstVoskCoreResult *gst_vosk_core_final_result (GstVoskCore *core);
+
+GstVoskCoreResult *gst_vosk_core_partial_result (GstVoskCore *core);
+
+/* After GST_VOSK_CORE_SILENCE and GST_VOSK_CORE_RESUMED respectively.
+ * The final result of an utterance ending without text is a retraction if
+ * a tentative result was given. */
+GstVoskCoreResult *gst_vosk_core_tentative_result (GstVoskCore *core);
+
+GstVoskCoreResult *gst_vosk_core_retracted_result (GstVoskCore *core);
+
+/*
+ * Accounts for duration nanoseconds of missing audio (packet loss, GAP) that
+ * are not decoded. Word times of later results still match the timeline.
+ * Returns GST_VOSK_CORE_TOO_LONG when the gap is long enough to end the
+ * current utterance: a final result should be taken now.
+ */
+GstVoskCoreStatus gst_vosk_core_skip (GstVoskCore *core,
+                                      guint64 duration);
+
+/* Drops the current utterance */
+void gst_vosk_core_flush (GstVoskCore *core);
+
+/*
+ * Returns an utterance id for an utterance recognized elsewhere (the results
+ * of another stream with the same audio): the utterances of the core come
+ * after it. MUST be called between utterances.
+ */
+guint64 gst_vosk_core_take_utterance_id (GstVoskCore *core);
+
+void gst_vosk_core_get_stats (GstVoskCore *core,
+                              GstVoskCoreStats *stats);
+
+void gst_vosk_core_result_free (GstVoskCoreResult *result);
+
+/* Encodes a result (its JSON) in the compact layout of gstvoskresult.h,
+ * which libgstvoskresult decodes. Returns NULL if json_result is not a
+ * result of libvosk. */
+GBytes *gst_vosk_result_encode (const gchar *json_result);
+
+G_END_DECLS
+
+#endif /* __GST_VOSK_CORE_H__ */
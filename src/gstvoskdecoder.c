@@ -0,0 +1,238 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "../gst-vosk-config.h"
+
+#ifdef HAVE_OPUS
+#include <opus.h>
+#endif
+
+#include "gstvoskdecoder.h"
+#include "gstvoskg711.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_vosk_debug);
+#define GST_CAT_DEFAULT gst_vosk_debug
+
+/* Opus decodes at any of its rates directly: pick the one of most models */
+#define OPUS_DECODE_RATE 16000
+
+/* Longest Opus packet */
+#define OPUS_MAX_PACKET_DURATION (120 * GST_MSECOND)
+
+typedef enum {
+  GST_VOSK_DECODER_MULAW,
+  GST_VOSK_DECODER_ALAW,
+  GST_VOSK_DECODER_OPUS,
+} GstVoskDecoderType;
+
+struct _GstVoskDecoder {
+  GstVoskDecoderType  type;
+  gint                rate;
+
+#ifdef HAVE_OPUS
+  OpusDecoder        *opus;
+#endif
+};
+
+gint
+gst_vosk_decoder_caps_rate (const GstStructure *caps)
+{
+  gint rate = 0;
+
+  if (gst_structure_has_name (caps, "audio/x-opus"))
+    return OPUS_DECODE_RATE;
+
+  gst_structure_get_int (caps, "rate", &rate);
+  return rate;
+}
+
+GstVoskDecoder *
+gst_vosk_decoder_new (const GstStructure *caps)
+{
+  GstVoskDecoder *decoder;
+
+  if (gst_structure_has_name (caps, "audio/x-raw"))
+    return NULL;
+
+  decoder = g_new0 (GstVoskDecoder, 1);
+  decoder->rate = gst_vosk_decoder_caps_rate (caps);
+
+  if (gst_structure_has_name (caps, "audio/x-mulaw"))
+    decoder->type = GST_VOSK_DECODER_MULAW;
+  else if (gst_structure_has_name (caps, "audio/x-alaw"))
+    decoder->type = GST_VOSK_DECODER_ALAW;
+#ifdef HAVE_OPUS
+  else if (gst_structure_has_name (caps, "audio/x-opus")) {
+    int error = OPUS_OK;
+
+    /* Stereo streams are downmixed by libopus */
+    decoder->type = GST_VOSK_DECODER_OPUS;
+    decoder->opus = opus_decoder_create (decoder->rate, 1, &error);
+    if (error != OPUS_OK) {
+      GST_ERROR ("could not create Opus decoder (%s).", opus_strerror (error));
+      g_free (decoder);
+      return NULL;
+    }
+  }
+#endif
+  else {
+    GST_ERROR ("%s cannot be decoded.", gst_structure_get_name (caps));
+    g_free (decoder);
+    return NULL;
+  }
+
+  if (decoder->rate <= 0) {
+    GST_ERROR ("no rate in the capabilities.");
+    gst_vosk_decoder_free (decoder);
+    return NULL;
+  }
+
+  return decoder;
+}
+
+void
+gst_vosk_decoder_free (GstVoskDecoder *decoder)
+{
+  if (!decoder)
+    return;
+
+#ifdef HAVE_OPUS
+  if (decoder->opus)
+    opus_decoder_destroy (decoder->opus);
+#endif
+
+  g_free (decoder);
+}
+
+gint
+gst_vosk_decoder_get_rate (GstVoskDecoder *decoder)
+{
+  return decoder->rate;
+}
+
+void
+gst_vosk_decoder_reset (GstVoskDecoder *decoder)
+{
+  if (!decoder)
+    return;
+
+  /* G.711 has no state */
+#ifdef HAVE_OPUS
+  if (decoder->opus)
+    opus_decoder_ctl (decoder->opus, OPUS_RESET_STATE);
+#endif
+}
+
+static guint64
+gst_vosk_decoder_num_samples (GstVoskDecoder *decoder,
+                              const guint8 *data,
+                              gsize size)
+{
+#ifdef HAVE_OPUS
+  if (decoder->type == GST_VOSK_DECODER_OPUS) {
+    int samples = opus_packet_get_nb_samples (data, size, decoder->rate);
+
+    return samples > 0 ? samples : 0;
+  }
+#endif
+
+  /* G.711: one byte per sample */
+  return size;
+}
+
+GstClockTime
+gst_vosk_decoder_get_duration (GstVoskDecoder *decoder,
+                               GstBuffer *buf)
+{
+  GstMapInfo info;
+  guint64 samples;
+
+  if (!gst_buffer_map (buf, &info, GST_MAP_READ))
+    return 0;
+
+  samples = gst_vosk_decoder_num_samples (decoder, info.data, info.size);
+  gst_buffer_unmap (buf, &info);
+
+  return gst_util_uint64_scale (samples, GST_SECOND, decoder->rate);
+}
+
+GstBuffer *
+gst_vosk_decoder_decode (GstVoskDecoder *decoder,
+                         GstBuffer *buf)
+{
+  GstMapInfo in, out;
+  GstBuffer *pcm;
+  gint16 *samples;
+  gsize num_samples, i;
+
+  if (!gst_buffer_map (buf, &in, GST_MAP_READ))
+    return NULL;
+
+  if (decoder->type == GST_VOSK_DECODER_OPUS)
+    num_samples = gst_util_uint64_scale (OPUS_MAX_PACKET_DURATION, decoder->rate, GST_SECOND);
+  else
+    num_samples = in.size;
+
+  pcm = gst_buffer_new_allocate (NULL, num_samples * sizeof (gint16), NULL);
+  gst_buffer_map (pcm, &out, GST_MAP_WRITE);
+  samples = (gint16 *) out.data;
+
+  switch (decoder->type) {
+    case GST_VOSK_DECODER_MULAW:
+      for (i = 0; i < num_samples; i++)
+        samples[i] = gst_vosk_mulaw_decode (in.data[i]);
+      break;
+
+    case GST_VOSK_DECODER_ALAW:
+      for (i = 0; i < num_samples; i++)
+        samples[i] = gst_vosk_alaw_decode (in.data[i]);
+      break;
+
+    case GST_VOSK_DECODER_OPUS:
+#ifdef HAVE_OPUS
+    {
+      int decoded;
+
+      decoded = opus_decode (decoder->opus, in.data, in.size, samples, num_samples, 0);
+      if (decoded < 0) {
+        GST_WARNING ("could not decode Opus packet (%s).", opus_strerror (decoded));
+        decoded = 0;
+      }
+
+      num_samples = decoded;
+    }
+#endif
+      break;
+  }
+
+  gst_buffer_unmap (pcm, &out);
+  gst_buffer_unmap (buf, &in);
+
+  if (!num_samples) {
+    gst_buffer_unref (pcm);
+    return NULL;
+  }
+
+  gst_buffer_set_size (pcm, num_samples * sizeof (gint16));
+  gst_buffer_copy_into (pcm, buf, GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS, 0, -1);
+  GST_BUFFER_DURATION (pcm) = gst_util_uint64_scale (num_samples, GST_SECOND, decoder->rate);
+  GST_BUFFER_OFFSET (pcm) = GST_BUFFER_OFFSET_NONE;
+  GST_BUFFER_OFFSET_END (pcm) = GST_BUFFER_OFFSET_NONE;
+  return pcm;
+}
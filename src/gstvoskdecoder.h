@@ -0,0 +1,59 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GST_VOSK_DECODER_H__
+#define __GST_VOSK_DECODER_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Decodes the encoded formats the sink pad accepts (G.711, Opus when built
+ * with libopus) to the S16LE mono the recognizer wants, so that the encoded
+ * buffers themselves can go downstream untouched.
+ */
+typedef struct _GstVoskDecoder GstVoskDecoder;
+
+/* Returns NULL for raw audio (there is nothing to decode) */
+GstVoskDecoder *gst_vosk_decoder_new (const GstStructure *caps);
+
+void gst_vosk_decoder_free (GstVoskDecoder *decoder);
+
+/* Rate of the decoded audio or 0 if caps are not complete */
+gint gst_vosk_decoder_caps_rate (const GstStructure *caps);
+
+gint gst_vosk_decoder_get_rate (GstVoskDecoder *decoder);
+
+/* Forgets the state kept from the previous buffers (after a flush or lost
+ * packets), so that it does not leak into the next ones */
+void gst_vosk_decoder_reset (GstVoskDecoder *decoder);
+
+/* Duration of an encoded buffer, without decoding it */
+GstClockTime gst_vosk_decoder_get_duration (GstVoskDecoder *decoder,
+                                            GstBuffer *buf);
+
+/* Returns a new buffer with the timestamps and the flags of buf, NULL if buf
+ * cannot be decoded */
+GstBuffer *gst_vosk_decoder_decode (GstVoskDecoder *decoder,
+                                    GstBuffer *buf);
+
+G_END_DECLS
+
+#endif /* __GST_VOSK_DECODER_H__ */
@@ -0,0 +1,582 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "gstvoskduplicate.h"
+#include "gstvoskrescorer.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_vosk_debug);
+#define GST_CAT_DEFAULT gst_vosk_debug
+
+#define FRAME_DURATION (10 * GST_MSECOND)
+
+/* Each bit compares the energy of the last 4 frames with that of the 4 frames
+ * before: that is what keeps streams whose frames are not aligned similar */
+#define ENERGY_FRAMES 4
+
+/* Fingerprint bits kept by stream */
+#define FINGERPRINT_FRAMES 512
+
+/* Two streams match when they differ on at most 25% of 2 s of frames (50%
+ * for unrelated audio)... */
+#define MATCH_FRAMES 200
+#define MATCH_MAX_ERRORS (MATCH_FRAMES / 4)
+
+/* ...and keep matching on 3 checks, every half second */
+#define CHECK_FRAMES 50
+#define CONFIRMATIONS 3
+
+/* They diverge when they differ on more than 30% of the last second */
+#define DIVERGE_FRAMES 100
+#define DIVERGE_MAX_ERRORS (DIVERGE_FRAMES * 3 / 10)
+#define DIVERGE_CHECK_FRAMES 10
+
+/* The streams are not aligned on frames: allow a shift that small to drift */
+#define DRIFT_FRAMES 2
+
+/* Results waiting for a stream that does not pop them: the oldest are
+ * dropped */
+#define MAX_SHARED 64
+
+typedef struct {
+  guint8             bits[FINGERPRINT_FRAMES];
+  guint64            frames;
+
+  /* End of the last frame on the timeline of the stream */
+  GstClockTime       position;
+} GstVoskFingerprint;
+
+/* Copy of the fingerprint of a stream, compared outside the registry lock */
+typedef struct {
+  GstVoskDuplicate  *duplicate;
+  GstVoskFingerprint fingerprint;
+} GstVoskSnapshot;
+
+struct _GstVoskDuplicate {
+  /* Written by the streaming thread of the stream with registry lock held,
+   * read by the others with registry lock held */
+  GstVoskFingerprint fingerprint;
+
+  /* Frame being computed and the energies of the last ones, only used by the
+   * streaming thread of the stream */
+  gdouble            energy;
+  guint              frame_samples;
+  guint              frame_size;
+  gdouble            energies[2 * ENERGY_FRAMES];
+  guint64            energy_frames;
+
+  gint               tolerance;       /* in frames */
+  guint64            next_check;
+
+  /* The stream being confirmed and the one this one duplicates, with the
+   * shift of their frames (protected by registry lock) */
+  GstVoskDuplicate  *candidate;
+  gint               candidate_shift;
+  guint              confirmations;
+
+  GstVoskDuplicate  *leader;
+  gint               shift;
+
+  /* What to add to the times of the leader to put them on the timeline of
+   * this stream (protected by registry lock) */
+  GstClockTimeDiff   offset;
+
+  GAsyncQueue       *shared;
+};
+
+static GList *registry = NULL;
+G_LOCK_DEFINE_STATIC (registry);
+
+GstVoskDuplicate *
+gst_vosk_duplicate_register (GstClockTime tolerance)
+{
+  GstVoskDuplicate *duplicate;
+
+  duplicate = g_new0 (GstVoskDuplicate, 1);
+  duplicate->tolerance = tolerance / FRAME_DURATION;
+  duplicate->shared = g_async_queue_new_full ((GDestroyNotify) gst_structure_free);
+
+  G_LOCK (registry);
+  registry = g_list_prepend (registry, duplicate);
+  G_UNLOCK (registry);
+
+  return duplicate;
+}
+
+void
+gst_vosk_duplicate_unregister (GstVoskDuplicate *duplicate)
+{
+  GList *iter;
+
+  if (!duplicate)
+    return;
+
+  G_LOCK (registry);
+  registry = g_list_remove (registry, duplicate);
+  for (iter = registry; iter; iter = iter->next) {
+    GstVoskDuplicate *other = iter->data;
+
+    if (other->leader == duplicate)
+      other->leader = NULL;
+
+    if (other->candidate == duplicate) {
+      other->candidate = NULL;
+      other->confirmations = 0;
+    }
+  }
+  G_UNLOCK (registry);
+
+  g_async_queue_unref (duplicate->shared);
+  g_free (duplicate);
+}
+
+/*
+ * Returns the bit of the frame that came offset frames before the last one or
+ * -1 if it is not known (any more).
+ */
+static gint
+gst_vosk_duplicate_bit (const GstVoskFingerprint *fingerprint,
+                        gint64 offset)
+{
+  if (offset < 0 ||
+      offset >= FINGERPRINT_FRAMES ||
+      (guint64) offset >= fingerprint->frames)
+    return -1;
+
+  return fingerprint->bits[(fingerprint->frames - 1 - offset) % FINGERPRINT_FRAMES];
+}
+
+/*
+ * Number of frames that differ among count frames of a and b, when the frames
+ * of b are shift frames ahead of those of a (behind if negative). G_MAXUINT if
+ * some are missing.
+ */
+static guint
+gst_vosk_duplicate_errors (const GstVoskFingerprint *a,
+                           const GstVoskFingerprint *b,
+                           gint shift,
+                           guint count)
+{
+  gint64 offset_a = MAX (0, -shift);
+  gint64 offset_b = MAX (0, shift);
+  guint errors = 0;
+  guint i;
+
+  for (i = 0; i < count; i++) {
+    gint bit_a = gst_vosk_duplicate_bit (a, offset_a + i);
+    gint bit_b = gst_vosk_duplicate_bit (b, offset_b + i);
+
+    if (bit_a < 0 || bit_b < 0)
+      return G_MAXUINT;
+
+    if (bit_a != bit_b)
+      errors++;
+  }
+
+  return errors;
+}
+
+static guint
+gst_vosk_duplicate_best_shift (const GstVoskFingerprint *a,
+                               const GstVoskFingerprint *b,
+                               gint min_shift,
+                               gint max_shift,
+                               guint count,
+                               gint *best_shift)
+{
+  guint best = G_MAXUINT;
+  gint shift;
+
+  for (shift = min_shift; shift <= max_shift; shift++) {
+    guint errors = gst_vosk_duplicate_errors (a, b, shift, count);
+
+    if (errors < best) {
+      best = errors;
+      *best_shift = shift;
+    }
+  }
+
+  return best;
+}
+
+/*
+ * Digital silence or a steady tone give the same bits whatever the stream:
+ * only audio that varies can be told apart.
+ */
+static gboolean
+gst_vosk_duplicate_is_active (const GstVoskFingerprint *fingerprint)
+{
+  guint ones = 0;
+  guint i;
+
+  for (i = 0; i < MATCH_FRAMES; i++)
+    ones += gst_vosk_duplicate_bit (fingerprint, i) == 1;
+
+  return ones >= MATCH_FRAMES / 4 && ones <= MATCH_FRAMES * 3 / 4;
+}
+
+/*
+ * MUST be called with registry lock held
+ */
+static gboolean
+gst_vosk_duplicate_is_leader (GstVoskDuplicate *duplicate)
+{
+  GList *iter;
+
+  for (iter = registry; iter; iter = iter->next) {
+    if (((GstVoskDuplicate *) iter->data)->leader == duplicate)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+/*
+ * A frame of a is shift frames ahead of the frame of b it matches: their
+ * times differ by as much, plus the distance between the ends of a and b.
+ */
+static GstClockTimeDiff
+gst_vosk_duplicate_offset (const GstVoskFingerprint *a,
+                           const GstVoskFingerprint *b,
+                           gint shift)
+{
+  return GST_CLOCK_DIFF (b->position, a->position) + shift * (GstClockTimeDiff) FRAME_DURATION;
+}
+
+/*
+ * The fingerprints are copied with registry lock held and compared once it
+ * is released: comparing them costs (2 * tolerance + 1) * MATCH_FRAMES by
+ * stream, which would serialize the streaming threads of all the streams.
+ */
+static void
+gst_vosk_duplicate_find_leader (GstVoskDuplicate *duplicate)
+{
+  GstVoskSnapshot *snapshots;
+  GstVoskDuplicate *best = NULL;
+  GstClockTimeDiff best_offset = 0;
+  guint best_errors = G_MAXUINT;
+  gint best_shift = 0;
+  guint num_snapshots = 0;
+  GList *iter;
+  guint i;
+
+  /* Only this thread writes the fingerprint of the stream */
+  if (!gst_vosk_duplicate_is_active (&duplicate->fingerprint)) {
+    G_LOCK (registry);
+    duplicate->candidate = NULL;
+    duplicate->confirmations = 0;
+    G_UNLOCK (registry);
+    return;
+  }
+
+  G_LOCK (registry);
+  snapshots = g_new (GstVoskSnapshot, g_list_length (registry));
+  for (iter = registry; iter; iter = iter->next) {
+    GstVoskDuplicate *other = iter->data;
+
+    if (other == duplicate || other->leader)
+      continue;
+
+    snapshots[num_snapshots].duplicate = other;
+    snapshots[num_snapshots].fingerprint = other->fingerprint;
+    num_snapshots++;
+  }
+  G_UNLOCK (registry);
+
+  for (i = 0; i < num_snapshots; i++) {
+    guint errors;
+    gint shift = 0;
+
+    errors = gst_vosk_duplicate_best_shift (&duplicate->fingerprint,
+                                            &snapshots[i].fingerprint,
+                                            -duplicate->tolerance,
+                                            duplicate->tolerance,
+                                            MATCH_FRAMES,
+                                            &shift);
+    if (errors < best_errors) {
+      best = snapshots[i].duplicate;
+      best_errors = errors;
+      best_shift = shift;
+      best_offset = gst_vosk_duplicate_offset (&duplicate->fingerprint,
+                                               &snapshots[i].fingerprint,
+                                               shift);
+    }
+  }
+  g_free (snapshots);
+
+  G_LOCK (registry);
+
+  /* The stream may have been unregistered or started duplicating another one
+   * while the lock was released: best is only compared, never dereferenced,
+   * until it is found in the registry again. */
+  if (!best ||
+      best_errors > MATCH_MAX_ERRORS ||
+      !g_list_find (registry, best) ||
+      best->leader) {
+    duplicate->candidate = NULL;
+    duplicate->confirmations = 0;
+    goto end;
+  }
+
+  if (best == duplicate->candidate &&
+      ABS (best_shift - duplicate->candidate_shift) <= DRIFT_FRAMES)
+    duplicate->confirmations++;
+  else {
+    duplicate->candidate = best;
+    duplicate->confirmations = 1;
+  }
+  duplicate->candidate_shift = best_shift;
+
+  /* A stream that others duplicate keeps its role */
+  if (duplicate->confirmations < CONFIRMATIONS ||
+      gst_vosk_duplicate_is_leader (duplicate))
+    goto end;
+
+  GST_INFO ("stream duplicates another one (shifted by %i ms, %u%% of frames differ).",
+            best_shift * (gint) (FRAME_DURATION / GST_MSECOND),
+            best_errors * 100 / MATCH_FRAMES);
+
+  duplicate->leader = best;
+  duplicate->shift = best_shift;
+  duplicate->offset = best_offset;
+  duplicate->candidate = NULL;
+  duplicate->confirmations = 0;
+
+end:
+  G_UNLOCK (registry);
+}
+
+static void
+gst_vosk_duplicate_check_leader (GstVoskDuplicate *duplicate)
+{
+  GstVoskFingerprint fingerprint;
+  GstVoskDuplicate *leader;
+  guint errors;
+  gint shift;
+
+  G_LOCK (registry);
+  leader = duplicate->leader;
+  if (leader)
+    fingerprint = leader->fingerprint;
+  shift = duplicate->shift;
+  G_UNLOCK (registry);
+
+  if (!leader)
+    return;
+
+  errors = gst_vosk_duplicate_best_shift (&duplicate->fingerprint, &fingerprint,
+                                          shift - DRIFT_FRAMES,
+                                          shift + DRIFT_FRAMES,
+                                          DIVERGE_FRAMES,
+                                          &shift);
+
+  /* G_MAXUINT: the leader is late, wait for its frames */
+  if (errors == G_MAXUINT)
+    return;
+
+  G_LOCK (registry);
+
+  /* The leader went away in the meantime */
+  if (duplicate->leader != leader)
+    goto end;
+
+  if (errors <= DIVERGE_MAX_ERRORS) {
+    duplicate->shift = shift;
+    duplicate->offset = gst_vosk_duplicate_offset (&duplicate->fingerprint,
+                                                   &fingerprint,
+                                                   shift);
+    goto end;
+  }
+
+  GST_INFO ("stream does not duplicate the other one any more (%u%% of frames differ).",
+            errors * 100 / DIVERGE_FRAMES);
+  duplicate->leader = NULL;
+
+end:
+  G_UNLOCK (registry);
+}
+
+/*
+ * Returns the bit of the frame that was just completed
+ */
+static guint8
+gst_vosk_duplicate_end_frame (GstVoskDuplicate *duplicate)
+{
+  gdouble previous = 0.0, current = 0.0;
+  guint i;
+
+  duplicate->energies[duplicate->energy_frames % (2 * ENERGY_FRAMES)] =
+    duplicate->energy / duplicate->frame_samples;
+  duplicate->energy_frames++;
+
+  /* The oldest half first, the ring starts at the next frame */
+  for (i = 0; i < 2 * ENERGY_FRAMES; i++) {
+    gdouble energy = duplicate->energies[(duplicate->energy_frames + i) % (2 * ENERGY_FRAMES)];
+
+    if (i < ENERGY_FRAMES)
+      previous += energy;
+    else
+      current += energy;
+  }
+
+  duplicate->energy = 0.0;
+  duplicate->frame_samples = 0;
+
+  return current > previous;
+}
+
+static void
+gst_vosk_duplicate_add_bits (GstVoskDuplicate *duplicate,
+                             const guint8 *bits,
+                             guint num_bits,
+                             GstClockTime position)
+{
+  GstVoskFingerprint *fingerprint = &duplicate->fingerprint;
+  guint i;
+
+  if (!num_bits)
+    return;
+
+  G_LOCK (registry);
+  for (i = 0; i < num_bits; i++) {
+    fingerprint->bits[fingerprint->frames % FINGERPRINT_FRAMES] = bits[i];
+    fingerprint->frames++;
+  }
+  fingerprint->position = position;
+  G_UNLOCK (registry);
+}
+
+gboolean
+gst_vosk_duplicate_push (GstVoskDuplicate *duplicate,
+                         const gint16 *pcm,
+                         gsize num_samples,
+                         guint rate,
+                         GstClockTime position)
+{
+  guint8 bits[FINGERPRINT_FRAMES];
+  guint num_bits = 0;
+  gboolean duplicated;
+  guint64 start;
+  gsize i;
+
+  /* Sample of the timeline pcm starts at, to know where its frames end */
+  start = gst_util_uint64_scale (position, rate, GST_SECOND);
+  start = start > num_samples ? start - num_samples : 0;
+
+  if (G_UNLIKELY (!duplicate->frame_size))
+    duplicate->frame_size = MAX (1, gst_util_uint64_scale (FRAME_DURATION, rate, GST_SECOND));
+
+  /* The energies are only used by this thread: the registry lock is only
+   * taken to publish the bits of the new frames */
+  for (i = 0; i < num_samples; i++) {
+    duplicate->energy += (gdouble) pcm[i] * pcm[i];
+    if (++duplicate->frame_samples < duplicate->frame_size)
+      continue;
+
+    bits[num_bits++] = gst_vosk_duplicate_end_frame (duplicate);
+    if (num_bits == FINGERPRINT_FRAMES) {
+      gst_vosk_duplicate_add_bits (duplicate, bits, num_bits,
+                                   gst_util_uint64_scale (start + i + 1, GST_SECOND, rate));
+      num_bits = 0;
+    }
+  }
+  gst_vosk_duplicate_add_bits (duplicate, bits, num_bits,
+                               gst_util_uint64_scale (start + num_samples - duplicate->frame_samples,
+                                                      GST_SECOND, rate));
+
+  if (duplicate->fingerprint.frames >= duplicate->next_check) {
+    gboolean has_leader;
+
+    G_LOCK (registry);
+    has_leader = duplicate->leader != NULL;
+    G_UNLOCK (registry);
+
+    if (has_leader) {
+      duplicate->next_check = duplicate->fingerprint.frames + DIVERGE_CHECK_FRAMES;
+      gst_vosk_duplicate_check_leader (duplicate);
+    }
+    else {
+      duplicate->next_check = duplicate->fingerprint.frames + CHECK_FRAMES;
+      gst_vosk_duplicate_find_leader (duplicate);
+    }
+  }
+
+  G_LOCK (registry);
+  duplicated = duplicate->leader != NULL;
+  G_UNLOCK (registry);
+
+  return duplicated;
+}
+
+static gint64
+gst_vosk_duplicate_time_shift (gdouble time G_GNUC_UNUSED,
+                               gpointer user_data)
+{
+  return *(GstClockTimeDiff *) user_data;
+}
+
+static gboolean
+gst_vosk_duplicate_retime (GQuark field_id G_GNUC_UNUSED,
+                           GValue *value,
+                           gpointer user_data)
+{
+  gchar *shifted;
+
+  /* Results are the only strings */
+  if (!G_VALUE_HOLDS_STRING (value) || !g_value_get_string (value))
+    return TRUE;
+
+  shifted = gst_vosk_result_shift_times (g_value_get_string (value),
+                                         gst_vosk_duplicate_time_shift,
+                                         user_data);
+  g_value_take_string (value, shifted);
+  return TRUE;
+}
+
+void
+gst_vosk_duplicate_share (GstVoskDuplicate *duplicate,
+                          const GstStructure *result)
+{
+  GList *iter;
+
+  G_LOCK (registry);
+  for (iter = registry; iter; iter = iter->next) {
+    GstVoskDuplicate *other = iter->data;
+    GstStructure *copy;
+
+    if (other->leader != duplicate)
+      continue;
+
+    copy = gst_structure_copy (result);
+    if (other->offset)
+      gst_structure_map_in_place (copy, gst_vosk_duplicate_retime, &other->offset);
+
+    if (g_async_queue_length (other->shared) >= MAX_SHARED) {
+      GST_WARNING ("results of the stream duplicated are not taken, dropping the oldest");
+      gst_structure_free (g_async_queue_try_pop (other->shared));
+    }
+    g_async_queue_push (other->shared, copy);
+  }
+  G_UNLOCK (registry);
+}
+
+GstStructure *
+gst_vosk_duplicate_pop (GstVoskDuplicate *duplicate)
+{
+  return g_async_queue_try_pop (duplicate->shared);
+}
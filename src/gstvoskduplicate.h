@@ -0,0 +1,63 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GST_VOSK_DUPLICATE_H__
+#define __GST_VOSK_DUPLICATE_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Process-wide registry of the fingerprints of the streams being recognized,
+ * to find streams carrying the same audio (a conference mix recorded several
+ * times). A stream that duplicates another one, give or take tolerance, is
+ * not decoded: the results of the other stream are handed to it instead,
+ * until their audio differs.
+ *
+ * The fingerprint has one bit per 10 ms frame (whether energy goes up), so it
+ * does not depend on the rate or the volume of the streams.
+ */
+typedef struct _GstVoskDuplicate GstVoskDuplicate;
+
+GstVoskDuplicate *gst_vosk_duplicate_register (GstClockTime tolerance);
+
+/* The streams that duplicate this one are decoded again */
+void gst_vosk_duplicate_unregister (GstVoskDuplicate *duplicate);
+
+/* Returns TRUE while the stream duplicates another one (that is, once it has
+ * been confirmed and as long as the audio does not differ). position is where
+ * pcm ends on the timeline of the word times of the stream. */
+gboolean gst_vosk_duplicate_push (GstVoskDuplicate *duplicate,
+                                  const gint16 *pcm,
+                                  gsize num_samples,
+                                  guint rate,
+                                  GstClockTime position);
+
+/* Hands a copy of a result of the stream to the streams duplicating it, its
+ * word times put on the timeline of each of them */
+void gst_vosk_duplicate_share (GstVoskDuplicate *duplicate,
+                               const GstStructure *result);
+
+/* Returns the next result handed by the stream this one duplicates */
+GstStructure *gst_vosk_duplicate_pop (GstVoskDuplicate *duplicate);
+
+G_END_DECLS
+
+#endif /* __GST_VOSK_DUPLICATE_H__ */
@@ -0,0 +1,75 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "gstvoskg711.h"
+
+#define MULAW_BIAS 0x84
+#define MULAW_CLIP 32635
+
+guint8
+gst_vosk_mulaw_encode (gint16 sample)
+{
+  gint value = sample;
+  gint exponent, mantissa;
+  guint8 sign = 0;
+  gint mask;
+
+  if (value < 0) {
+    value = -value;
+    sign = 0x80;
+  }
+
+  value = MIN (value, MULAW_CLIP) + MULAW_BIAS;
+
+  /* Position of the highest bit set above the 8 lower ones */
+  for (exponent = 7, mask = 0x4000; exponent > 0 && !(value & mask); exponent--)
+    mask >>= 1;
+
+  mantissa = (value >> (exponent + 3)) & 0x0f;
+  return ~(sign | (exponent << 4) | mantissa);
+}
+
+gint16
+gst_vosk_mulaw_decode (guint8 mulaw)
+{
+  gint value;
+
+  mulaw = ~mulaw;
+  value = (((mulaw & 0x0f) << 3) + MULAW_BIAS) << ((mulaw & 0x70) >> 4);
+  return (mulaw & 0x80) ? MULAW_BIAS - value : value - MULAW_BIAS;
+}
+
+gint16
+gst_vosk_alaw_decode (guint8 alaw)
+{
+  gint value, segment;
+
+  /* Even bits are inverted on the wire */
+  alaw ^= 0x55;
+
+  value = (alaw & 0x0f) << 4;
+  segment = (alaw & 0x70) >> 4;
+
+  if (segment == 0)
+    value += 8;
+  else
+    value = (value + 0x108) << (segment - 1);
+
+  return (alaw & 0x80) ? value : -value;
+}
@@ -0,0 +1,40 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GST_VOSK_G711_H__
+#define __GST_VOSK_G711_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * ITU-T G.711 µ-law and A-law: one byte per sample, about 14 and 13 bits of
+ * dynamic range. That is plenty for speech recognition (telephony models are
+ * trained on it).
+ */
+guint8 gst_vosk_mulaw_encode (gint16 sample);
+
+gint16 gst_vosk_mulaw_decode (guint8 mulaw);
+
+gint16 gst_vosk_alaw_decode (guint8 alaw);
+
+G_END_DECLS
+
+#endif /* __GST_VOSK_G711_H__ */
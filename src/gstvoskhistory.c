@@ -0,0 +1,197 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "gstvoskhistory.h"
+#include "gstvoskg711.h"
+
+struct _GstVoskHistory {
+  guint8        *data;
+  gsize          capacity;    /* in samples */
+  gsize          head;        /* index of the oldest sample */
+  gsize          length;      /* in samples */
+  guint          sample_size;
+  guint          rate;
+
+  /* Time right after the latest sample */
+  GstClockTime   end;
+};
+
+GstVoskHistory *
+gst_vosk_history_new (guint rate,
+                      GstClockTime duration,
+                      gboolean compress)
+{
+  GstVoskHistory *history;
+
+  g_return_val_if_fail (rate > 0, NULL);
+
+  history = g_new0 (GstVoskHistory, 1);
+  history->rate = rate;
+  history->sample_size = compress ? sizeof (guint8) : sizeof (gint16);
+  history->capacity = MAX (1, gst_util_uint64_scale (duration, rate, GST_SECOND));
+  history->data = g_malloc (history->capacity * history->sample_size);
+  history->end = GST_CLOCK_TIME_NONE;
+  return history;
+}
+
+void
+gst_vosk_history_free (GstVoskHistory *history)
+{
+  if (!history)
+    return;
+
+  g_free (history->data);
+  g_free (history);
+}
+
+void
+gst_vosk_history_clear (GstVoskHistory *history)
+{
+  history->head = 0;
+  history->length = 0;
+  history->end = GST_CLOCK_TIME_NONE;
+}
+
+static GstClockTime
+gst_vosk_history_samples_to_time (GstVoskHistory *history,
+                                  guint64 samples)
+{
+  return gst_util_uint64_scale (samples, GST_SECOND, history->rate);
+}
+
+static void
+gst_vosk_history_append (GstVoskHistory *history,
+                         gint16 sample)
+{
+  gsize index;
+
+  if (history->length == history->capacity) {
+    history->head = (history->head + 1) % history->capacity;
+    history->length--;
+  }
+
+  index = (history->head + history->length) % history->capacity;
+  if (history->sample_size == sizeof (gint16))
+    ((gint16 *) history->data)[index] = sample;
+  else
+    history->data[index] = gst_vosk_mulaw_encode (sample);
+
+  history->length++;
+}
+
+static gint16
+gst_vosk_history_sample (GstVoskHistory *history,
+                         gsize offset)
+{
+  gsize index = (history->head + offset) % history->capacity;
+
+  if (history->sample_size == sizeof (gint16))
+    return ((gint16 *) history->data)[index];
+
+  return gst_vosk_mulaw_decode (history->data[index]);
+}
+
+void
+gst_vosk_history_push (GstVoskHistory *history,
+                       GstClockTime pts,
+                       const gint16 *pcm,
+                       gsize num_samples)
+{
+  gsize i;
+
+  if (GST_CLOCK_TIME_IS_VALID (pts) && GST_CLOCK_TIME_IS_VALID (history->end)) {
+    if (pts < history->end) {
+      /* Going back (seek, new segment) means another timeline */
+      if (history->end - pts > GST_MSECOND)
+        gst_vosk_history_clear (history);
+    }
+    else {
+      guint64 missing;
+
+      missing = gst_util_uint64_scale (pts - history->end, history->rate, GST_SECOND);
+      if (missing >= history->capacity)
+        gst_vosk_history_clear (history);
+      else {
+        for (i = 0; i < missing; i++)
+          gst_vosk_history_append (history, 0);
+      }
+    }
+  }
+
+  if (!GST_CLOCK_TIME_IS_VALID (history->end))
+    history->end = GST_CLOCK_TIME_IS_VALID (pts) ? pts : 0;
+  else if (GST_CLOCK_TIME_IS_VALID (pts) && pts > history->end)
+    history->end = pts;
+
+  for (i = 0; i < num_samples; i++)
+    gst_vosk_history_append (history, pcm[i]);
+
+  history->end += gst_vosk_history_samples_to_time (history, num_samples);
+}
+
+GByteArray *
+gst_vosk_history_get (GstVoskHistory *history,
+                      GstClockTime *start,
+                      GstClockTime *stop)
+{
+  GstClockTime oldest;
+  GByteArray *pcm;
+  guint64 first, last, i;
+
+  if (!history->length)
+    return NULL;
+
+  oldest = history->end - gst_vosk_history_samples_to_time (history, history->length);
+
+  first = 0;
+  if (GST_CLOCK_TIME_IS_VALID (*start) && *start > oldest)
+    first = gst_util_uint64_scale (*start - oldest, history->rate, GST_SECOND);
+
+  last = history->length;
+  if (GST_CLOCK_TIME_IS_VALID (*stop)) {
+    if (*stop <= oldest)
+      return NULL;
+
+    last = MIN (last, gst_util_uint64_scale (*stop - oldest, history->rate, GST_SECOND));
+  }
+
+  if (first >= last)
+    return NULL;
+
+  pcm = g_byte_array_sized_new ((last - first) * sizeof (gint16));
+  g_byte_array_set_size (pcm, (last - first) * sizeof (gint16));
+  for (i = first; i < last; i++)
+    ((gint16 *) pcm->data)[i - first] = gst_vosk_history_sample (history, i);
+
+  *start = oldest + gst_vosk_history_samples_to_time (history, first);
+  *stop = oldest + gst_vosk_history_samples_to_time (history, last);
+  return pcm;
+}
+
+GstClockTime
+gst_vosk_history_get_duration (GstVoskHistory *history)
+{
+  return gst_vosk_history_samples_to_time (history, history->length);
+}
+
+gsize
+gst_vosk_history_get_size (GstVoskHistory *history)
+{
+  return history->capacity * history->sample_size;
+}
@@ -0,0 +1,64 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GST_VOSK_HISTORY_H__
+#define __GST_VOSK_HISTORY_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Ring holding the last samples of a stream with their timestamps, so that
+ * any part of it can be decoded later. Missing audio is kept as silence to
+ * stay on the timeline. Compressed samples are stored as G.711 µ-law (half
+ * the memory).
+ */
+typedef struct _GstVoskHistory GstVoskHistory;
+
+GstVoskHistory *gst_vosk_history_new (guint rate,
+                                      GstClockTime duration,
+                                      gboolean compress);
+
+void gst_vosk_history_free (GstVoskHistory *history);
+
+void gst_vosk_history_clear (GstVoskHistory *history);
+
+/* pts can be GST_CLOCK_TIME_NONE when samples follow the previous ones */
+void gst_vosk_history_push (GstVoskHistory *history,
+                            GstClockTime pts,
+                            const gint16 *pcm,
+                            gsize num_samples);
+
+/*
+ * Returns the PCM between start and stop (GST_CLOCK_TIME_NONE for the oldest
+ * and the latest samples), or NULL when none is left. start and stop are set
+ * to the times of the samples returned.
+ */
+GByteArray *gst_vosk_history_get (GstVoskHistory *history,
+                                  GstClockTime *start,
+                                  GstClockTime *stop);
+
+GstClockTime gst_vosk_history_get_duration (GstVoskHistory *history);
+
+gsize gst_vosk_history_get_size (GstVoskHistory *history);
+
+G_END_DECLS
+
+#endif /* __GST_VOSK_HISTORY_H__ */
@@ -0,0 +1,78 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GST_VOSK_LOCALE_H__
+#define __GST_VOSK_LOCALE_H__
+
+#include <locale.h>
+
+#include "../gst-vosk-config.h"
+
+/* BUG : protect from local formatting errors when fr_ prefix
+   Maybe there are other locales ?
+   Use uselocale () when we can as it is supposed to be safer since it sets
+   the locale only for the thread. */
+#if HAVE_USELOCALE
+
+#define PROTECT_FROM_LOCALE_BUG_START                         \
+  locale_t current_locale;                                    \
+  locale_t new_locale;                                        \
+  locale_t old_locale = NULL;                                 \
+                                                              \
+  current_locale = uselocale (NULL);                          \
+  old_locale = duplocale (current_locale);                    \
+  new_locale = newlocale (LC_NUMERIC_MASK, "C", old_locale);  \
+  if (new_locale)                                             \
+    uselocale (new_locale);
+
+#else
+
+#define PROTECT_FROM_LOCALE_BUG_START                         \
+  gchar *saved_locale = NULL;                                 \
+  const gchar *current_locale;                                \
+  current_locale = setlocale(LC_NUMERIC, NULL);               \
+  if (current_locale != NULL &&                               \
+      g_str_has_prefix (current_locale, "fr_") == TRUE) {     \
+    saved_locale = g_strdup (current_locale);                 \
+    setlocale (LC_NUMERIC, "C");                              \
+    GST_LOG ("Changed locale %s", saved_locale);              \
+  }
+
+#endif
+
+#if HAVE_USELOCALE
+
+#define PROTECT_FROM_LOCALE_BUG_END                           \
+  if (old_locale) {                                           \
+    uselocale (current_locale);                               \
+    freelocale (new_locale);                                  \
+  }
+
+#else
+
+#define PROTECT_FROM_LOCALE_BUG_END                           \
+  if (saved_locale != NULL) {                                 \
+    setlocale (LC_NUMERIC, saved_locale);                     \
+    GST_LOG ("Reset locale %s", saved_locale);                \
+    g_free (saved_locale);                                    \
+  }
+
+#endif
+
+#endif /* __GST_VOSK_LOCALE_H__ */
@@ -0,0 +1,230 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <gst/gst.h>
+
+#include "gstvoskmodelcache.h"
+#include "gstvoskbundle.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_vosk_core_debug);
+#define GST_CAT_DEFAULT gst_vosk_core_debug
+
+typedef struct {
+  gchar     *path;
+  VoskModel *model;
+  guint      users;
+  gboolean   loading;
+  gboolean   shared;
+} GstVoskModelEntry;
+
+static GMutex cache_mutex;
+static GCond cache_cond;
+static GHashTable *cache_table = NULL;
+
+/* Models loaded for a single user (not found by path), by model */
+static GHashTable *private_table = NULL;
+
+static void
+gst_vosk_model_entry_free (gpointer data)
+{
+  GstVoskModelEntry *entry = data;
+
+  g_free (entry->path);
+  g_free (entry);
+}
+
+static VoskModel *
+gst_vosk_model_cache_load (const gchar *path)
+{
+  /* A single file is a packed model (see gst-vosk-pack) */
+  if (gst_vosk_bundle_is_bundle (path))
+    return gst_vosk_bundle_load_model (path);
+
+  return vosk_model_new (path);
+}
+
+VoskModel *
+gst_vosk_model_cache_get (const gchar *path)
+{
+  GstVoskModelEntry *entry;
+  VoskModel *model;
+
+  g_return_val_if_fail (path != NULL, NULL);
+
+  g_mutex_lock (&cache_mutex);
+
+  if (!cache_table)
+    cache_table = g_hash_table_new_full (g_str_hash,
+                                         g_str_equal,
+                                         NULL,
+                                         gst_vosk_model_entry_free);
+
+  /* Another thread may be loading the same model: wait for it rather than
+   * loading a second copy. If it failed, try again ourselves. */
+  while ((entry = g_hash_table_lookup (cache_table, path)) != NULL &&
+         entry->loading)
+    g_cond_wait (&cache_cond, &cache_mutex);
+
+  if (entry) {
+    entry->users++;
+    GST_DEBUG ("model %s found in cache (%u users).", path, entry->users);
+    g_mutex_unlock (&cache_mutex);
+    return entry->model;
+  }
+
+  entry = g_new0 (GstVoskModelEntry, 1);
+  entry->path = g_strdup (path);
+  entry->loading = TRUE;
+  entry->shared = TRUE;
+  g_hash_table_insert (cache_table, entry->path, entry);
+
+  g_mutex_unlock (&cache_mutex);
+
+  GST_INFO ("loading model %s.", path);
+  model = gst_vosk_model_cache_load (path);
+
+  g_mutex_lock (&cache_mutex);
+
+  if (model) {
+    entry->model = model;
+    entry->users = 1;
+    entry->loading = FALSE;
+  }
+  else {
+    GST_WARNING ("could not load model %s.", path);
+    g_hash_table_remove (cache_table, path);
+  }
+
+  g_cond_broadcast (&cache_cond);
+  g_mutex_unlock (&cache_mutex);
+
+  return model;
+}
+
+VoskModel *
+gst_vosk_model_cache_get_private (const gchar *path)
+{
+  GstVoskModelEntry *entry;
+  VoskModel *model;
+
+  g_return_val_if_fail (path != NULL, NULL);
+
+  GST_INFO ("loading private model %s.", path);
+  model = gst_vosk_model_cache_load (path);
+  if (!model) {
+    GST_WARNING ("could not load model %s.", path);
+    return NULL;
+  }
+
+  entry = g_new0 (GstVoskModelEntry, 1);
+  entry->path = g_strdup (path);
+  entry->model = model;
+  entry->users = 1;
+
+  g_mutex_lock (&cache_mutex);
+
+  if (!private_table)
+    private_table = g_hash_table_new_full (g_direct_hash,
+                                           g_direct_equal,
+                                           NULL,
+                                           gst_vosk_model_entry_free);
+
+  g_hash_table_insert (private_table, model, entry);
+
+  g_mutex_unlock (&cache_mutex);
+
+  return model;
+}
+
+static GstVoskModelEntry *
+gst_vosk_model_cache_find (VoskModel *model)
+{
+  GstVoskModelEntry *entry;
+  GHashTableIter iter;
+
+  if (private_table &&
+      (entry = g_hash_table_lookup (private_table, model)) != NULL)
+    return entry;
+
+  if (!cache_table)
+    return NULL;
+
+  g_hash_table_iter_init (&iter, cache_table);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entry)) {
+    if (entry->model == model)
+      return entry;
+  }
+
+  return NULL;
+}
+
+VoskModel *
+gst_vosk_model_cache_ref (VoskModel *model)
+{
+  GstVoskModelEntry *entry;
+
+  g_return_val_if_fail (model != NULL, NULL);
+
+  g_mutex_lock (&cache_mutex);
+
+  entry = gst_vosk_model_cache_find (model);
+  if (entry)
+    entry->users++;
+  else
+    GST_WARNING ("model %p is not in cache.", model);
+
+  g_mutex_unlock (&cache_mutex);
+
+  return entry ? model : NULL;
+}
+
+void
+gst_vosk_model_cache_release (VoskModel *model)
+{
+  GstVoskModelEntry *entry;
+
+  if (!model)
+    return;
+
+  g_mutex_lock (&cache_mutex);
+
+  entry = gst_vosk_model_cache_find (model);
+  if (!entry) {
+    GST_WARNING ("model %p is not in cache.", model);
+    model = NULL;
+  }
+  else if (--entry->users > 0) {
+    GST_DEBUG ("model %s still in use (%u users).", entry->path, entry->users);
+    model = NULL;
+  }
+  else if (!entry->shared) {
+    GST_INFO ("freeing private model %s.", entry->path);
+    g_hash_table_remove (private_table, model);
+  }
+  else {
+    GST_INFO ("removing model %s from cache.", entry->path);
+    g_hash_table_remove (cache_table, entry->path);
+  }
+
+  g_mutex_unlock (&cache_mutex);
+
+  /* Recognizers still hold a reference on it if they are alive */
+  if (model)
+    vosk_model_free (model);
+}
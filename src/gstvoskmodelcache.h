@@ -0,0 +1,49 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GST_VOSK_MODEL_CACHE_H__
+#define __GST_VOSK_MODEL_CACHE_H__
+
+#include <glib.h>
+
+#include "vosk-api.h"
+
+G_BEGIN_DECLS
+
+/*
+ * Process-wide cache of loaded models, indexed by path.
+ * Every successful call to gst_vosk_model_cache_get() must be balanced by a
+ * call to gst_vosk_model_cache_release(). A model is freed once its last user
+ * released it (recognizers created from it keep their own libvosk reference).
+ */
+VoskModel *gst_vosk_model_cache_get (const gchar *path);
+
+/*
+ * Loads a model that no other call finds by its path (a separate instance).
+ * It is referenced and released like the others.
+ */
+VoskModel *gst_vosk_model_cache_get_private (const gchar *path);
+
+VoskModel *gst_vosk_model_cache_ref (VoskModel *model);
+
+void gst_vosk_model_cache_release (VoskModel *model);
+
+G_END_DECLS
+
+#endif /* __GST_VOSK_MODEL_CACHE_H__ */
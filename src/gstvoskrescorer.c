@@ -0,0 +1,304 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "../gst-vosk-config.h"
+
+#include <string.h>
+
+#if defined (HAVE_SETPRIORITY) && defined (HAVE_SYS_GETTID)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <gst/gst.h>
+#include <json-glib/json-glib.h>
+
+#include "gstvoskrescorer.h"
+#include "gstvoskmodelcache.h"
+#include "gstvosklocale.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_vosk_core_debug);
+#define GST_CAT_DEFAULT gst_vosk_core_debug
+
+/* Rescoring threads should never compete with live decoding */
+#define RESCORER_NICENESS 10
+
+typedef struct {
+  GstVoskRescoreFunc  func;
+  gpointer            user_data;
+  GDestroyNotify      user_data_unref;
+  VoskModel          *model;
+  gfloat              rate;
+  gint                alternatives;
+  GByteArray         *audio;
+  guint64             utterance_id;
+  guint64             offset;
+} GstVoskRescoreJob;
+
+static GThreadPool *rescorer_pool = NULL;
+G_LOCK_DEFINE_STATIC (rescorer_pool);
+
+static void
+gst_vosk_rescore_job_free (GstVoskRescoreJob *job)
+{
+  gst_vosk_model_cache_release (job->model);
+  g_byte_array_unref (job->audio);
+  if (job->user_data && job->user_data_unref)
+    job->user_data_unref (job->user_data);
+  g_free (job);
+}
+
+/*
+ * The pool is exclusive: its threads are never lent to other pools, which
+ * would otherwise run model loading or transcriptions at a lower priority.
+ */
+static void
+gst_vosk_rescorer_lower_priority (void)
+{
+#if defined (HAVE_SETPRIORITY) && defined (HAVE_SYS_GETTID)
+  static GPrivate lowered;
+
+  if (g_private_get (&lowered))
+    return;
+
+  /* On Linux the nice value is a per-thread attribute */
+  if (setpriority (PRIO_PROCESS, syscall (SYS_gettid), RESCORER_NICENESS) != 0)
+    GST_DEBUG ("could not lower rescoring thread priority.");
+
+  g_private_set (&lowered, GINT_TO_POINTER (TRUE));
+#endif
+}
+
+static gint64
+gst_vosk_rescorer_time_shift (gdouble time G_GNUC_UNUSED,
+                              gpointer user_data)
+{
+  return *(guint64 *) user_data;
+}
+
+static void
+gst_vosk_rescorer_run (gpointer data,
+                       gpointer user_data G_GNUC_UNUSED)
+{
+  GstVoskRescoreJob *job = data;
+  VoskRecognizer *recognizer;
+  const gchar *json_txt;
+
+  gst_vosk_rescorer_lower_priority ();
+
+  GST_DEBUG ("rescoring utterance %" G_GUINT64_FORMAT " (%u bytes).",
+                    job->utterance_id, job->audio->len);
+
+  recognizer = vosk_recognizer_new (job->model, job->rate);
+  if (!recognizer) {
+    GST_WARNING ("could not create rescoring recognizer.");
+    goto clean;
+  }
+
+  vosk_recognizer_set_max_alternatives (recognizer, job->alternatives);
+  vosk_recognizer_set_words (recognizer, 1);
+
+  if (vosk_recognizer_accept_waveform (recognizer,
+                                       (const gchar *) job->audio->data,
+                                       job->audio->len) == -1) {
+    GST_ERROR ("accept_waveform error while rescoring");
+    vosk_recognizer_free (recognizer);
+    goto clean;
+  }
+
+  {
+    PROTECT_FROM_LOCALE_BUG_START
+
+    json_txt = vosk_recognizer_final_result (recognizer);
+
+    PROTECT_FROM_LOCALE_BUG_END
+  }
+
+  /* The recognizer only heard the utterance: its words are timed from the
+   * start of it */
+  if (json_txt) {
+    gchar *shifted;
+
+    shifted = gst_vosk_result_shift_times (json_txt,
+                                           gst_vosk_rescorer_time_shift,
+                                           &job->offset);
+    job->func (job->user_data, job->utterance_id, shifted);
+    g_free (shifted);
+  }
+
+  vosk_recognizer_free (recognizer);
+
+clean:
+  gst_vosk_rescore_job_free (job);
+}
+
+void
+gst_vosk_rescorer_push (GstVoskRescoreFunc func,
+                        gpointer user_data,
+                        GDestroyNotify user_data_unref,
+                        VoskModel *model,
+                        gfloat rate,
+                        gint alternatives,
+                        GByteArray *audio,
+                        guint64 utterance_id,
+                        guint64 offset)
+{
+  GstVoskRescoreJob *job;
+
+  if (!gst_vosk_model_cache_ref (model)) {
+    g_byte_array_unref (audio);
+    if (user_data && user_data_unref)
+      user_data_unref (user_data);
+    return;
+  }
+
+  job = g_new0 (GstVoskRescoreJob, 1);
+  job->func = func;
+  job->user_data = user_data;
+  job->user_data_unref = user_data_unref;
+  job->model = model;
+  job->rate = rate;
+  job->alternatives = alternatives;
+  job->audio = audio;
+  job->utterance_id = utterance_id;
+  job->offset = offset;
+
+  G_LOCK (rescorer_pool);
+  if (!rescorer_pool)
+    rescorer_pool = g_thread_pool_new (gst_vosk_rescorer_run,
+                                       NULL,
+                                       MAX (1, g_get_num_processors () / 2),
+                                       TRUE,
+                                       NULL);
+  G_UNLOCK (rescorer_pool);
+
+  g_thread_pool_push (rescorer_pool, job, NULL);
+}
+
+/*
+ * Returns the average confidence of the words of a result (or of the words of
+ * its best alternative) or -1.0 if the result does not carry any.
+ */
+gdouble
+gst_vosk_result_confidence (const gchar *json_result)
+{
+  JsonParser *parser;
+  JsonObject *object;
+  JsonArray *words = NULL;
+  gdouble confidence = -1.0;
+  gdouble sum = 0.0;
+  guint i, len;
+
+  parser = json_parser_new ();
+  if (!json_parser_load_from_data (parser, json_result, -1, NULL) ||
+      !JSON_NODE_HOLDS_OBJECT (json_parser_get_root (parser)))
+    goto end;
+
+  object = json_node_get_object (json_parser_get_root (parser));
+
+  if (json_object_has_member (object, "alternatives")) {
+    JsonArray *alternatives;
+
+    alternatives = json_object_get_array_member (object, "alternatives");
+    if (!alternatives || json_array_get_length (alternatives) == 0)
+      goto end;
+
+    object = json_array_get_object_element (alternatives, 0);
+  }
+
+  if (object && json_object_has_member (object, "result"))
+    words = json_object_get_array_member (object, "result");
+
+  if (!words)
+    goto end;
+
+  len = json_array_get_length (words);
+  for (i = 0; i < len; i++) {
+    JsonObject *word = json_array_get_object_element (words, i);
+
+    if (!word || !json_object_has_member (word, "conf"))
+      goto end;
+
+    sum += json_object_get_double_member (word, "conf");
+  }
+
+  if (len)
+    confidence = sum / len;
+
+end:
+  g_object_unref (parser);
+  return confidence;
+}
+
+gchar *
+gst_vosk_result_shift_times (const gchar *json_result,
+                             GstVoskTimeShiftFunc func,
+                             gpointer user_data)
+{
+  static const gchar *keys[] = { "\"start\"", "\"end\"", NULL };
+  const gchar *p = json_result;
+  GString *shifted;
+
+  shifted = g_string_sized_new (strlen (json_result) + 16);
+
+  for (;;) {
+    gchar number[G_ASCII_DTOSTR_BUF_SIZE];
+    const gchar *key = NULL, *value, *end;
+    gdouble time;
+    guint i;
+
+    for (i = 0; keys[i]; i++) {
+      const gchar *found = strstr (p, keys[i]);
+
+      if (found && (!key || found < key)) {
+        key = found;
+        value = found + strlen (keys[i]);
+      }
+    }
+
+    if (!key)
+      break;
+
+    /* Only members: the same text as a string value is left alone */
+    while (g_ascii_isspace (*value))
+      value++;
+    if (*value != ':') {
+      g_string_append_len (shifted, p, value - p);
+      p = value;
+      continue;
+    }
+    value++;
+    while (g_ascii_isspace (*value))
+      value++;
+
+    time = g_ascii_strtod (value, (gchar **) &end);
+    g_string_append_len (shifted, p, value - p);
+    p = end;
+    if (end == value)
+      continue;
+
+    /* libvosk writes times with 6 decimals */
+    time = MAX (0.0, time + (gdouble) func (time, user_data) / GST_SECOND);
+    g_string_append (shifted, g_ascii_formatd (number, sizeof (number), "%f", time));
+  }
+
+  g_string_append (shifted, p);
+  return g_string_free (shifted, FALSE);
+}
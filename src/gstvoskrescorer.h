@@ -0,0 +1,65 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GST_VOSK_RESCORER_H__
+#define __GST_VOSK_RESCORER_H__
+
+#include <glib.h>
+
+#include "vosk-api.h"
+
+G_BEGIN_DECLS
+
+/* Called from a rescoring thread (never with any element lock held) */
+typedef void (*GstVoskRescoreFunc) (gpointer user_data,
+                                    guint64 utterance_id,
+                                    const gchar *json_result);
+
+/*
+ * Queues the audio of an utterance to be decoded again with model on the
+ * process-wide, low priority rescoring pool. audio and user_data are stolen.
+ * model must come from the model cache; the job holds its own reference.
+ * offset (nanoseconds) is the position of the utterance in the stream: the
+ * word times of the revised result are moved by it.
+ */
+void gst_vosk_rescorer_push (GstVoskRescoreFunc func,
+                             gpointer user_data,
+                             GDestroyNotify user_data_unref,
+                             VoskModel *model,
+                             gfloat rate,
+                             gint alternatives,
+                             GByteArray *audio,
+                             guint64 utterance_id,
+                             guint64 offset);
+
+gdouble gst_vosk_result_confidence (const gchar *json_result);
+
+/* Returns the shift (nanoseconds) of a word time (seconds) */
+typedef gint64 (*GstVoskTimeShiftFunc) (gdouble time,
+                                        gpointer user_data);
+
+/* Returns json_result with its word times shifted (not before 0), the rest of
+ * the text untouched (libvosk formatting included) */
+gchar *gst_vosk_result_shift_times (const gchar *json_result,
+                                    GstVoskTimeShiftFunc func,
+                                    gpointer user_data);
+
+G_END_DECLS
+
+#endif /* __GST_VOSK_RESCORER_H__ */
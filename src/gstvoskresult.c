@@ -0,0 +1,349 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "gstvoskcbor.h"
+#include "gstvoskresult.h"
+
+/* Nesting of our layout is 4, anything deeper is not ours */
+#define MAX_DEPTH     8
+
+typedef struct {
+  const guint8 *data;
+  gsize         size;
+  gsize         pos;
+} GstVoskCborReader;
+
+static gboolean
+gst_vosk_cbor_read_head (GstVoskCborReader *reader,
+                         guint8 *major,
+                         guint8 *info,
+                         guint64 *value)
+{
+  guint len, i;
+
+  if (reader->pos >= reader->size)
+    return FALSE;
+
+  *major = reader->data[reader->pos] >> 5;
+  *info = reader->data[reader->pos] & 0x1f;
+  reader->pos++;
+
+  if (*info < 24) {
+    *value = *info;
+    return TRUE;
+  }
+
+  /* Indefinite lengths and reserved values are never produced */
+  if (*info > 27)
+    return FALSE;
+
+  len = 1 << (*info - 24);
+  if (reader->size - reader->pos < len)
+    return FALSE;
+
+  *value = 0;
+  for (i = 0; i < len; i++)
+    *value = (*value << 8) | reader->data[reader->pos++];
+
+  return TRUE;
+}
+
+static gboolean
+gst_vosk_cbor_skip (GstVoskCborReader *reader,
+                    guint depth)
+{
+  guint8 major, info;
+  guint64 value, i;
+
+  if (depth > MAX_DEPTH || !gst_vosk_cbor_read_head (reader, &major, &info, &value))
+    return FALSE;
+
+  switch (major) {
+    case CBOR_BYTES:
+    case CBOR_TEXT:
+      if (reader->size - reader->pos < value)
+        return FALSE;
+      reader->pos += value;
+      return TRUE;
+
+    case CBOR_ARRAY:
+    case CBOR_MAP:
+      if (major == CBOR_MAP) {
+        if (value > G_MAXUINT64 / 2)
+          return FALSE;
+        value *= 2;
+      }
+
+      for (i = 0; i < value; i++) {
+        if (!gst_vosk_cbor_skip (reader, depth + 1))
+          return FALSE;
+      }
+      return TRUE;
+
+    case CBOR_TAG:
+      return gst_vosk_cbor_skip (reader, depth + 1);
+
+    default:
+      return TRUE;
+  }
+}
+
+static gboolean
+gst_vosk_cbor_read_text (GstVoskCborReader *reader,
+                         gchar **text)
+{
+  guint8 major, info;
+  guint64 len;
+
+  if (!gst_vosk_cbor_read_head (reader, &major, &info, &len) ||
+      major != CBOR_TEXT ||
+      reader->size - reader->pos < len)
+    return FALSE;
+
+  g_free (*text);
+  *text = g_strndup ((const gchar *) reader->data + reader->pos, len);
+  reader->pos += len;
+  return TRUE;
+}
+
+/* null is read as -1.0 */
+static gboolean
+gst_vosk_cbor_read_number (GstVoskCborReader *reader,
+                           gdouble *number)
+{
+  guint8 major, info;
+  guint64 value;
+
+  if (!gst_vosk_cbor_read_head (reader, &major, &info, &value))
+    return FALSE;
+
+  if (major == CBOR_UINT) {
+    *number = value;
+    return TRUE;
+  }
+
+  if (major != CBOR_SIMPLE)
+    return FALSE;
+
+  if (info == CBOR_NULL) {
+    *number = -1.0;
+    return TRUE;
+  }
+
+  if (info == 26) {
+    union { gfloat f; guint32 u; } bits;
+
+    bits.u = value;
+    *number = bits.f;
+    return TRUE;
+  }
+
+  if (info == 27) {
+    union { gdouble d; guint64 u; } bits;
+
+    bits.u = value;
+    *number = bits.d;
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+static void
+gst_vosk_word_clear (GstVoskWord *word)
+{
+  g_free (word->word);
+}
+
+static gboolean
+gst_vosk_cbor_read_words (GstVoskCborReader *reader,
+                          GArray **words)
+{
+  guint8 major, info;
+  guint64 len, i;
+
+  if (!gst_vosk_cbor_read_head (reader, &major, &info, &len) ||
+      major != CBOR_ARRAY ||
+      len > reader->size - reader->pos)
+    return FALSE;
+
+  if (*words)
+    g_array_unref (*words);
+
+  *words = g_array_sized_new (FALSE, TRUE, sizeof (GstVoskWord), len);
+  g_array_set_clear_func (*words, (GDestroyNotify) gst_vosk_word_clear);
+
+  for (i = 0; i < len; i++) {
+    GstVoskWord word = { NULL, 0.0, 0.0, -1.0 };
+    gdouble conf = -1.0;
+    guint64 fields;
+
+    if (!gst_vosk_cbor_read_head (reader, &major, &info, &fields) ||
+        major != CBOR_ARRAY ||
+        fields < 4 ||
+        !gst_vosk_cbor_read_text (reader, &word.word) ||
+        !gst_vosk_cbor_read_number (reader, &word.start) ||
+        !gst_vosk_cbor_read_number (reader, &word.end) ||
+        !gst_vosk_cbor_read_number (reader, &conf)) {
+      g_free (word.word);
+      return FALSE;
+    }
+    word.conf = conf;
+
+    g_array_append_val (*words, word);
+
+    for (fields -= 4; fields > 0; fields--) {
+      if (!gst_vosk_cbor_skip (reader, 2))
+        return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+static GstVoskResult *
+gst_vosk_cbor_read_result (GstVoskCborReader *reader,
+                           guint depth)
+{
+  GstVoskResult *result;
+  guint8 major, info;
+  guint64 pairs, key, value;
+
+  if (!gst_vosk_cbor_read_head (reader, &major, &info, &pairs) ||
+      major != CBOR_MAP)
+    return NULL;
+
+  result = g_new0 (GstVoskResult, 1);
+  result->confidence = -1.0;
+
+  for (; pairs > 0; pairs--) {
+    gsize key_pos = reader->pos;
+    gboolean ok;
+
+    if (!gst_vosk_cbor_read_head (reader, &major, &info, &key))
+      goto error;
+
+    /* Not one of our keys: skip it and its value */
+    if (major != CBOR_UINT) {
+      reader->pos = key_pos;
+      if (!gst_vosk_cbor_skip (reader, depth + 1) ||
+          !gst_vosk_cbor_skip (reader, depth + 1))
+        goto error;
+      continue;
+    }
+
+    switch (key) {
+      case KEY_TEXT:
+        ok = gst_vosk_cbor_read_text (reader, &result->text);
+        break;
+
+      case KEY_PARTIAL:
+        ok = gst_vosk_cbor_read_head (reader, &major, &info, &value) &&
+             major == CBOR_SIMPLE;
+        result->partial = (info == CBOR_TRUE);
+        break;
+
+      case KEY_WORDS:
+        ok = gst_vosk_cbor_read_words (reader, &result->words);
+        break;
+
+      case KEY_CONFIDENCE: {
+        gdouble confidence;
+
+        ok = gst_vosk_cbor_read_number (reader, &confidence);
+        result->confidence = confidence;
+        break;
+      }
+
+      case KEY_ALTERNATIVES:
+        if (depth > 0 ||
+            !gst_vosk_cbor_read_head (reader, &major, &info, &value) ||
+            major != CBOR_ARRAY ||
+            value > reader->size - reader->pos) {
+          ok = FALSE;
+          break;
+        }
+
+        if (result->alternatives)
+          g_ptr_array_unref (result->alternatives);
+        result->alternatives = g_ptr_array_new_full (value,
+                                                     (GDestroyNotify) gst_vosk_result_free);
+
+        for (ok = TRUE; ok && value > 0; value--) {
+          GstVoskResult *alternative = gst_vosk_cbor_read_result (reader, depth + 1);
+
+          if (alternative)
+            g_ptr_array_add (result->alternatives, alternative);
+          else
+            ok = FALSE;
+        }
+        break;
+
+      default:
+        ok = gst_vosk_cbor_skip (reader, depth + 1);
+        break;
+    }
+
+    if (!ok)
+      goto error;
+  }
+
+  if (!result->text)
+    result->text = g_strdup ("");
+
+  return result;
+
+error:
+  gst_vosk_result_free (result);
+  return NULL;
+}
+
+GstVoskResult *
+gst_vosk_result_decode (GBytes *bytes)
+{
+  GstVoskCborReader reader = { NULL, 0, 0 };
+  GstVoskResult *result;
+
+  g_return_val_if_fail (bytes != NULL, NULL);
+
+  reader.data = g_bytes_get_data (bytes, &reader.size);
+  result = gst_vosk_cbor_read_result (&reader, 0);
+
+  /* Trailing data means this is not one of our results */
+  if (result && reader.pos != reader.size) {
+    gst_vosk_result_free (result);
+    return NULL;
+  }
+
+  return result;
+}
+
+void
+gst_vosk_result_free (GstVoskResult *result)
+{
+  if (!result)
+    return;
+
+  g_free (result->text);
+  if (result->words)
+    g_array_unref (result->words);
+  if (result->alternatives)
+    g_ptr_array_unref (result->alternatives);
+  g_free (result);
+}
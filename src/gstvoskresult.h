@@ -0,0 +1,70 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GST_VOSK_RESULT_H__
+#define __GST_VOSK_RESULT_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Compact encoding of the results of libvosk, much smaller than its JSON and
+ * cheaper to read. It is CBOR (RFC 8949): a map with integer keys
+ *
+ *   0  text (text string), that of the result or of the partial result
+ *   1  true for a partial result (absent otherwise)
+ *   2  words, array of [word (text string), start, end, conf], times in
+ *      seconds, conf is null when libvosk did not give it
+ *   3  alternatives, array of maps with keys 0 (text), 4 (confidence) and 2
+ *      (words)
+ *
+ * Times are float64, confidences float32. Decoders must accept either width
+ * (and unsigned integers) and ignore keys they do not know.
+ *
+ * The decoder is libgstvoskresult, which only needs GLib: applications that
+ * read results need neither GStreamer nor libvosk. The encoder is
+ * gst_vosk_result_encode () of libgstvoskcore.
+ */
+
+typedef struct {
+  gchar   *word;
+  gdouble  start;
+  gdouble  end;
+  gfloat   conf;         /* -1.0 when not given */
+} GstVoskWord;
+
+typedef struct _GstVoskResult GstVoskResult;
+
+struct _GstVoskResult {
+  gchar     *text;
+  gboolean   partial;
+  gfloat     confidence;   /* alternatives only, -1.0 otherwise */
+  GArray    *words;        /* of GstVoskWord, NULL when not given */
+  GPtrArray *alternatives; /* of GstVoskResult, NULL when not given */
+};
+
+/* Returns NULL if bytes is not a valid encoded result */
+GstVoskResult *gst_vosk_result_decode (GBytes *bytes);
+
+void gst_vosk_result_free (GstVoskResult *result);
+
+G_END_DECLS
+
+#endif /* __GST_VOSK_RESULT_H__ */
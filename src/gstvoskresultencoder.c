@@ -0,0 +1,250 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <string.h>
+
+#include <json-glib/json-glib.h>
+
+#include "gstvoskcbor.h"
+#include "gstvoskcore.h"
+
+static void
+gst_vosk_cbor_head (GByteArray *out,
+                    guint8 major,
+                    guint64 value)
+{
+  guint8 head[9];
+  guint len, i;
+
+  if (value < 24) {
+    head[0] = (major << 5) | value;
+    len = 1;
+  }
+  else if (value <= G_MAXUINT8) {
+    head[0] = (major << 5) | 24;
+    len = 2;
+  }
+  else if (value <= G_MAXUINT16) {
+    head[0] = (major << 5) | 25;
+    len = 3;
+  }
+  else if (value <= G_MAXUINT32) {
+    head[0] = (major << 5) | 26;
+    len = 5;
+  }
+  else {
+    head[0] = (major << 5) | 27;
+    len = 9;
+  }
+
+  /* Big endian */
+  for (i = len - 1; i > 0; i--) {
+    head[i] = value & 0xff;
+    value >>= 8;
+  }
+
+  g_byte_array_append (out, head, len);
+}
+
+static void
+gst_vosk_cbor_text (GByteArray *out,
+                    const gchar *text)
+{
+  gsize len = text ? strlen (text) : 0;
+
+  gst_vosk_cbor_head (out, CBOR_TEXT, len);
+  g_byte_array_append (out, (const guint8 *) text, len);
+}
+
+static void
+gst_vosk_cbor_float (GByteArray *out,
+                     gdouble value)
+{
+  union { gfloat f; guint32 u; } bits;
+  guint8 item[5];
+
+  bits.f = value;
+  item[0] = (CBOR_SIMPLE << 5) | 26;
+  item[1] = bits.u >> 24;
+  item[2] = bits.u >> 16;
+  item[3] = bits.u >> 8;
+  item[4] = bits.u;
+  g_byte_array_append (out, item, sizeof (item));
+}
+
+/* Times: float32 would only keep 1 ms of resolution up to 4.6 hours */
+static void
+gst_vosk_cbor_double (GByteArray *out,
+                      gdouble value)
+{
+  union { gdouble d; guint64 u; } bits;
+  guint8 item[9];
+  guint i;
+
+  bits.d = value;
+  item[0] = (CBOR_SIMPLE << 5) | 27;
+  for (i = 8; i > 0; i--) {
+    item[i] = bits.u & 0xff;
+    bits.u >>= 8;
+  }
+  g_byte_array_append (out, item, sizeof (item));
+}
+
+static void
+gst_vosk_cbor_simple (GByteArray *out,
+                      guint8 value)
+{
+  gst_vosk_cbor_head (out, CBOR_SIMPLE, value);
+}
+
+static void
+gst_vosk_result_encode_words (GByteArray *out,
+                              JsonArray *words)
+{
+  guint i, len;
+
+  len = json_array_get_length (words);
+  gst_vosk_cbor_head (out, CBOR_ARRAY, len);
+
+  for (i = 0; i < len; i++) {
+    JsonObject *word = json_array_get_object_element (words, i);
+
+    gst_vosk_cbor_head (out, CBOR_ARRAY, 4);
+    if (!word) {
+      gst_vosk_cbor_text (out, NULL);
+      gst_vosk_cbor_double (out, 0.0);
+      gst_vosk_cbor_double (out, 0.0);
+      gst_vosk_cbor_simple (out, CBOR_NULL);
+      continue;
+    }
+
+    gst_vosk_cbor_text (out, json_object_get_string_member_with_default (word, "word", ""));
+    gst_vosk_cbor_double (out, json_object_get_double_member_with_default (word, "start", 0.0));
+    gst_vosk_cbor_double (out, json_object_get_double_member_with_default (word, "end", 0.0));
+    if (json_object_has_member (word, "conf"))
+      gst_vosk_cbor_float (out, json_object_get_double_member (word, "conf"));
+    else
+      gst_vosk_cbor_simple (out, CBOR_NULL);
+  }
+}
+
+static JsonArray *
+gst_vosk_result_get_array (JsonObject *object,
+                           const gchar *member)
+{
+  JsonNode *node = json_object_get_member (object, member);
+
+  if (!node || !JSON_NODE_HOLDS_ARRAY (node))
+    return NULL;
+
+  return json_node_get_array (node);
+}
+
+static void
+gst_vosk_result_encode_alternative (GByteArray *out,
+                                    JsonObject *alternative)
+{
+  JsonArray *words;
+
+  words = alternative ? gst_vosk_result_get_array (alternative, "result") : NULL;
+
+  gst_vosk_cbor_head (out, CBOR_MAP, words ? 3 : 2);
+  gst_vosk_cbor_head (out, CBOR_UINT, KEY_TEXT);
+  gst_vosk_cbor_text (out, alternative ?
+                      json_object_get_string_member_with_default (alternative, "text", "") :
+                      NULL);
+  gst_vosk_cbor_head (out, CBOR_UINT, KEY_CONFIDENCE);
+  gst_vosk_cbor_float (out, alternative ?
+                       json_object_get_double_member_with_default (alternative, "confidence", -1.0) :
+                       -1.0);
+  if (words) {
+    gst_vosk_cbor_head (out, CBOR_UINT, KEY_WORDS);
+    gst_vosk_result_encode_words (out, words);
+  }
+}
+
+GBytes *
+gst_vosk_result_encode (const gchar *json_result)
+{
+  JsonParser *parser;
+  JsonObject *object;
+  JsonArray *words, *alternatives;
+  const gchar *text;
+  gboolean partial;
+  GByteArray *out;
+  guint pairs;
+
+  g_return_val_if_fail (json_result != NULL, NULL);
+
+  parser = json_parser_new_immutable ();
+  if (!json_parser_load_from_data (parser, json_result, -1, NULL) ||
+      !JSON_NODE_HOLDS_OBJECT (json_parser_get_root (parser))) {
+    g_object_unref (parser);
+    return NULL;
+  }
+
+  object = json_node_get_object (json_parser_get_root (parser));
+
+  partial = json_object_has_member (object, "partial");
+  text = json_object_get_string_member_with_default (object,
+                                                     partial ? "partial" : "text",
+                                                     NULL);
+  words = gst_vosk_result_get_array (object, partial ? "partial_result" : "result");
+  alternatives = gst_vosk_result_get_array (object, "alternatives");
+
+  /* Results with alternatives have no text of their own: that of the best
+   * one is the text of the result */
+  if (!text && alternatives && json_array_get_length (alternatives)) {
+    JsonObject *best = json_array_get_object_element (alternatives, 0);
+
+    if (best)
+      text = json_object_get_string_member_with_default (best, "text", NULL);
+  }
+
+  pairs = 1 + (partial ? 1 : 0) + (words ? 1 : 0) + (alternatives ? 1 : 0);
+
+  out = g_byte_array_sized_new (64);
+  gst_vosk_cbor_head (out, CBOR_MAP, pairs);
+
+  gst_vosk_cbor_head (out, CBOR_UINT, KEY_TEXT);
+  gst_vosk_cbor_text (out, text);
+
+  if (partial) {
+    gst_vosk_cbor_head (out, CBOR_UINT, KEY_PARTIAL);
+    gst_vosk_cbor_simple (out, CBOR_TRUE);
+  }
+
+  if (words) {
+    gst_vosk_cbor_head (out, CBOR_UINT, KEY_WORDS);
+    gst_vosk_result_encode_words (out, words);
+  }
+
+  if (alternatives) {
+    guint i, len;
+
+    len = json_array_get_length (alternatives);
+    gst_vosk_cbor_head (out, CBOR_UINT, KEY_ALTERNATIVES);
+    gst_vosk_cbor_head (out, CBOR_ARRAY, len);
+    for (i = 0; i < len; i++)
+      gst_vosk_result_encode_alternative (out, json_array_get_object_element (alternatives, i));
+  }
+
+  g_object_unref (parser);
+  return g_byte_array_free_to_bytes (out);
+}
@@ -0,0 +1,465 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Sweeps a grid of vosk element settings on a corpus and, for each point of
+ * the grid, looks for the highest number of concurrent realtime streams the
+ * host sustains while keeping the lag of recognition below a target at a
+ * given percentile. The best settings are saved in a key file that the
+ * element loads with its config-file property.
+ *
+ * gst-vosk-autotune --manifest corpus.tsv --model /path/model \
+ *                   --param partial-results-interval=-1,250,1000 \
+ *                   --param chunk-duration=0,100 \
+ *                   --lag 0.5 --percentile 95 --output vosk.conf
+ *
+ * chunk-duration is not an element property: it is the duration (ms) of the
+ * buffers fed to the element and ends up in the [pipeline] group.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gstvosktool.h"
+
+#define GST_VOSK_AUTOTUNE_CHUNK_DURATION "chunk-duration"
+
+static const gchar *default_grid[] = {
+  "partial-results-interval=-1,250,1000",
+  GST_VOSK_AUTOTUNE_CHUNK_DURATION "=0,100",
+  NULL
+};
+
+typedef struct {
+  gchar  *name;
+  gchar **values;
+} GstVoskAutotuneParameter;
+
+typedef struct {
+  GPtrArray   *samples;
+  GPtrArray   *parameters;
+  const gchar *base_config;
+  gint         rate;
+  gdouble      lag;
+  gdouble      percentile;
+  guint        max_streams;
+} GstVoskAutotune;
+
+typedef struct {
+  GstVoskAutotune   *tune;
+  GstVoskToolSample *sample;
+  const gchar       *config;
+  gint               chunk_duration;
+  GstVoskToolRun     run;
+} GstVoskAutotuneStream;
+
+static void
+gst_vosk_autotune_parameter_free (GstVoskAutotuneParameter *parameter)
+{
+  g_free (parameter->name);
+  g_strfreev (parameter->values);
+  g_free (parameter);
+}
+
+static GstVoskAutotuneParameter *
+gst_vosk_autotune_parameter_parse (const gchar *string)
+{
+  GstVoskAutotuneParameter *parameter;
+  gchar **fields;
+
+  fields = g_strsplit (string, "=", 2);
+  if (!fields[0] || !fields[1] || fields[0][0] == '\0' || fields[1][0] == '\0') {
+    g_strfreev (fields);
+    return NULL;
+  }
+
+  parameter = g_new0 (GstVoskAutotuneParameter, 1);
+  parameter->name = g_strdup (g_strstrip (fields[0]));
+  parameter->values = g_strsplit (fields[1], ",", -1);
+
+  g_strfreev (fields);
+  return parameter;
+}
+
+static gpointer
+gst_vosk_autotune_stream (gpointer user_data)
+{
+  GstVoskAutotuneStream *stream = user_data;
+
+  gst_vosk_tool_run_file (stream->sample->audio,
+                          stream->config,
+                          stream->tune->rate,
+                          stream->chunk_duration,
+                          TRUE,
+                          &stream->run);
+  return NULL;
+}
+
+/* Returns FALSE if a stream failed or if the lag is over the target */
+static gboolean
+gst_vosk_autotune_measure (GstVoskAutotune *tune,
+                           const gchar *config,
+                           gint chunk_duration,
+                           guint num_streams,
+                           gdouble *lag)
+{
+  GstVoskAutotuneStream *streams;
+  gboolean success = TRUE;
+  GThread **threads;
+  GArray *lags;
+  guint i;
+
+  streams = g_new0 (GstVoskAutotuneStream, num_streams);
+  threads = g_new0 (GThread *, num_streams);
+
+  for (i = 0; i < num_streams; i++) {
+    streams[i].tune = tune;
+    streams[i].sample = g_ptr_array_index (tune->samples, i % tune->samples->len);
+    streams[i].config = config;
+    streams[i].chunk_duration = chunk_duration;
+    threads[i] = g_thread_new ("autotune", gst_vosk_autotune_stream, &streams[i]);
+  }
+
+  lags = g_array_new (FALSE, FALSE, sizeof (gdouble));
+  for (i = 0; i < num_streams; i++) {
+    g_thread_join (threads[i]);
+
+    if (streams[i].run.error) {
+      g_printerr ("  %s: %s\n", streams[i].sample->audio, streams[i].run.error);
+      success = FALSE;
+    }
+    else if (streams[i].run.lags)
+      g_array_append_vals (lags, streams[i].run.lags->data, streams[i].run.lags->len);
+
+    gst_vosk_tool_run_clear (&streams[i].run);
+  }
+
+  *lag = gst_vosk_tool_percentile (lags, tune->percentile);
+  if (*lag > tune->lag)
+    success = FALSE;
+
+  g_print ("  %3u streams: p%.0f lag %.3f s%s\n",
+           num_streams, tune->percentile, *lag, success ? "" : " (missed)");
+
+  g_array_unref (lags);
+  g_free (threads);
+  g_free (streams);
+  return success;
+}
+
+/*
+ * Doubles the number of streams until the target is missed, then bisects.
+ * Returns 0 if a single stream cannot keep up.
+ */
+static guint
+gst_vosk_autotune_max_streams (GstVoskAutotune *tune,
+                               const gchar *config,
+                               gint chunk_duration,
+                               gdouble *lag)
+{
+  guint good = 0, bad = tune->max_streams + 1;
+
+  *lag = -1.0;
+
+  while (good + 1 < bad) {
+    gdouble measured;
+    guint num;
+
+    if (bad > tune->max_streams)
+      num = MIN (good ? good * 2 : 1, tune->max_streams);
+    else
+      num = (good + bad) / 2;
+
+    if (gst_vosk_autotune_measure (tune, config, chunk_duration, num, &measured)) {
+      good = num;
+      *lag = measured;
+    }
+    else
+      bad = num;
+  }
+
+  return good;
+}
+
+/* Fills values with the current point of the grid, returns FALSE past the end */
+static gboolean
+gst_vosk_autotune_next (GstVoskAutotune *tune,
+                        guint *indexes,
+                        gboolean first)
+{
+  guint i;
+
+  if (first)
+    return TRUE;
+
+  for (i = 0; i < tune->parameters->len; i++) {
+    GstVoskAutotuneParameter *parameter = g_ptr_array_index (tune->parameters, i);
+
+    if (parameter->values[++indexes[i]])
+      return TRUE;
+
+    indexes[i] = 0;
+  }
+
+  return FALSE;
+}
+
+static gchar *
+gst_vosk_autotune_config (GstVoskAutotune *tune,
+                          const guint *indexes,
+                          gint *chunk_duration)
+{
+  GString *config;
+  guint i;
+
+  config = g_string_new (tune->base_config);
+  *chunk_duration = 0;
+
+  for (i = 0; i < tune->parameters->len; i++) {
+    GstVoskAutotuneParameter *parameter = g_ptr_array_index (tune->parameters, i);
+    const gchar *value = parameter->values[indexes[i]];
+
+    if (!g_strcmp0 (parameter->name, GST_VOSK_AUTOTUNE_CHUNK_DURATION)) {
+      *chunk_duration = atoi (value);
+      continue;
+    }
+
+    g_string_append_printf (config, " %s=%s", parameter->name, value);
+  }
+
+  return g_string_free (config, FALSE);
+}
+
+static gboolean
+gst_vosk_autotune_save (GstVoskAutotune *tune,
+                        const gchar *config,
+                        gint chunk_duration,
+                        guint num_streams,
+                        gdouble lag,
+                        const gchar *path,
+                        GError **error)
+{
+  GKeyFile *key_file;
+  gboolean result;
+  gchar **properties = NULL;
+  gchar *comment;
+  guint i;
+
+  key_file = g_key_file_new ();
+
+  /* Quotes around values are only needed by gst_parse_launch () */
+  g_shell_parse_argv (config, NULL, &properties, NULL);
+  for (i = 0; properties && properties[i]; i++) {
+    gchar **fields;
+
+    fields = g_strsplit (properties[i], "=", 2);
+    if (fields[0] && fields[1])
+      g_key_file_set_value (key_file, "vosk", fields[0], fields[1]);
+    g_strfreev (fields);
+  }
+  g_strfreev (properties);
+
+  /* Not used by the element, this is what the host was measured with */
+  g_key_file_set_integer (key_file, "pipeline", GST_VOSK_AUTOTUNE_CHUNK_DURATION, chunk_duration);
+  g_key_file_set_integer (key_file, "pipeline", "max-streams", num_streams);
+
+  comment = g_strdup_printf (" Generated by gst-vosk-autotune on %s\n"
+                             " %u concurrent streams with a p%.0f lag of %.3f s (target %.3f s)",
+                             g_get_host_name (),
+                             num_streams,
+                             tune->percentile,
+                             lag,
+                             tune->lag);
+  g_key_file_set_comment (key_file, NULL, NULL, comment, NULL);
+  g_free (comment);
+
+  result = g_key_file_save_to_file (key_file, path, error);
+  g_key_file_free (key_file);
+  return result;
+}
+
+int
+main (int argc,
+      char **argv)
+{
+  gchar *best_config = NULL;
+  gchar **param_strings = NULL;
+  gchar *plugin_dir = NULL;
+  gchar *base_config = NULL;
+  gchar *manifest = NULL;
+  gchar *output = NULL;
+  gchar *model = NULL;
+  GstVoskAutotune tune;
+  GOptionContext *context;
+  GError *error = NULL;
+  gint best_chunk_duration = 0;
+  guint best_streams = 0;
+  gdouble best_lag = -1.0;
+  gint max_streams = 0;
+  gint rate = 16000;
+  gdouble lag = 1.0;
+  gdouble percentile = 95.0;
+  gboolean first;
+  guint *indexes;
+  guint i;
+
+  GOptionEntry entries[] = {
+    { "manifest", 'm', 0, G_OPTION_ARG_FILENAME, &manifest,
+      "Corpus manifest (audio<TAB>reference per line)", "FILE" },
+    { "model", 0, 0, G_OPTION_ARG_FILENAME, &model,
+      "Speech model to tune for", "DIR" },
+    { "config", 'c', 0, G_OPTION_ARG_STRING, &base_config,
+      "Properties of the vosk element that are not tuned (\"prop=value ...\")", "PROPS" },
+    { "param", 'P', 0, G_OPTION_ARG_STRING_ARRAY, &param_strings,
+      "Parameter and values to try (\"name=value,value...\"), may be repeated", "PARAM" },
+    { "lag", 'l', 0, G_OPTION_ARG_DOUBLE, &lag,
+      "Maximum lag of recognition in seconds", "SECONDS" },
+    { "percentile", 0, 0, G_OPTION_ARG_DOUBLE, &percentile,
+      "Percentile of the lag compared with the target", "PERCENT" },
+    { "max-streams", 's', 0, G_OPTION_ARG_INT, &max_streams,
+      "Maximum number of concurrent streams tried (default: twice the number of CPUs)", "N" },
+    { "rate", 'r', 0, G_OPTION_ARG_INT, &rate,
+      "Sample rate fed to the element", "RATE" },
+    { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output,
+      "Configuration file written (default: gst-vosk.conf)", "FILE" },
+    { "plugin-dir", 'p', 0, G_OPTION_ARG_FILENAME, &plugin_dir,
+      "Directory holding the vosk plugin", "DIR" },
+    G_OPTION_ENTRY_NULL
+  };
+
+  context = g_option_context_new ("- tune the vosk element for this host");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("%s\n", error->message);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free (context);
+
+  if (!manifest || manifest[0] == '\0') {
+    g_printerr ("a manifest is required (--manifest)\n");
+    return EXIT_FAILURE;
+  }
+
+  if (max_streams <= 0)
+    max_streams = g_get_num_processors () * 2;
+
+  if (rate < 1 || lag <= 0.0 || percentile <= 0.0 || percentile > 100.0) {
+    g_printerr ("invalid rate, lag or percentile\n");
+    return EXIT_FAILURE;
+  }
+
+  memset (&tune, 0, sizeof (tune));
+  tune.rate = rate;
+  tune.lag = lag;
+  tune.percentile = percentile;
+  tune.max_streams = max_streams;
+
+  tune.parameters = g_ptr_array_new_with_free_func ((GDestroyNotify) gst_vosk_autotune_parameter_free);
+  for (i = 0; (param_strings ? param_strings[i] : default_grid[i]); i++) {
+    const gchar *string = param_strings ? param_strings[i] : default_grid[i];
+    GstVoskAutotuneParameter *parameter;
+
+    parameter = gst_vosk_autotune_parameter_parse (string);
+    if (!parameter) {
+      g_printerr ("invalid parameter %s (expected \"name=value,value...\")\n", string);
+      return EXIT_FAILURE;
+    }
+
+    g_ptr_array_add (tune.parameters, parameter);
+  }
+
+  if (model)
+    tune.base_config = g_strdup_printf ("speech-model=\"%s\" %s", model, base_config ? base_config : "");
+  else
+    tune.base_config = g_strdup (base_config ? base_config : "");
+
+  if (!gst_vosk_tool_init (plugin_dir, &error)) {
+    g_printerr ("%s\n", error->message);
+    return EXIT_FAILURE;
+  }
+
+  tune.samples = gst_vosk_tool_load_manifest (manifest, &error);
+  if (!tune.samples) {
+    g_printerr ("%s\n", error->message);
+    return EXIT_FAILURE;
+  }
+
+  if (!tune.samples->len) {
+    g_printerr ("%s is empty\n", manifest);
+    return EXIT_FAILURE;
+  }
+
+  indexes = g_new0 (guint, tune.parameters->len);
+  for (first = TRUE; gst_vosk_autotune_next (&tune, indexes, first); first = FALSE) {
+    gint chunk_duration;
+    guint num_streams;
+    gdouble measured;
+    gchar *config;
+
+    config = gst_vosk_autotune_config (&tune, indexes, &chunk_duration);
+    g_print ("%s (chunks of %d ms)\n", config, chunk_duration);
+
+    num_streams = gst_vosk_autotune_max_streams (&tune, config, chunk_duration, &measured);
+
+    /* Ties go to the lowest lag */
+    if (num_streams > best_streams ||
+        (num_streams == best_streams && num_streams && measured < best_lag)) {
+      g_free (best_config);
+      best_config = config;
+      best_chunk_duration = chunk_duration;
+      best_streams = num_streams;
+      best_lag = measured;
+    }
+    else
+      g_free (config);
+  }
+  g_free (indexes);
+
+  if (!best_streams) {
+    g_printerr ("no setting allowed a single stream to keep a p%.0f lag below %.3f s\n",
+                percentile, lag);
+    return EXIT_FAILURE;
+  }
+
+  g_print ("\nbest: %s (chunks of %d ms), %u streams, p%.0f lag %.3f s\n",
+           best_config, best_chunk_duration, best_streams, percentile, best_lag);
+
+  if (!gst_vosk_autotune_save (&tune,
+                               best_config,
+                               best_chunk_duration,
+                               best_streams,
+                               best_lag,
+                               output ? output : "gst-vosk.conf",
+                               &error)) {
+    g_printerr ("%s\n", error->message);
+    return EXIT_FAILURE;
+  }
+
+  g_free (best_config);
+  g_free ((gchar *) tune.base_config);
+  g_ptr_array_unref (tune.parameters);
+  g_ptr_array_unref (tune.samples);
+  g_strfreev (param_strings);
+  g_free (plugin_dir);
+  g_free (manifest);
+  g_free (output);
+  g_free (model);
+  g_free (base_config);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,124 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Checks of the recognition core, run against the stub libvosk of
+ * tools/vosk-stub (meson test). The stub ends an utterance every two seconds
+ * of audio and gives it one word spanning it, so results are predictable.
+ */
+
+#include <gst/gst.h>
+#include <json-glib/json-glib.h>
+
+#include "gstvoskcore.h"
+
+#define CHECK_RATE 16000
+#define CHECK_CHUNK (CHECK_RATE / 10)
+
+/* Feeds duration seconds of silence and returns the start and end times of
+ * the words of the final results, in order */
+static GArray *
+gst_vosk_check_feed (GstVoskCore *core,
+                     guint duration)
+{
+  gint16 silence[CHECK_CHUNK] = { 0, };
+  GstVoskCoreResult *result;
+  GArray *times;
+  guint i;
+
+  times = g_array_new (FALSE, FALSE, sizeof (gdouble));
+
+  for (i = 0; i < duration * 10; i++) {
+    g_assert_true (gst_vosk_core_feed (core, silence, CHECK_CHUNK));
+
+    while ((result = gst_vosk_core_pop_result (core))) {
+      JsonParser *parser = json_parser_new ();
+      JsonObject *object;
+      JsonArray *words;
+      guint j;
+
+      g_assert_true (json_parser_load_from_data (parser, result->json, -1, NULL));
+      object = json_node_get_object (json_parser_get_root (parser));
+
+      if (result->type == GST_VOSK_CORE_RESULT_FINAL &&
+          json_object_has_member (object, "result")) {
+        words = json_object_get_array_member (object, "result");
+        for (j = 0; j < json_array_get_length (words); j++) {
+          JsonObject *word = json_array_get_object_element (words, j);
+          gdouble start = json_object_get_double_member (word, "start");
+          gdouble end = json_object_get_double_member (word, "end");
+
+          g_array_append_val (times, start);
+          g_array_append_val (times, end);
+        }
+      }
+
+      g_object_unref (parser);
+      gst_vosk_core_result_free (result);
+    }
+  }
+
+  return times;
+}
+
+/* Recycled recognizers time their words from 0: the core must keep them on
+ * the timeline of the stream */
+static void
+gst_vosk_check_recycle_times (void)
+{
+  GstVoskCoreStats stats;
+  GstVoskCore *core;
+  GArray *times;
+  guint i;
+
+  core = gst_vosk_core_new ("stub-model", NULL);
+  g_assert_nonnull (core);
+
+  gst_vosk_core_set_partial_interval (core, -1);
+  gst_vosk_core_set_recycle_interval (core, 5 * GST_SECOND);
+  g_assert_true (gst_vosk_core_start (core, CHECK_RATE));
+
+  times = gst_vosk_check_feed (core, 30);
+
+  gst_vosk_core_get_stats (core, &stats);
+  g_assert_cmpuint (stats.recognizer_recycles, >, 0);
+
+  g_assert_cmpuint (times->len, >=, 2 * 14);
+  for (i = 1; i < times->len; i++)
+    g_assert_cmpfloat (g_array_index (times, gdouble, i), >=,
+                       g_array_index (times, gdouble, i - 1) - 0.001);
+
+  /* The last utterance ends with the audio */
+  g_assert_cmpfloat_with_epsilon (g_array_index (times, gdouble, times->len - 1), 30.0, 0.01);
+
+  g_array_unref (times);
+  gst_vosk_core_free (core);
+}
+
+int
+main (int argc,
+      char **argv)
+{
+  gst_init (&argc, &argv);
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/core/recycle-times", gst_vosk_check_recycle_times);
+
+  return g_test_run ();
+}
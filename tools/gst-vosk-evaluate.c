@@ -0,0 +1,421 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Runs a corpus through the vosk element with one or two configurations and
+ * reports accuracy (WER/CER) next to speed (RTF, latency, memory).
+ *
+ * gst-vosk-evaluate --manifest corpus.tsv --jobs 4 \
+ *                   --config-a "speech-model=/path/small" \
+ *                   --config-b "speech-model=/path/small alternatives=3"
+ *
+ * Each manifest line holds an audio file path (relative to the manifest) and
+ * its reference transcript separated by a tabulation.
+ *
+ * Files decoded in parallel share the CPU: RTF (of a file or of the
+ * configuration) is only that of the element with --jobs 1, xRT tells the
+ * throughput.
+ *
+ * Each file is decoded by a process of its own (this program run with
+ * --run-file), so that the peak memory of a file, model included, is not
+ * mixed with that of the other files and of the other configuration.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "gstvosktool.h"
+
+#define RUN_GROUP "run"
+
+typedef struct {
+  const gchar    *name;
+  const gchar    *config;
+  const gchar    *program;
+  const gchar    *plugin_dir;
+  GPtrArray      *samples;
+  GstVoskToolRun *runs;
+  guint64        *peak_rss;     /* bytes, of the process of each file */
+  guint           next;
+  GMutex          lock;
+  gint            rate;
+  gdouble         elapsed;
+} GstVoskEvaluation;
+
+typedef struct {
+  guint   word_errors;
+  guint   words;
+  guint   char_errors;
+  guint   chars;
+  gdouble audio;
+  gdouble wall;
+  gdouble elapsed;
+  GArray *final_latencies;
+  guint64 peak_rss;
+  guint   failures;
+} GstVoskEvaluationSummary;
+
+/*
+ * Child side: decodes a single file and prints what was measured, with the
+ * peak memory of the process, as a key file on stdout.
+ */
+static int
+gst_vosk_evaluate_run_file (const gchar *audio,
+                            const gchar *config,
+                            gint rate,
+                            const gchar *plugin_dir)
+{
+  GstVoskToolRun run = { 0, };
+  GError *error = NULL;
+  struct rusage usage;
+  GKeyFile *key_file;
+  gchar *data;
+
+  key_file = g_key_file_new ();
+
+  if (!gst_vosk_tool_init (plugin_dir, &error)) {
+    g_key_file_set_string (key_file, RUN_GROUP, "error", error->message);
+    g_clear_error (&error);
+  }
+  else {
+    gst_vosk_tool_run_file (audio, config, rate, 0, FALSE, &run);
+    if (run.error)
+      g_key_file_set_string (key_file, RUN_GROUP, "error", run.error);
+    g_key_file_set_string (key_file, RUN_GROUP, "hypothesis",
+                           run.hypothesis ? run.hypothesis : "");
+    g_key_file_set_uint64 (key_file, RUN_GROUP, "audio-bytes", run.audio_bytes);
+    g_key_file_set_double (key_file, RUN_GROUP, "audio-duration", run.audio_duration);
+    g_key_file_set_double (key_file, RUN_GROUP, "wall-time", run.wall_time);
+    g_key_file_set_double (key_file, RUN_GROUP, "first-result-latency", run.first_result_latency);
+    g_key_file_set_double (key_file, RUN_GROUP, "final-latency", run.final_latency);
+    gst_vosk_tool_run_clear (&run);
+  }
+
+  /* Kilobytes on Linux */
+  if (getrusage (RUSAGE_SELF, &usage) == 0)
+    g_key_file_set_uint64 (key_file, RUN_GROUP, "peak-rss", (guint64) usage.ru_maxrss * 1024);
+
+  data = g_key_file_to_data (key_file, NULL, NULL);
+  g_print ("%s", data);
+  g_free (data);
+  g_key_file_free (key_file);
+  return EXIT_SUCCESS;
+}
+
+/*
+ * Parent side: runs the child for a file and reads back its measures.
+ */
+static void
+gst_vosk_evaluate_spawn (GstVoskEvaluation *evaluation,
+                         GstVoskToolSample *sample,
+                         GstVoskToolRun *run,
+                         guint64 *peak_rss)
+{
+  GPtrArray *args;
+  GError *error = NULL;
+  GKeyFile *key_file;
+  gchar *output = NULL;
+  gchar *rate;
+  gint status;
+
+  rate = g_strdup_printf ("%d", evaluation->rate);
+
+  args = g_ptr_array_new ();
+  g_ptr_array_add (args, (gpointer) evaluation->program);
+  g_ptr_array_add (args, "--run-file");
+  g_ptr_array_add (args, sample->audio);
+  g_ptr_array_add (args, "--config-a");
+  g_ptr_array_add (args, (gpointer) evaluation->config);
+  g_ptr_array_add (args, "--rate");
+  g_ptr_array_add (args, rate);
+  if (evaluation->plugin_dir) {
+    g_ptr_array_add (args, "--plugin-dir");
+    g_ptr_array_add (args, (gpointer) evaluation->plugin_dir);
+  }
+  g_ptr_array_add (args, NULL);
+
+  key_file = g_key_file_new ();
+
+  if (!g_spawn_sync (NULL, (gchar **) args->pdata, NULL, G_SPAWN_SEARCH_PATH,
+                     NULL, NULL, &output, NULL, &status, &error) ||
+      !g_spawn_check_wait_status (status, &error) ||
+      !g_key_file_load_from_data (key_file, output, -1, G_KEY_FILE_NONE, &error)) {
+    run->error = g_strdup (error->message);
+    g_clear_error (&error);
+    goto end;
+  }
+
+  run->error = g_key_file_get_string (key_file, RUN_GROUP, "error", NULL);
+  run->hypothesis = g_key_file_get_string (key_file, RUN_GROUP, "hypothesis", NULL);
+  run->audio_bytes = g_key_file_get_uint64 (key_file, RUN_GROUP, "audio-bytes", NULL);
+  run->audio_duration = g_key_file_get_double (key_file, RUN_GROUP, "audio-duration", NULL);
+  run->wall_time = g_key_file_get_double (key_file, RUN_GROUP, "wall-time", NULL);
+  run->first_result_latency = g_key_file_get_double (key_file, RUN_GROUP, "first-result-latency", NULL);
+  run->final_latency = g_key_file_get_double (key_file, RUN_GROUP, "final-latency", NULL);
+  *peak_rss = g_key_file_get_uint64 (key_file, RUN_GROUP, "peak-rss", NULL);
+
+end:
+  g_key_file_free (key_file);
+  g_ptr_array_free (args, TRUE);
+  g_free (output);
+  g_free (rate);
+}
+
+static gpointer
+gst_vosk_evaluate_worker (gpointer user_data)
+{
+  GstVoskEvaluation *evaluation = user_data;
+
+  while (TRUE) {
+    guint index;
+
+    g_mutex_lock (&evaluation->lock);
+    index = evaluation->next++;
+    g_mutex_unlock (&evaluation->lock);
+
+    if (index >= evaluation->samples->len)
+      break;
+
+    gst_vosk_evaluate_spawn (evaluation,
+                             g_ptr_array_index (evaluation->samples, index),
+                             &evaluation->runs[index],
+                             &evaluation->peak_rss[index]);
+  }
+
+  return NULL;
+}
+
+static void
+gst_vosk_evaluate_run (GstVoskEvaluation *evaluation,
+                       guint jobs)
+{
+  GThread **threads;
+  gint64 start;
+  guint i;
+
+  evaluation->runs = g_new0 (GstVoskToolRun, evaluation->samples->len);
+  evaluation->peak_rss = g_new0 (guint64, evaluation->samples->len);
+  g_mutex_init (&evaluation->lock);
+
+  start = g_get_monotonic_time ();
+
+  threads = g_new0 (GThread *, jobs);
+  for (i = 0; i < jobs; i++)
+    threads[i] = g_thread_new ("evaluate", gst_vosk_evaluate_worker, evaluation);
+
+  for (i = 0; i < jobs; i++)
+    g_thread_join (threads[i]);
+
+  evaluation->elapsed = (gdouble) (g_get_monotonic_time () - start) / G_USEC_PER_SEC;
+
+  g_free (threads);
+  g_mutex_clear (&evaluation->lock);
+}
+
+static void
+gst_vosk_evaluate_report (GstVoskEvaluation *evaluation,
+                          GstVoskEvaluationSummary *summary)
+{
+  guint i;
+
+  memset (summary, 0, sizeof (GstVoskEvaluationSummary));
+  summary->final_latencies = g_array_new (FALSE, FALSE, sizeof (gdouble));
+  summary->elapsed = evaluation->elapsed;
+
+  g_print ("\n== configuration %s: %s\n\n", evaluation->name,
+           evaluation->config[0] ? evaluation->config : "(defaults)");
+  g_print ("%-40s %6s %6s %7s %9s %9s %9s\n",
+           "file", "words", "WER%", "RTF", "first(ms)", "final(ms)", "peak(MB)");
+
+  for (i = 0; i < evaluation->samples->len; i++) {
+    GstVoskToolSample *sample = g_ptr_array_index (evaluation->samples, i);
+    GstVoskToolRun *run = &evaluation->runs[i];
+    guint word_errors, words, char_errors, chars;
+    gchar *basename;
+
+    basename = g_path_get_basename (sample->audio);
+
+    if (run->error) {
+      g_print ("%-40.40s failed: %s\n", basename, run->error);
+      summary->failures++;
+      g_free (basename);
+      continue;
+    }
+
+    gst_vosk_tool_word_errors (sample->reference, run->hypothesis, &word_errors, &words);
+    gst_vosk_tool_char_errors (sample->reference, run->hypothesis, &char_errors, &chars);
+
+    summary->word_errors += word_errors;
+    summary->words += words;
+    summary->char_errors += char_errors;
+    summary->chars += chars;
+    summary->audio += run->audio_duration;
+    summary->wall += run->wall_time;
+    g_array_append_val (summary->final_latencies, run->final_latency);
+    summary->peak_rss = MAX (summary->peak_rss, evaluation->peak_rss[i]);
+
+    g_print ("%-40.40s %6u %6.2f %7.3f %9.0f %9.0f %9.1f\n",
+             basename,
+             words,
+             words ? 100.0 * word_errors / words : 0.0,
+             run->audio_duration > 0.0 ? run->wall_time / run->audio_duration : 0.0,
+             run->first_result_latency * 1000.0,
+             run->final_latency * 1000.0,
+             (gdouble) evaluation->peak_rss[i] / (1024 * 1024));
+
+    g_free (basename);
+  }
+}
+
+static void
+gst_vosk_evaluate_print_summary (const gchar *name,
+                                 GstVoskEvaluationSummary *summary)
+{
+  g_print ("%-6s %7.2f %7.2f %7.3f %9.2f %10.0f %10.0f %8.1f %6u\n",
+           name,
+           summary->words ? 100.0 * summary->word_errors / summary->words : 0.0,
+           summary->chars ? 100.0 * summary->char_errors / summary->chars : 0.0,
+           summary->audio > 0.0 ? summary->wall / summary->audio : 0.0,
+           summary->elapsed > 0.0 ? summary->audio / summary->elapsed : 0.0,
+           gst_vosk_tool_percentile (summary->final_latencies, 50) * 1000.0,
+           gst_vosk_tool_percentile (summary->final_latencies, 95) * 1000.0,
+           (gdouble) summary->peak_rss / (1024 * 1024),
+           summary->failures);
+}
+
+int
+main (int argc,
+      char **argv)
+{
+  GstVoskEvaluationSummary summaries[2];
+  GstVoskEvaluation evaluations[2];
+  gchar *plugin_dir = NULL;
+  gchar *run_file = NULL;
+  gchar *config_a = NULL;
+  gchar *config_b = NULL;
+  gchar *manifest = NULL;
+  GOptionContext *context;
+  GError *error = NULL;
+  GPtrArray *samples;
+  guint num = 1, i, j;
+  gint jobs = 1;
+  gint rate = 16000;
+
+  GOptionEntry entries[] = {
+    { "manifest", 'm', 0, G_OPTION_ARG_FILENAME, &manifest,
+      "Corpus manifest (audio<TAB>reference per line)", "FILE" },
+    { "config-a", 'a', 0, G_OPTION_ARG_STRING, &config_a,
+      "Properties of the vosk element (\"prop=value ...\")", "PROPS" },
+    { "config-b", 'b', 0, G_OPTION_ARG_STRING, &config_b,
+      "Properties of the vosk element to compare with", "PROPS" },
+    { "jobs", 'j', 0, G_OPTION_ARG_INT, &jobs,
+      "Number of files decoded in parallel (RTF is only meaningful with 1)", "N" },
+    { "rate", 'r', 0, G_OPTION_ARG_INT, &rate,
+      "Sample rate fed to the element", "RATE" },
+    { "plugin-dir", 'p', 0, G_OPTION_ARG_FILENAME, &plugin_dir,
+      "Directory holding the vosk plugin", "DIR" },
+    { "run-file", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_FILENAME, &run_file,
+      "Decode a single file with --config-a and print what was measured", "FILE" },
+    G_OPTION_ENTRY_NULL
+  };
+
+  context = g_option_context_new ("- evaluate the vosk element on a corpus");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("%s\n", error->message);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free (context);
+
+  if (run_file)
+    return gst_vosk_evaluate_run_file (run_file, config_a ? config_a : "", rate, plugin_dir);
+
+  if (!manifest || manifest[0] == '\0') {
+    g_printerr ("a manifest is required (--manifest)\n");
+    return EXIT_FAILURE;
+  }
+
+  if (jobs < 1 || rate < 1) {
+    g_printerr ("invalid number of jobs or rate\n");
+    return EXIT_FAILURE;
+  }
+
+  if (jobs > 1)
+    g_print ("%d files are decoded at once: RTF includes the time they wait for the CPU\n",
+             jobs);
+
+  samples = gst_vosk_tool_load_manifest (manifest, &error);
+  if (!samples) {
+    g_printerr ("%s\n", error->message);
+    return EXIT_FAILURE;
+  }
+
+  memset (evaluations, 0, sizeof (evaluations));
+  evaluations[0].name = "A";
+  evaluations[0].config = config_a ? config_a : "";
+  if (config_b && config_b[0] != '\0') {
+    evaluations[1].name = "B";
+    evaluations[1].config = config_b;
+    num = 2;
+  }
+
+  for (i = 0; i < num; i++) {
+    evaluations[i].program = argv[0];
+    evaluations[i].plugin_dir = plugin_dir;
+    evaluations[i].samples = samples;
+    evaluations[i].rate = rate;
+    gst_vosk_evaluate_run (&evaluations[i], jobs);
+    gst_vosk_evaluate_report (&evaluations[i], &summaries[i]);
+  }
+
+  g_print ("\n%-6s %7s %7s %7s %9s %10s %10s %8s %6s\n",
+           "config", "WER%", "CER%", "RTF", "xRT", "final p50", "final p95",
+           "peak(MB)", "failed");
+  for (i = 0; i < num; i++)
+    gst_vosk_evaluate_print_summary (evaluations[i].name, &summaries[i]);
+
+  if (num == 2) {
+    GstVoskEvaluationSummary *a = &summaries[0], *b = &summaries[1];
+
+    g_print ("\nB versus A: WER %+.2f points, RTF %+.1f%%, final latency p95 %+.0f ms\n",
+             (b->words ? 100.0 * b->word_errors / b->words : 0.0) -
+             (a->words ? 100.0 * a->word_errors / a->words : 0.0),
+             a->wall > 0.0 ? 100.0 * (b->wall - a->wall) / a->wall : 0.0,
+             (gst_vosk_tool_percentile (b->final_latencies, 95) -
+              gst_vosk_tool_percentile (a->final_latencies, 95)) * 1000.0);
+  }
+
+  for (i = 0; i < num; i++) {
+    for (j = 0; j < samples->len; j++)
+      gst_vosk_tool_run_clear (&evaluations[i].runs[j]);
+
+    g_free (evaluations[i].runs);
+    g_free (evaluations[i].peak_rss);
+    g_array_unref (summaries[i].final_latencies);
+  }
+
+  g_ptr_array_unref (samples);
+  g_free (manifest);
+  g_free (config_a);
+  g_free (config_b);
+  g_free (plugin_dir);
+  g_free (run_file);
+  return EXIT_SUCCESS;
+}
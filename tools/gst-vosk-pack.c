@@ -0,0 +1,184 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Packs a model directory into a single bundle file that the vosk element
+ * (speech-model property) and the recognition core load with one sequential
+ * read instead of opening every file of the model.
+ *
+ * gst-vosk-pack /path/model /path/model.gvb
+ *
+ * With --benchmark, the load times of the directory and of the bundle are
+ * compared, with the page cache evicted before each run (cold start) or not
+ * (--warm).
+ */
+
+#include "../gst-vosk-config.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <gst/gst.h>
+
+#include "gstvoskcore.h"
+#include "gstvoskbundle.h"
+
+/* Drops the pages of a file or of every file of a directory from the cache */
+static void
+gst_vosk_pack_evict (const gchar *path)
+{
+  if (g_file_test (path, G_FILE_TEST_IS_DIR)) {
+    const gchar *name;
+    GDir *dir;
+
+    dir = g_dir_open (path, 0, NULL);
+    if (!dir)
+      return;
+
+    while ((name = g_dir_read_name (dir))) {
+      gchar *child = g_build_filename (path, name, NULL);
+
+      gst_vosk_pack_evict (child);
+      g_free (child);
+    }
+
+    g_dir_close (dir);
+    return;
+  }
+
+#ifdef HAVE_POSIX_FADVISE
+  {
+    int fd = open (path, O_RDONLY);
+
+    if (fd < 0)
+      return;
+
+    /* Dirty pages are not dropped */
+    fdatasync (fd);
+    posix_fadvise (fd, 0, 0, POSIX_FADV_DONTNEED);
+    close (fd);
+  }
+#endif
+}
+
+static gdouble
+gst_vosk_pack_load_time (const gchar *path,
+                         gboolean cold)
+{
+  GstVoskCore *core;
+  gint64 start;
+  gdouble elapsed;
+
+  if (cold)
+    gst_vosk_pack_evict (path);
+
+  start = g_get_monotonic_time ();
+  core = gst_vosk_core_new (path, NULL);
+  elapsed = (gdouble) (g_get_monotonic_time () - start) / G_USEC_PER_SEC;
+
+  if (!core)
+    return -1.0;
+
+  /* Last user: the model is freed and next run loads it again */
+  gst_vosk_core_free (core);
+  return elapsed;
+}
+
+static gboolean
+gst_vosk_pack_benchmark (const gchar *model_dir,
+                         const gchar *bundle,
+                         gint runs,
+                         gboolean cold)
+{
+  gdouble dir_total = 0.0, bundle_total = 0.0;
+  gint i;
+
+  g_print ("%-6s %12s %12s\n", "run", "directory", "bundle");
+
+  for (i = 0; i < runs; i++) {
+    gdouble dir_time, bundle_time;
+
+    dir_time = gst_vosk_pack_load_time (model_dir, cold);
+    bundle_time = gst_vosk_pack_load_time (bundle, cold);
+    if (dir_time < 0.0 || bundle_time < 0.0) {
+      g_printerr ("could not load %s\n", dir_time < 0.0 ? model_dir : bundle);
+      return FALSE;
+    }
+
+    g_print ("%-6d %11.3fs %11.3fs\n", i + 1, dir_time, bundle_time);
+    dir_total += dir_time;
+    bundle_total += bundle_time;
+  }
+
+  g_print ("%-6s %11.3fs %11.3fs (%s, %+.1f%%)\n",
+           "mean",
+           dir_total / runs,
+           bundle_total / runs,
+           cold ? "cold" : "warm",
+           dir_total > 0.0 ? (bundle_total - dir_total) * 100.0 / dir_total : 0.0);
+  return TRUE;
+}
+
+int
+main (int argc,
+      char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  gboolean benchmark = FALSE;
+  gboolean warm = FALSE;
+  gint runs = 3;
+
+  GOptionEntry entries[] = {
+    { "benchmark", 'b', 0, G_OPTION_ARG_NONE, &benchmark,
+      "Compare the load times of the directory and of the bundle", NULL },
+    { "runs", 'n', 0, G_OPTION_ARG_INT, &runs,
+      "Number of loads of each with --benchmark", "N" },
+    { "warm", 'w', 0, G_OPTION_ARG_NONE, &warm,
+      "Keep the page cache between loads with --benchmark", NULL },
+    G_OPTION_ENTRY_NULL
+  };
+
+  context = g_option_context_new ("MODEL_DIR BUNDLE - pack a vosk model into a single file");
+  g_option_context_add_main_entries (context, entries, NULL);
+  g_option_context_add_group (context, gst_init_get_option_group ());
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("%s\n", error->message);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free (context);
+
+  if (argc != 3 || !g_file_test (argv[1], G_FILE_TEST_IS_DIR)) {
+    g_printerr ("usage: %s MODEL_DIR BUNDLE\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (!gst_vosk_bundle_pack (argv[1], argv[2], &error)) {
+    g_printerr ("%s\n", error->message);
+    return EXIT_FAILURE;
+  }
+
+  g_print ("%s packed into %s\n", argv[1], argv[2]);
+
+  if (benchmark && !gst_vosk_pack_benchmark (argv[1], argv[2], MAX (1, runs), !warm))
+    return EXIT_FAILURE;
+
+  return EXIT_SUCCESS;
+}
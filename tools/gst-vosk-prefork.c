@@ -0,0 +1,312 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Loads models once, then forks worker processes that each run a pipeline.
+ * Workers find the models in the model cache of the process they were forked
+ * from, so they start without loading anything and the pages of the models
+ * are shared between them (copy-on-write) instead of being duplicated.
+ *
+ * gst-vosk-prefork --model /path/model --workers 8 -- \
+ *     filesrc location=in-{worker}.wav ! decodebin ! audioconvert ! audioresample ! \
+ *     vosk speech-model=/path/model ! fakesink
+ *
+ * Model paths must be written exactly as in the pipeline: the cache is
+ * indexed by path. {worker} is replaced by the index of the worker.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <gst/gst.h>
+
+#include "gstvoskcore.h"
+
+static volatile sig_atomic_t terminating = 0;
+
+static void
+gst_vosk_prefork_terminate (int signum G_GNUC_UNUSED)
+{
+  terminating = 1;
+}
+
+/* Without SA_RESTART, so that waitpid () returns to forward the signal */
+static void
+gst_vosk_prefork_set_handler (void (*handler) (int))
+{
+  struct sigaction action;
+
+  memset (&action, 0, sizeof (action));
+  action.sa_handler = handler;
+  sigemptyset (&action.sa_mask);
+
+  sigaction (SIGTERM, &action, NULL);
+  sigaction (SIGINT, &action, NULL);
+}
+
+static gchar *
+gst_vosk_prefork_description (gchar **args,
+                              guint index)
+{
+  gchar *description, *worker, *result;
+  gchar **fields;
+
+  description = g_strjoinv (" ", args);
+  worker = g_strdup_printf ("%u", index);
+
+  fields = g_strsplit (description, "{worker}", -1);
+  result = g_strjoinv (worker, fields);
+
+  g_strfreev (fields);
+  g_free (worker);
+  g_free (description);
+  return result;
+}
+
+/* Runs in the worker process, returns its exit status */
+static int
+gst_vosk_prefork_worker (const gchar *description,
+                         guint index)
+{
+  GstElement *pipeline;
+  GstMessage *message;
+  GError *error = NULL;
+  gboolean playing = FALSE;
+  int status = EXIT_FAILURE;
+  gint64 start;
+  GstBus *bus;
+
+  start = g_get_monotonic_time ();
+
+  pipeline = gst_parse_launch (description, &error);
+  if (!pipeline) {
+    g_printerr ("worker %u: %s\n", index, error->message);
+    g_error_free (error);
+    return EXIT_FAILURE;
+  }
+
+  bus = gst_element_get_bus (pipeline);
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  for (;;) {
+    message = gst_bus_timed_pop_filtered (bus,
+                                          GST_CLOCK_TIME_NONE,
+                                          GST_MESSAGE_EOS |
+                                          GST_MESSAGE_ERROR |
+                                          GST_MESSAGE_ASYNC_DONE);
+
+    if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_ASYNC_DONE) {
+      if (!playing && GST_MESSAGE_SRC (message) == GST_OBJECT (pipeline)) {
+        g_print ("worker %u (pid %d): prerolled after %.3f s\n",
+                 index,
+                 (int) getpid (),
+                 (gdouble) (g_get_monotonic_time () - start) / G_USEC_PER_SEC);
+        playing = TRUE;
+      }
+
+      gst_message_unref (message);
+      continue;
+    }
+
+    if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_ERROR) {
+      gst_message_parse_error (message, &error, NULL);
+      g_printerr ("worker %u: %s\n", index, error->message);
+      g_error_free (error);
+    }
+    else
+      status = EXIT_SUCCESS;
+
+    gst_message_unref (message);
+    break;
+  }
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (bus);
+  gst_object_unref (pipeline);
+  return status;
+}
+
+static pid_t
+gst_vosk_prefork_spawn (gchar **args,
+                        guint index)
+{
+  gchar *description;
+  pid_t pid;
+
+  description = gst_vosk_prefork_description (args, index);
+
+  pid = fork ();
+  if (pid == 0) {
+    gst_vosk_prefork_set_handler (SIG_DFL);
+
+    /* No atexit handler or buffered output of the parent must run twice */
+    _exit (gst_vosk_prefork_worker (description, index));
+  }
+
+  if (pid < 0)
+    g_printerr ("could not start worker %u: %s\n", index, g_strerror (errno));
+
+  g_free (description);
+  return pid;
+}
+
+int
+main (int argc,
+      char **argv)
+{
+  GPtrArray *cores;
+  gchar **models = NULL;
+  gchar *plugin_dir = NULL;
+  GstPluginFeature *feature = NULL;
+  GstElementFactory *factory;
+  GOptionContext *context;
+  GError *error = NULL;
+  gboolean respawn = FALSE;
+  gint num_workers = 0;
+  guint running = 0;
+  gint failures = 0;
+  pid_t *pids;
+  guint i;
+
+  GOptionEntry entries[] = {
+    { "model", 'm', 0, G_OPTION_ARG_FILENAME_ARRAY, &models,
+      "Model loaded before forking (speech, rescoring or model-map model), may be repeated", "PATH" },
+    { "workers", 'w', 0, G_OPTION_ARG_INT, &num_workers,
+      "Number of worker processes (default: number of CPUs)", "N" },
+    { "respawn", 'r', 0, G_OPTION_ARG_NONE, &respawn,
+      "Start a new worker whenever one exits, until terminated", NULL },
+    { "plugin-dir", 'p', 0, G_OPTION_ARG_FILENAME, &plugin_dir,
+      "Directory holding the vosk plugin", "DIR" },
+    G_OPTION_ENTRY_NULL
+  };
+
+  context = g_option_context_new ("-- PIPELINE-DESCRIPTION - run pipelines in processes sharing loaded models");
+  g_option_context_add_main_entries (context, entries, NULL);
+  g_option_context_add_group (context, gst_init_get_option_group ());
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("%s\n", error->message);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free (context);
+
+  if (argc < 2) {
+    g_printerr ("a pipeline description is required\n");
+    return EXIT_FAILURE;
+  }
+
+  if (!models) {
+    g_printerr ("at least one model is required (--model)\n");
+    return EXIT_FAILURE;
+  }
+
+  if (num_workers <= 0)
+    num_workers = g_get_num_processors ();
+
+  if (plugin_dir)
+    gst_registry_scan_path (gst_registry_get (), plugin_dir);
+
+  /* Load the plugin now so that workers do not each do it */
+  factory = gst_element_factory_find ("vosk");
+  if (factory) {
+    feature = gst_plugin_feature_load (GST_PLUGIN_FEATURE (factory));
+    gst_object_unref (factory);
+  }
+
+  if (!feature) {
+    g_printerr ("the vosk element could not be found (use --plugin-dir)\n");
+    return EXIT_FAILURE;
+  }
+  gst_object_unref (feature);
+
+  /* The cores are never started: they only hold the models in the cache
+   * (shared with the plugin through libgstvoskcore) for the workers */
+  cores = g_ptr_array_new_with_free_func ((GDestroyNotify) gst_vosk_core_free);
+  for (i = 0; models[i]; i++) {
+    GstVoskCore *core;
+    gint64 start;
+
+    start = g_get_monotonic_time ();
+    core = gst_vosk_core_new (models[i], NULL);
+    if (!core) {
+      g_printerr ("could not load model %s\n", models[i]);
+      return EXIT_FAILURE;
+    }
+
+    g_print ("%s loaded in %.3f s\n",
+             models[i], (gdouble) (g_get_monotonic_time () - start) / G_USEC_PER_SEC);
+    g_ptr_array_add (cores, core);
+  }
+
+  gst_vosk_prefork_set_handler (gst_vosk_prefork_terminate);
+
+  pids = g_new0 (pid_t, num_workers);
+  for (i = 0; i < (guint) num_workers; i++) {
+    pids[i] = gst_vosk_prefork_spawn (argv + 1, i);
+    if (pids[i] > 0)
+      running++;
+    else
+      failures++;
+  }
+
+  while (running) {
+    int status;
+    pid_t pid;
+
+    pid = waitpid (-1, &status, 0);
+    if (pid < 0) {
+      if (errno != EINTR)
+        break;
+
+      /* Interrupted by SIGTERM or SIGINT */
+      for (i = 0; i < (guint) num_workers; i++) {
+        if (pids[i] > 0)
+          kill (pids[i], SIGTERM);
+      }
+      continue;
+    }
+
+    for (i = 0; i < (guint) num_workers && pids[i] != pid; i++);
+    if (i == (guint) num_workers)
+      continue;
+
+    pids[i] = 0;
+    running--;
+
+    if (!WIFEXITED (status) || WEXITSTATUS (status) != EXIT_SUCCESS) {
+      g_printerr ("worker %u (pid %d) failed\n", i, (int) pid);
+      failures++;
+    }
+
+    if (respawn && !terminating) {
+      pids[i] = gst_vosk_prefork_spawn (argv + 1, i);
+      if (pids[i] > 0)
+        running++;
+    }
+  }
+
+  g_free (pids);
+  g_ptr_array_unref (cores);
+  g_strfreev (models);
+  return failures && !terminating ? EXIT_FAILURE : EXIT_SUCCESS;
+}
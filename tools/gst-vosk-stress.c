@@ -0,0 +1,490 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Runs many vosk elements at once while other threads change their state,
+ * read their properties, flush them, send them EOS and change their caps.
+ * Each element has its own thread drawing its actions and delays from the
+ * seed: the sequence of each thread is the same from one run to the other,
+ * but how the threads interleave (and so the result of an action) is not.
+ * Reports the throughput and the latency of the chain function, and fails if
+ * an element stops answering.
+ *
+ * It is meant to be run with the stub libvosk built in tools/vosk-stub, so
+ * that recognition costs little and results are predictable:
+ *
+ * LD_PRELOAD=build/tools/vosk-stub/libvosk.so \
+ *     gst-vosk-stress --plugin-dir build/src --elements 16 --actions 500 --seed 1
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gstvosktool.h"
+
+typedef enum {
+  GST_VOSK_STRESS_PLAYING,
+  GST_VOSK_STRESS_PAUSED,
+  GST_VOSK_STRESS_READY,
+  GST_VOSK_STRESS_READ_PROPERTIES,
+  GST_VOSK_STRESS_SUSPEND,
+  GST_VOSK_STRESS_FLUSH,
+  GST_VOSK_STRESS_EOS,
+  GST_VOSK_STRESS_CAPS,
+  GST_VOSK_STRESS_NUM_ACTIONS
+} GstVoskStressAction;
+
+static const gchar *action_names[] = {
+  "set state to PLAYING",
+  "set state to PAUSED",
+  "set state to READY",
+  "read properties",
+  "toggle suspended",
+  "flush",
+  "send EOS",
+  "change caps",
+};
+
+typedef struct {
+  guint          index;
+  GRand         *rand;
+  guint          actions;
+  guint          interval;
+
+  GstElement    *pipeline;
+  GstElement    *capsfilter;
+  GstElement    *vosk;
+
+  gint           rate;
+  gboolean       suspended;
+
+  /* Only touched by the streaming thread */
+  gint64         chain_start;
+
+  GMutex         lock;
+  GArray        *latencies;     /* gdouble seconds */
+  guint64        buffers;
+  GstClockTime   audio;
+
+  /* Read by the watchdog, under lock */
+  gint           action;        /* -1 when done */
+  gint64         action_start;  /* monotonic time */
+
+  guint          results;
+  guint          errors;
+} GstVoskStressElement;
+
+static GstPadProbeReturn
+gst_vosk_stress_chain_in (GstPad *pad G_GNUC_UNUSED,
+                          GstPadProbeInfo *info G_GNUC_UNUSED,
+                          gpointer user_data)
+{
+  GstVoskStressElement *element = user_data;
+
+  element->chain_start = g_get_monotonic_time ();
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+gst_vosk_stress_chain_out (GstPad *pad G_GNUC_UNUSED,
+                           GstPadProbeInfo *info,
+                           gpointer user_data)
+{
+  GstVoskStressElement *element = user_data;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  gdouble latency;
+
+  if (!element->chain_start)
+    return GST_PAD_PROBE_OK;
+
+  latency = (gdouble) (g_get_monotonic_time () - element->chain_start) / G_USEC_PER_SEC;
+  element->chain_start = 0;
+
+  g_mutex_lock (&element->lock);
+  g_array_append_val (element->latencies, latency);
+  element->buffers++;
+  if (GST_BUFFER_DURATION_IS_VALID (buffer))
+    element->audio += GST_BUFFER_DURATION (buffer);
+  g_mutex_unlock (&element->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+gst_vosk_stress_set_caps (GstVoskStressElement *element)
+{
+  GstCaps *caps;
+
+  caps = gst_caps_new_simple ("audio/x-raw",
+                              "format", G_TYPE_STRING, "S16LE",
+                              "rate", G_TYPE_INT, element->rate,
+                              "channels", G_TYPE_INT, 1,
+                              NULL);
+  g_object_set (element->capsfilter, "caps", caps, NULL);
+  gst_caps_unref (caps);
+}
+
+static gboolean
+gst_vosk_stress_element_init (GstVoskStressElement *element,
+                              const gchar *model,
+                              guint buffer_duration,
+                              GError **error)
+{
+  gchar *description;
+  GstPad *pad;
+
+  element->rate = 16000;
+
+  /* Not live and not synchronized: buffers flow as fast as they are decoded */
+  description = g_strdup_printf ("audiotestsrc name=src wave=sine samplesperbuffer=%u ! "
+                                 "capsfilter name=caps ! "
+                                 "vosk name=vosk speech-model=\"%s\" partial-results-interval=0 ! "
+                                 "fakesink sync=false",
+                                 16000 * buffer_duration / 1000,
+                                 model);
+  element->pipeline = gst_parse_launch (description, error);
+  g_free (description);
+
+  if (!element->pipeline)
+    return FALSE;
+
+  element->capsfilter = gst_bin_get_by_name (GST_BIN (element->pipeline), "caps");
+  element->vosk = gst_bin_get_by_name (GST_BIN (element->pipeline), "vosk");
+  gst_vosk_stress_set_caps (element);
+
+  pad = gst_element_get_static_pad (element->vosk, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, gst_vosk_stress_chain_in, element, NULL);
+  gst_object_unref (pad);
+
+  pad = gst_element_get_static_pad (element->vosk, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, gst_vosk_stress_chain_out, element, NULL);
+  gst_object_unref (pad);
+
+  g_mutex_init (&element->lock);
+  element->latencies = g_array_new (FALSE, FALSE, sizeof (gdouble));
+  element->action = GST_VOSK_STRESS_PLAYING;
+  element->action_start = g_get_monotonic_time ();
+  return TRUE;
+}
+
+static void
+gst_vosk_stress_element_clear (GstVoskStressElement *element)
+{
+  if (element->pipeline) {
+    gst_element_set_state (element->pipeline, GST_STATE_NULL);
+    gst_object_unref (element->capsfilter);
+    gst_object_unref (element->vosk);
+    gst_object_unref (element->pipeline);
+  }
+
+  if (element->latencies)
+    g_array_unref (element->latencies);
+
+  g_mutex_clear (&element->lock);
+  g_rand_free (element->rand);
+}
+
+/* Drains the bus so that results do not pile up */
+static void
+gst_vosk_stress_check_bus (GstVoskStressElement *element)
+{
+  GstMessage *message;
+  GstBus *bus;
+
+  bus = gst_element_get_bus (element->pipeline);
+  while ((message = gst_bus_pop (bus))) {
+    if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_ERROR) {
+      GError *error = NULL;
+
+      gst_message_parse_error (message, &error, NULL);
+      g_printerr ("element %u: %s\n", element->index, error->message);
+      g_error_free (error);
+      element->errors++;
+    }
+    else if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_ELEMENT &&
+             gst_message_has_name (message, "vosk"))
+      element->results++;
+
+    gst_message_unref (message);
+  }
+  gst_object_unref (bus);
+}
+
+static void
+gst_vosk_stress_run_action (GstVoskStressElement *element,
+                            GstVoskStressAction action)
+{
+  switch (action) {
+    case GST_VOSK_STRESS_PLAYING:
+      gst_element_set_state (element->pipeline, GST_STATE_PLAYING);
+      break;
+
+    case GST_VOSK_STRESS_PAUSED:
+      gst_element_set_state (element->pipeline, GST_STATE_PAUSED);
+      break;
+
+    case GST_VOSK_STRESS_READY:
+      gst_element_set_state (element->pipeline, GST_STATE_READY);
+      break;
+
+    case GST_VOSK_STRESS_READ_PROPERTIES: {
+      GstStructure *stats = NULL;
+      gchar *results = NULL;
+      gchar *final_results = NULL;
+
+      g_object_get (element->vosk,
+                    "stats", &stats,
+                    "current-results", &results,
+                    "current-final-results", &final_results,
+                    NULL);
+      if (stats)
+        gst_structure_free (stats);
+      g_free (results);
+      g_free (final_results);
+      break;
+    }
+
+    case GST_VOSK_STRESS_SUSPEND:
+      element->suspended = !element->suspended;
+      g_object_set (element->vosk, "suspended", element->suspended, NULL);
+      break;
+
+    case GST_VOSK_STRESS_FLUSH:
+      /* Also restarts the stream after EOS */
+      gst_element_seek_simple (element->pipeline,
+                               GST_FORMAT_TIME,
+                               GST_SEEK_FLAG_FLUSH,
+                               0);
+      break;
+
+    case GST_VOSK_STRESS_EOS:
+      gst_element_send_event (element->pipeline, gst_event_new_eos ());
+      break;
+
+    case GST_VOSK_STRESS_CAPS:
+      element->rate = element->rate == 16000 ? 8000 : 16000;
+      gst_vosk_stress_set_caps (element);
+      break;
+
+    default:
+      g_assert_not_reached ();
+  }
+}
+
+static gpointer
+gst_vosk_stress_element_run (gpointer user_data)
+{
+  GstVoskStressElement *element = user_data;
+  guint i;
+
+  gst_element_set_state (element->pipeline, GST_STATE_PLAYING);
+
+  for (i = 0; i < element->actions; i++) {
+    GstVoskStressAction action;
+
+    /* Both are drawn whatever happens, so that the sequence of this thread
+     * only depends on the seed */
+    action = g_rand_int_range (element->rand, 0, GST_VOSK_STRESS_NUM_ACTIONS);
+    g_usleep (g_rand_int_range (element->rand, 0, element->interval * 2 + 1) * 1000);
+
+    g_mutex_lock (&element->lock);
+    element->action = action;
+    element->action_start = g_get_monotonic_time ();
+    g_mutex_unlock (&element->lock);
+
+    gst_vosk_stress_run_action (element, action);
+    gst_vosk_stress_check_bus (element);
+  }
+
+  gst_element_set_state (element->pipeline, GST_STATE_NULL);
+  gst_vosk_stress_check_bus (element);
+
+  g_mutex_lock (&element->lock);
+  element->action = -1;
+  g_mutex_unlock (&element->lock);
+  return NULL;
+}
+
+/* Returns the index of an element stuck for longer than timeout or -1 */
+static gint
+gst_vosk_stress_stuck (GstVoskStressElement *elements,
+                       guint num_elements,
+                       gint64 timeout,
+                       gboolean *done)
+{
+  gint64 now = g_get_monotonic_time ();
+  guint i;
+
+  *done = TRUE;
+  for (i = 0; i < num_elements; i++) {
+    GstVoskStressElement *element = &elements[i];
+    gboolean stuck;
+
+    g_mutex_lock (&element->lock);
+    stuck = element->action >= 0 && now - element->action_start > timeout;
+    if (element->action >= 0)
+      *done = FALSE;
+    g_mutex_unlock (&element->lock);
+
+    if (stuck)
+      return i;
+  }
+
+  return -1;
+}
+
+int
+main (int argc,
+      char **argv)
+{
+  GstVoskStressElement *elements;
+  GThread **threads;
+  gchar *plugin_dir = NULL;
+  gchar *model = NULL;
+  GOptionContext *context;
+  GError *error = NULL;
+  GArray *latencies;
+  GstClockTime audio = 0;
+  guint64 buffers = 0;
+  guint results = 0, errors = 0;
+  gint num_elements = 0;
+  gint actions = 200;
+  gint interval = 20;
+  gint buffer_duration = 20;
+  gint timeout = 10;
+  gint64 seed = 0;
+  gint64 start;
+  gdouble elapsed;
+  gboolean done = FALSE;
+  gint stuck = -1;
+  guint i;
+
+  GOptionEntry entries[] = {
+    { "elements", 'e', 0, G_OPTION_ARG_INT, &num_elements,
+      "Number of elements run at once (default: twice the number of CPUs)", "N" },
+    { "actions", 'a', 0, G_OPTION_ARG_INT, &actions,
+      "Number of actions run on each element", "N" },
+    { "interval", 'i', 0, G_OPTION_ARG_INT, &interval,
+      "Average time between two actions on an element", "MS" },
+    { "buffer-duration", 'b', 0, G_OPTION_ARG_INT, &buffer_duration,
+      "Duration of the buffers fed to the elements", "MS" },
+    { "timeout", 't', 0, G_OPTION_ARG_INT, &timeout,
+      "Time after which an action that has not returned is a deadlock", "SECONDS" },
+    { "seed", 's', 0, G_OPTION_ARG_INT64, &seed,
+      "Seed of the sequence of actions", "SEED" },
+    { "model", 0, 0, G_OPTION_ARG_FILENAME, &model,
+      "Speech model (default: \"stub\", for the stub libvosk)", "DIR" },
+    { "plugin-dir", 'p', 0, G_OPTION_ARG_FILENAME, &plugin_dir,
+      "Directory holding the vosk plugin", "DIR" },
+    G_OPTION_ENTRY_NULL
+  };
+
+  context = g_option_context_new ("- run vosk elements under concurrent state changes");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("%s\n", error->message);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free (context);
+
+  if (num_elements <= 0)
+    num_elements = g_get_num_processors () * 2;
+
+  if (actions < 1 || interval < 0 || buffer_duration < 1 || timeout < 1) {
+    g_printerr ("invalid number of actions, interval, buffer duration or timeout\n");
+    return EXIT_FAILURE;
+  }
+
+  if (!gst_vosk_tool_init (plugin_dir, &error)) {
+    g_printerr ("%s\n", error->message);
+    return EXIT_FAILURE;
+  }
+
+  elements = g_new0 (GstVoskStressElement, num_elements);
+  threads = g_new0 (GThread *, num_elements);
+
+  for (i = 0; i < (guint) num_elements; i++) {
+    elements[i].index = i;
+    elements[i].rand = g_rand_new_with_seed ((guint32) (seed + i));
+    elements[i].actions = actions;
+    elements[i].interval = interval;
+
+    if (!gst_vosk_stress_element_init (&elements[i], model ? model : "stub", buffer_duration, &error)) {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+  }
+
+  g_print ("%d elements, %d actions each, seed %" G_GINT64_FORMAT "\n",
+           num_elements, actions, seed);
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < (guint) num_elements; i++)
+    threads[i] = g_thread_new ("stress", gst_vosk_stress_element_run, &elements[i]);
+
+  while (!done) {
+    g_usleep (G_USEC_PER_SEC / 10);
+
+    stuck = gst_vosk_stress_stuck (elements, num_elements, (gint64) timeout * G_USEC_PER_SEC, &done);
+    if (stuck >= 0)
+      break;
+  }
+
+  if (stuck >= 0) {
+    /* The thread cannot be joined, there is nothing to clean up */
+    g_printerr ("element %d did not %s within %d s: deadlock or stall\n",
+                stuck,
+                action_names[elements[stuck].action],
+                timeout);
+    return EXIT_FAILURE;
+  }
+
+  elapsed = (gdouble) (g_get_monotonic_time () - start) / G_USEC_PER_SEC;
+
+  latencies = g_array_new (FALSE, FALSE, sizeof (gdouble));
+  for (i = 0; i < (guint) num_elements; i++) {
+    g_thread_join (threads[i]);
+
+    g_array_append_vals (latencies, elements[i].latencies->data, elements[i].latencies->len);
+    buffers += elements[i].buffers;
+    audio += elements[i].audio;
+    results += elements[i].results;
+    errors += elements[i].errors;
+
+    gst_vosk_stress_element_clear (&elements[i]);
+  }
+
+  g_print ("%.1f s, %" G_GUINT64_FORMAT " buffers (%.0f/s), %.1f s of audio (%.1fx realtime)\n",
+           elapsed,
+           buffers,
+           buffers / elapsed,
+           (gdouble) audio / GST_SECOND,
+           (gdouble) audio / GST_SECOND / elapsed);
+  g_print ("chain latency: p50 %.3f ms, p99 %.3f ms, p99.9 %.3f ms, max %.3f ms\n",
+           gst_vosk_tool_percentile (latencies, 50.0) * 1000.0,
+           gst_vosk_tool_percentile (latencies, 99.0) * 1000.0,
+           gst_vosk_tool_percentile (latencies, 99.9) * 1000.0,
+           gst_vosk_tool_percentile (latencies, 100.0) * 1000.0);
+  g_print ("%u results, %u errors\n", results, errors);
+
+  g_array_unref (latencies);
+  g_free (threads);
+  g_free (elements);
+  return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
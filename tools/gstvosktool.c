@@ -0,0 +1,552 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <string.h>
+#include <unistd.h>
+
+#include <json-glib/json-glib.h>
+
+#include "gstvosktool.h"
+
+#define GST_VOSK_TOOL_PIPELINE                                     \
+  "filesrc name=src ! decodebin ! audioconvert ! audioresample ! " \
+  "audio/x-raw,format=S16LE,channels=1,rate=%d ! %s %s "           \
+  "vosk name=vosk %s ! fakesink sync=false"
+
+G_DEFINE_QUARK (gst-vosk-tool-error-quark, gst_vosk_tool_error)
+#define GST_VOSK_TOOL_ERROR (gst_vosk_tool_error_quark ())
+
+typedef struct {
+  GMutex      lock;
+  GstElement *vosk;
+  guint64     bytes;
+  gint64      eos_time;
+  GArray     *lags;
+} GstVoskToolProbeData;
+
+gboolean
+gst_vosk_tool_init (const gchar *plugin_dir,
+                    GError **error)
+{
+  GstElementFactory *factory;
+
+  if (!gst_init_check (NULL, NULL, error))
+    return FALSE;
+
+  if (plugin_dir)
+    gst_registry_scan_path (gst_registry_get (), plugin_dir);
+
+  factory = gst_element_factory_find ("vosk");
+  if (!factory) {
+    g_set_error (error, GST_VOSK_TOOL_ERROR, 0,
+                 "the vosk element could not be found (use --plugin-dir)");
+    return FALSE;
+  }
+
+  gst_object_unref (factory);
+  return TRUE;
+}
+
+void
+gst_vosk_tool_sample_free (GstVoskToolSample *sample)
+{
+  g_free (sample->audio);
+  g_free (sample->reference);
+  g_free (sample);
+}
+
+GPtrArray *
+gst_vosk_tool_load_manifest (const gchar *path,
+                             GError **error)
+{
+  GPtrArray *samples;
+  gchar *contents;
+  gchar **lines;
+  gchar *dirname;
+  guint i;
+
+  if (!g_file_get_contents (path, &contents, NULL, error))
+    return NULL;
+
+  samples = g_ptr_array_new_with_free_func ((GDestroyNotify) gst_vosk_tool_sample_free);
+  dirname = g_path_get_dirname (path);
+  lines = g_strsplit (contents, "\n", -1);
+
+  for (i = 0; lines[i]; i++) {
+    GstVoskToolSample *sample;
+    gchar **fields;
+    gchar *line;
+
+    line = g_strstrip (lines[i]);
+    if (line[0] == '\0' || line[0] == '#')
+      continue;
+
+    fields = g_strsplit (line, "\t", 2);
+    if (!fields[0] || !fields[1]) {
+      g_set_error (error, GST_VOSK_TOOL_ERROR, 0,
+                   "%s:%u: expected \"audio<TAB>reference\"", path, i + 1);
+      g_strfreev (fields);
+      g_ptr_array_unref (samples);
+      samples = NULL;
+      break;
+    }
+
+    sample = g_new0 (GstVoskToolSample, 1);
+    if (g_path_is_absolute (fields[0]))
+      sample->audio = g_strdup (fields[0]);
+    else
+      sample->audio = g_build_filename (dirname, fields[0], NULL);
+    sample->reference = g_strdup (g_strstrip (fields[1]));
+    g_ptr_array_add (samples, sample);
+
+    g_strfreev (fields);
+  }
+
+  g_strfreev (lines);
+  g_free (dirname);
+  g_free (contents);
+  return samples;
+}
+
+void
+gst_vosk_tool_run_clear (GstVoskToolRun *run)
+{
+  g_free (run->hypothesis);
+  g_free (run->error);
+  if (run->lags)
+    g_array_unref (run->lags);
+
+  memset (run, 0, sizeof (GstVoskToolRun));
+}
+
+/* Returns the text of a final result, NULL for partial results */
+static gchar *
+gst_vosk_tool_result_text (const gchar *json_txt)
+{
+  JsonParser *parser;
+  JsonObject *object;
+  gchar *text = NULL;
+
+  parser = json_parser_new ();
+  if (!json_parser_load_from_data (parser, json_txt, -1, NULL) ||
+      !JSON_NODE_HOLDS_OBJECT (json_parser_get_root (parser)))
+    goto end;
+
+  object = json_node_get_object (json_parser_get_root (parser));
+  if (json_object_has_member (object, "alternatives")) {
+    JsonArray *alternatives;
+
+    alternatives = json_object_get_array_member (object, "alternatives");
+    if (!alternatives || !json_array_get_length (alternatives))
+      goto end;
+
+    object = json_array_get_object_element (alternatives, 0);
+  }
+
+  if (object && json_object_has_member (object, "text"))
+    text = g_strdup (json_object_get_string_member (object, "text"));
+
+end:
+  g_object_unref (parser);
+  return text;
+}
+
+static GstPadProbeReturn
+gst_vosk_tool_sink_probe (GstPad *pad,
+                          GstPadProbeInfo *info,
+                          gpointer user_data)
+{
+  GstVoskToolProbeData *data = user_data;
+
+  g_mutex_lock (&data->lock);
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER)
+    data->bytes += gst_buffer_get_size (GST_PAD_PROBE_INFO_BUFFER (info));
+  else if (GST_EVENT_TYPE (GST_PAD_PROBE_INFO_EVENT (info)) == GST_EVENT_EOS)
+    data->eos_time = g_get_monotonic_time ();
+
+  g_mutex_unlock (&data->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+/* Called once the element is done with a buffer */
+static GstPadProbeReturn
+gst_vosk_tool_src_probe (GstPad *pad,
+                         GstPadProbeInfo *info,
+                         gpointer user_data)
+{
+  GstVoskToolProbeData *data = user_data;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstClockTime running_time;
+  gdouble lag;
+
+  running_time = gst_element_get_current_running_time (data->vosk);
+  if (!GST_CLOCK_TIME_IS_VALID (running_time) ||
+      !GST_BUFFER_PTS_IS_VALID (buffer))
+    return GST_PAD_PROBE_OK;
+
+  lag = (gdouble) GST_CLOCK_DIFF (GST_BUFFER_PTS (buffer), running_time) / GST_SECOND;
+
+  g_mutex_lock (&data->lock);
+  g_array_append_val (data->lags, lag);
+  g_mutex_unlock (&data->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+void
+gst_vosk_tool_run_file (const gchar *audio,
+                        const gchar *config,
+                        gint rate,
+                        gint chunk_duration,
+                        gboolean realtime,
+                        GstVoskToolRun *run)
+{
+  GstVoskToolProbeData data = { 0, };
+  GstElement *pipeline, *src;
+  gint64 start, last_result = -1;
+  GString *hypothesis;
+  GError *error = NULL;
+  gboolean done = FALSE;
+  gchar *description;
+  gchar *chunker;
+  GstPad *pad;
+  GstBus *bus;
+
+  memset (run, 0, sizeof (GstVoskToolRun));
+  run->first_result_latency = -1.0;
+
+  if (chunk_duration > 0)
+    chunker = g_strdup_printf ("audiobuffersplit output-buffer-duration=%d/1000 !",
+                               chunk_duration);
+  else
+    chunker = g_strdup ("");
+
+  description = g_strdup_printf (GST_VOSK_TOOL_PIPELINE,
+                                 rate,
+                                 chunker,
+                                 realtime ? "identity sync=true !" : "",
+                                 config ? config : "");
+  pipeline = gst_parse_launch (description, &error);
+  g_free (description);
+  g_free (chunker);
+
+  if (!pipeline) {
+    run->error = g_strdup (error->message);
+    g_error_free (error);
+    return;
+  }
+
+  src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  g_object_set (src, "location", audio, NULL);
+  gst_object_unref (src);
+
+  g_mutex_init (&data.lock);
+  data.vosk = gst_bin_get_by_name (GST_BIN (pipeline), "vosk");
+  data.lags = g_array_new (FALSE, FALSE, sizeof (gdouble));
+
+  pad = gst_element_get_static_pad (data.vosk, "sink");
+  gst_pad_add_probe (pad,
+                     GST_PAD_PROBE_TYPE_BUFFER|GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                     gst_vosk_tool_sink_probe,
+                     &data,
+                     NULL);
+  gst_object_unref (pad);
+
+  if (realtime) {
+    pad = gst_element_get_static_pad (data.vosk, "src");
+    gst_pad_add_probe (pad,
+                       GST_PAD_PROBE_TYPE_BUFFER,
+                       gst_vosk_tool_src_probe,
+                       &data,
+                       NULL);
+    gst_object_unref (pad);
+  }
+
+  hypothesis = g_string_new (NULL);
+  bus = gst_element_get_bus (pipeline);
+
+  start = g_get_monotonic_time ();
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  while (!done) {
+    const GstStructure *structure;
+    GstMessage *message;
+    const gchar *json_txt;
+    gchar *text;
+
+    message = gst_bus_timed_pop_filtered (bus,
+                                          GST_CLOCK_TIME_NONE,
+                                          GST_MESSAGE_ERROR|GST_MESSAGE_EOS|GST_MESSAGE_ELEMENT);
+
+    switch (GST_MESSAGE_TYPE (message)) {
+      case GST_MESSAGE_ERROR:
+        gst_message_parse_error (message, &error, NULL);
+        run->error = g_strdup (error->message);
+        g_clear_error (&error);
+        done = TRUE;
+        break;
+
+      case GST_MESSAGE_EOS:
+        done = TRUE;
+        break;
+
+      case GST_MESSAGE_ELEMENT:
+        structure = gst_message_get_structure (message);
+        if (!gst_structure_has_name (structure, "vosk"))
+          break;
+
+        json_txt = gst_structure_get_string (structure, "current-result");
+        if (!json_txt)
+          break;
+
+        text = gst_vosk_tool_result_text (json_txt);
+        if (!text)
+          break;
+
+        last_result = g_get_monotonic_time ();
+        if (run->first_result_latency < 0.0)
+          run->first_result_latency = (gdouble) (last_result - start) / G_USEC_PER_SEC;
+
+        if (text[0] != '\0') {
+          if (hypothesis->len)
+            g_string_append_c (hypothesis, ' ');
+          g_string_append (hypothesis, text);
+        }
+        g_free (text);
+        break;
+
+      default:
+        break;
+    }
+
+    gst_message_unref (message);
+  }
+
+  run->wall_time = (gdouble) (g_get_monotonic_time () - start) / G_USEC_PER_SEC;
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (bus);
+
+  run->hypothesis = g_string_free (hypothesis, FALSE);
+  run->audio_bytes = data.bytes;
+  run->audio_duration = (gdouble) data.bytes / sizeof (gint16) / rate;
+  if (data.eos_time > 0 && last_result >= data.eos_time)
+    run->final_latency = (gdouble) (last_result - data.eos_time) / G_USEC_PER_SEC;
+
+  if (realtime)
+    run->lags = data.lags;
+  else
+    g_array_unref (data.lags);
+
+  gst_object_unref (data.vosk);
+  gst_object_unref (pipeline);
+  g_mutex_clear (&data.lock);
+}
+
+guint
+gst_vosk_tool_edit_distance (const guint32 *reference,
+                             guint reference_len,
+                             const guint32 *hypothesis,
+                             guint hypothesis_len)
+{
+  guint *previous, *current, *tmp;
+  guint distance;
+  guint i, j;
+
+  previous = g_new (guint, hypothesis_len + 1);
+  current = g_new (guint, hypothesis_len + 1);
+
+  for (j = 0; j <= hypothesis_len; j++)
+    previous[j] = j;
+
+  for (i = 1; i <= reference_len; i++) {
+    current[0] = i;
+    for (j = 1; j <= hypothesis_len; j++) {
+      guint substitution = previous[j - 1] + (reference[i - 1] != hypothesis[j - 1]);
+      guint deletion = previous[j] + 1;
+      guint insertion = current[j - 1] + 1;
+
+      current[j] = MIN (substitution, MIN (deletion, insertion));
+    }
+
+    tmp = previous;
+    previous = current;
+    current = tmp;
+  }
+
+  distance = previous[hypothesis_len];
+  g_free (previous);
+  g_free (current);
+  return distance;
+}
+
+/* Lower case, punctuation removed, words separated by single spaces */
+static gchar *
+gst_vosk_tool_normalize (const gchar *text)
+{
+  GString *normalized;
+  gboolean space = TRUE;
+  gchar *lower;
+  const gchar *p;
+
+  lower = g_utf8_strdown (text, -1);
+  normalized = g_string_new (NULL);
+
+  for (p = lower; *p; p = g_utf8_next_char (p)) {
+    gunichar c = g_utf8_get_char (p);
+
+    if (g_unichar_isspace (c) || (g_unichar_ispunct (c) && c != '\'')) {
+      space = TRUE;
+      continue;
+    }
+
+    if (space && normalized->len)
+      g_string_append_c (normalized, ' ');
+
+    g_string_append_unichar (normalized, c);
+    space = FALSE;
+  }
+
+  g_free (lower);
+  return g_string_free (normalized, FALSE);
+}
+
+static GArray *
+gst_vosk_tool_word_ids (const gchar *text,
+                        GHashTable *words)
+{
+  GArray *ids;
+  gchar **tokens;
+  guint i;
+
+  ids = g_array_new (FALSE, FALSE, sizeof (guint32));
+  tokens = g_strsplit (text, " ", -1);
+
+  for (i = 0; tokens[i]; i++) {
+    guint32 id;
+
+    if (tokens[i][0] == '\0')
+      continue;
+
+    id = GPOINTER_TO_UINT (g_hash_table_lookup (words, tokens[i]));
+    if (!id) {
+      id = g_hash_table_size (words) + 1;
+      g_hash_table_insert (words, g_strdup (tokens[i]), GUINT_TO_POINTER (id));
+    }
+
+    g_array_append_val (ids, id);
+  }
+
+  g_strfreev (tokens);
+  return ids;
+}
+
+void
+gst_vosk_tool_word_errors (const gchar *reference,
+                           const gchar *hypothesis,
+                           guint *errors,
+                           guint *length)
+{
+  GArray *reference_ids, *hypothesis_ids;
+  gchar *normalized;
+  GHashTable *words;
+
+  words = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  normalized = gst_vosk_tool_normalize (reference);
+  reference_ids = gst_vosk_tool_word_ids (normalized, words);
+  g_free (normalized);
+
+  normalized = gst_vosk_tool_normalize (hypothesis ? hypothesis : "");
+  hypothesis_ids = gst_vosk_tool_word_ids (normalized, words);
+  g_free (normalized);
+
+  *errors = gst_vosk_tool_edit_distance ((guint32 *) reference_ids->data,
+                                         reference_ids->len,
+                                         (guint32 *) hypothesis_ids->data,
+                                         hypothesis_ids->len);
+  *length = reference_ids->len;
+
+  g_array_unref (reference_ids);
+  g_array_unref (hypothesis_ids);
+  g_hash_table_unref (words);
+}
+
+void
+gst_vosk_tool_char_errors (const gchar *reference,
+                           const gchar *hypothesis,
+                           guint *errors,
+                           guint *length)
+{
+  gunichar *reference_chars, *hypothesis_chars;
+  glong reference_len, hypothesis_len;
+  gchar *normalized;
+
+  normalized = gst_vosk_tool_normalize (reference);
+  reference_chars = g_utf8_to_ucs4_fast (normalized, -1, &reference_len);
+  g_free (normalized);
+
+  normalized = gst_vosk_tool_normalize (hypothesis ? hypothesis : "");
+  hypothesis_chars = g_utf8_to_ucs4_fast (normalized, -1, &hypothesis_len);
+  g_free (normalized);
+
+  *errors = gst_vosk_tool_edit_distance (reference_chars,
+                                         reference_len,
+                                         hypothesis_chars,
+                                         hypothesis_len);
+  *length = reference_len;
+
+  g_free (reference_chars);
+  g_free (hypothesis_chars);
+}
+
+static gint
+gst_vosk_tool_compare_double (gconstpointer a,
+                              gconstpointer b)
+{
+  gdouble value_a = *(const gdouble *) a;
+  gdouble value_b = *(const gdouble *) b;
+
+  return value_a < value_b ? -1 : (value_a > value_b ? 1 : 0);
+}
+
+/* Nearest rank percentile (0 to 100) of an array of doubles */
+gdouble
+gst_vosk_tool_percentile (GArray *values,
+                          gdouble percentile)
+{
+  GArray *sorted;
+  gdouble result;
+  guint rank;
+
+  if (!values || !values->len)
+    return 0.0;
+
+  sorted = g_array_sized_new (FALSE, FALSE, sizeof (gdouble), values->len);
+  g_array_append_vals (sorted, values->data, values->len);
+  g_array_sort (sorted, gst_vosk_tool_compare_double);
+
+  rank = (guint) (percentile / 100.0 * sorted->len + 0.5);
+  rank = CLAMP (rank, 1, sorted->len);
+  result = g_array_index (sorted, gdouble, rank - 1);
+
+  g_array_unref (sorted);
+  return result;
+}
@@ -0,0 +1,91 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GST_VOSK_TOOL_H__
+#define __GST_VOSK_TOOL_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* One line of a corpus manifest: audio path <TAB> reference transcript */
+typedef struct {
+  gchar *audio;
+  gchar *reference;
+} GstVoskToolSample;
+
+/* What was measured while running one audio file through the element */
+typedef struct {
+  gchar   *hypothesis;
+  guint64  audio_bytes;
+  gdouble  audio_duration;        /* seconds */
+  gdouble  wall_time;             /* seconds */
+  gdouble  first_result_latency;  /* seconds since start, < 0 if no result */
+  gdouble  final_latency;         /* seconds between EOS and last result */
+  GArray  *lags;                  /* gdouble seconds, only in realtime mode */
+  gchar   *error;
+} GstVoskToolRun;
+
+GPtrArray *gst_vosk_tool_load_manifest (const gchar *path,
+                                        GError **error);
+
+void gst_vosk_tool_sample_free (GstVoskToolSample *sample);
+
+void gst_vosk_tool_run_clear (GstVoskToolRun *run);
+
+/*
+ * Runs one audio file through a pipeline ending with a vosk element whose
+ * properties are set from config ("prop=value prop=value").
+ * If chunk_duration (ms) is not 0, audio is fed to the element in buffers of
+ * that duration (requires audiobuffersplit).
+ * In realtime mode, buffers are released at their running time and the lag
+ * of each buffer after recognition is recorded.
+ */
+void gst_vosk_tool_run_file (const gchar *audio,
+                             const gchar *config,
+                             gint rate,
+                             gint chunk_duration,
+                             gboolean realtime,
+                             GstVoskToolRun *run);
+
+guint gst_vosk_tool_edit_distance (const guint32 *reference,
+                                   guint reference_len,
+                                   const guint32 *hypothesis,
+                                   guint hypothesis_len);
+
+/* Counts word (or character) errors and the reference length */
+void gst_vosk_tool_word_errors (const gchar *reference,
+                                const gchar *hypothesis,
+                                guint *errors,
+                                guint *length);
+
+void gst_vosk_tool_char_errors (const gchar *reference,
+                                const gchar *hypothesis,
+                                guint *errors,
+                                guint *length);
+
+gdouble gst_vosk_tool_percentile (GArray *values,
+                                  gdouble percentile);
+
+gboolean gst_vosk_tool_init (const gchar *plugin_dir,
+                             GError **error);
+
+G_END_DECLS
+
+#endif /* __GST_VOSK_TOOL_H__ */
@@ -0,0 +1,350 @@
+/*
+ * GStreamer Vosk plugin
+ * Copyright (C) 2022 Philippe Rouquier <bonfire-app@wanadoo.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * A libvosk that does not recognize anything, for gst-vosk-stress: it closes
+ * an utterance every STUB_UTTERANCE_SECONDS of audio and spends a fixed,
+ * configurable amount of CPU per sample (GST_VOSK_STUB_COST, in nanoseconds,
+ * approximately). Results only depend on the audio length, so that runs can
+ * be compared.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include "vosk-api.h"
+
+#define STUB_UTTERANCE_SECONDS 2
+#define STUB_DEFAULT_COST 50
+#define STUB_RESULT_SIZE 256
+
+struct VoskModel {
+  int unused;
+};
+
+struct VoskRecognizer {
+  float rate;
+  long  utterance;
+  long  utterance_samples;
+  long  samples;                /* since the recognizer was created */
+  char  result[STUB_RESULT_SIZE];
+};
+
+struct VoskBatchModel {
+  int unused;
+};
+
+struct VoskBatchRecognizer {
+  VoskRecognizer  recognizer;
+  char          (*results)[STUB_RESULT_SIZE];
+  int             num_results;
+};
+
+static long
+stub_cost (void)
+{
+  static long cost = -1;
+  const char *env;
+
+  if (cost >= 0)
+    return cost;
+
+  env = getenv ("GST_VOSK_STUB_COST");
+  cost = env ? atol (env) : STUB_DEFAULT_COST;
+  return cost;
+}
+
+/* Busy wait rather than sleep: the point is to load the CPU */
+static void
+stub_spend (long samples)
+{
+  struct timespec start, now;
+  long budget = samples * stub_cost ();
+
+  if (budget <= 0)
+    return;
+
+  clock_gettime (CLOCK_THREAD_CPUTIME_ID, &start);
+  do
+    clock_gettime (CLOCK_THREAD_CPUTIME_ID, &now);
+  while ((now.tv_sec - start.tv_sec) * 1000000000L + (now.tv_nsec - start.tv_nsec) < budget);
+}
+
+/* Final results have one word spanning the utterance, timed like libvosk
+ * does: on the audio the recognizer decoded */
+static const char *
+stub_text (VoskRecognizer *recognizer,
+           const char *member)
+{
+  if (strcmp (member, "text"))
+    snprintf (recognizer->result, sizeof (recognizer->result),
+              "{\n  \"%s\" : \"utterance %ld\"\n}", member, recognizer->utterance);
+  else
+    snprintf (recognizer->result, sizeof (recognizer->result),
+              "{\n  \"result\" : [{\n      \"conf\" : 1.000000,\n"
+              "      \"end\" : %.6f,\n      \"start\" : %.6f,\n"
+              "      \"word\" : \"utterance\"\n    }],\n"
+              "  \"text\" : \"utterance %ld\"\n}",
+              recognizer->samples / recognizer->rate,
+              (recognizer->samples - recognizer->utterance_samples) / recognizer->rate,
+              recognizer->utterance);
+
+  return recognizer->result;
+}
+
+/* Returns 1 when the utterance ends */
+static int
+stub_accept (VoskRecognizer *recognizer,
+             int length)
+{
+  long samples = length / 2;
+
+  stub_spend (samples);
+
+  recognizer->utterance_samples += samples;
+  recognizer->samples += samples;
+  if (recognizer->utterance_samples < recognizer->rate * STUB_UTTERANCE_SECONDS)
+    return 0;
+
+  stub_text (recognizer, "text");
+  recognizer->utterance++;
+  recognizer->utterance_samples = 0;
+  return 1;
+}
+
+VoskModel *
+vosk_model_new (const char *model_path)
+{
+  if (!model_path)
+    return NULL;
+
+  return calloc (1, sizeof (VoskModel));
+}
+
+void
+vosk_model_free (VoskModel *model)
+{
+  free (model);
+}
+
+int
+vosk_model_find_word (VoskModel *model G_GNUC_UNUSED,
+                      const char *word G_GNUC_UNUSED)
+{
+  return -1;
+}
+
+VoskRecognizer *
+vosk_recognizer_new (VoskModel *model,
+                     float sample_rate)
+{
+  VoskRecognizer *recognizer;
+
+  if (!model || sample_rate <= 0)
+    return NULL;
+
+  recognizer = calloc (1, sizeof (VoskRecognizer));
+  recognizer->rate = sample_rate;
+  return recognizer;
+}
+
+VoskRecognizer *
+vosk_recognizer_new_grm (VoskModel *model,
+                         float sample_rate,
+                         const char *grammar G_GNUC_UNUSED)
+{
+  return vosk_recognizer_new (model, sample_rate);
+}
+
+void
+vosk_recognizer_set_max_alternatives (VoskRecognizer *recognizer G_GNUC_UNUSED,
+                                      int max_alternatives G_GNUC_UNUSED)
+{
+}
+
+void
+vosk_recognizer_set_words (VoskRecognizer *recognizer G_GNUC_UNUSED,
+                           int words G_GNUC_UNUSED)
+{
+}
+
+void
+vosk_recognizer_set_partial_words (VoskRecognizer *recognizer G_GNUC_UNUSED,
+                                   int partial_words G_GNUC_UNUSED)
+{
+}
+
+int
+vosk_recognizer_accept_waveform (VoskRecognizer *recognizer,
+                                 const char *data G_GNUC_UNUSED,
+                                 int length)
+{
+  if (!recognizer || length < 0)
+    return -1;
+
+  return stub_accept (recognizer, length);
+}
+
+const char *
+vosk_recognizer_result (VoskRecognizer *recognizer)
+{
+  /* Set by the last end of utterance */
+  if (recognizer->result[0] == '\0')
+    return "{\n  \"text\" : \"\"\n}";
+
+  return recognizer->result;
+}
+
+const char *
+vosk_recognizer_partial_result (VoskRecognizer *recognizer)
+{
+  if (!recognizer->utterance_samples)
+    return "{\n  \"partial\" : \"\"\n}";
+
+  return stub_text (recognizer, "partial");
+}
+
+const char *
+vosk_recognizer_final_result (VoskRecognizer *recognizer)
+{
+  if (!recognizer->utterance_samples)
+    return "{\n  \"text\" : \"\"\n}";
+
+  stub_text (recognizer, "text");
+  recognizer->utterance++;
+  recognizer->utterance_samples = 0;
+  return recognizer->result;
+}
+
+void
+vosk_recognizer_reset (VoskRecognizer *recognizer)
+{
+  recognizer->utterance_samples = 0;
+  recognizer->result[0] = '\0';
+}
+
+void
+vosk_recognizer_free (VoskRecognizer *recognizer)
+{
+  free (recognizer);
+}
+
+void
+vosk_set_log_level (int log_level G_GNUC_UNUSED)
+{
+}
+
+VoskBatchModel *
+vosk_batch_model_new (void)
+{
+  return calloc (1, sizeof (VoskBatchModel));
+}
+
+void
+vosk_batch_model_free (VoskBatchModel *model)
+{
+  free (model);
+}
+
+void
+vosk_batch_model_wait (VoskBatchModel *model G_GNUC_UNUSED)
+{
+}
+
+VoskBatchRecognizer *
+vosk_batch_recognizer_new (VoskBatchModel *model,
+                           float sample_rate)
+{
+  VoskBatchRecognizer *recognizer;
+
+  if (!model || sample_rate <= 0)
+    return NULL;
+
+  recognizer = calloc (1, sizeof (VoskBatchRecognizer));
+  recognizer->recognizer.rate = sample_rate;
+  return recognizer;
+}
+
+void
+vosk_batch_recognizer_free (VoskBatchRecognizer *recognizer)
+{
+  if (!recognizer)
+    return;
+
+  free (recognizer->results);
+  free (recognizer);
+}
+
+static void
+stub_batch_add_result (VoskBatchRecognizer *recognizer)
+{
+  recognizer->results = realloc (recognizer->results,
+                                 (recognizer->num_results + 1) * STUB_RESULT_SIZE);
+  memcpy (recognizer->results[recognizer->num_results],
+          recognizer->recognizer.result,
+          STUB_RESULT_SIZE);
+  recognizer->num_results++;
+}
+
+void
+vosk_batch_recognizer_accept_waveform (VoskBatchRecognizer *recognizer,
+                                       const char *data G_GNUC_UNUSED,
+                                       int length)
+{
+  if (stub_accept (&recognizer->recognizer, length))
+    stub_batch_add_result (recognizer);
+}
+
+void
+vosk_batch_recognizer_finish_stream (VoskBatchRecognizer *recognizer)
+{
+  if (!recognizer->recognizer.utterance_samples)
+    return;
+
+  vosk_recognizer_final_result (&recognizer->recognizer);
+  stub_batch_add_result (recognizer);
+}
+
+const char *
+vosk_batch_recognizer_front_result (VoskBatchRecognizer *recognizer)
+{
+  return recognizer->num_results ? recognizer->results[0] : "";
+}
+
+void
+vosk_batch_recognizer_pop (VoskBatchRecognizer *recognizer)
+{
+  if (!recognizer->num_results)
+    return;
+
+  recognizer->num_results--;
+  memmove (recognizer->results,
+           recognizer->results + 1,
+           recognizer->num_results * STUB_RESULT_SIZE);
+}
+
+int
+vosk_batch_recognizer_get_pending_chunks (VoskBatchRecognizer *recognizer G_GNUC_UNUSED)
+{
+  return 0;
+}